@@ -2,23 +2,63 @@
    Railway Ticket Booker with:
     - Duplicate booking prevention
     - QR code generation (libqrencode if available; fallback ASCII otherwise)
+    - Payment step between seat hold and confirmation (pluggable gateway)
+    - Per-thread commit journals, replayed in sequence order after a crash
+    - Traffic capture (RB_CAPTURE) and replay against later builds
+    - Per-stage span tracing of bookings and cancellations (RB_TRACE, Chrome trace format)
+    - Station autocomplete ranked by traffic, tolerant of one typo
+    - Many operators (tenants) served at once from shared workers, each with its own catalog, store and quotas
+    - Passenger accounts with a per-account booking list and session tokens
+    - Per-passenger velocity limits against ticket touting
+    - Live top booking names, accounts and trains (count-min sketch, lock-free)
+    - One journey per passenger, date and route across trains (RB_DUP_SAME_DAY)
+    - Occupancy-banded dynamic fares with band-change events
+    - Train listings served from a generation-stamped response cache
 
    Compile (Linux with libqrencode installed):
-     gcc railway_booking_qr.c -o railway_booking_qr -lqrencode
+     gcc railway_booking_qr.c -o railway_booking_qr -pthread -lqrencode
 
    Compile without libqrencode:
-     gcc railway_booking_qr.c -o railway_booking_qr
+     gcc railway_booking_qr.c -o railway_booking_qr -pthread
+
+   Benchmarks:
+     ./railway_booking_qr bench [name] [args...]
 
    Notes:
     - On Debian/Ubuntu: sudo apt install libqrencode-dev
     - On Windows (MSYS2 / MinGW): install qrencode package or compile libqrencode and link.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* copy_file_range */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#else
+#include <io.h>
+#ifndef S_ISDIR
+#define S_ISDIR(m) (((m) & S_IFMT) == S_IFDIR)
+#endif
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/perf_event.h>
+#endif
 
 /* If libqrencode is available on your system, define HAVE_QRENCODE (or compile with -DHAVE_QRENCODE)
    and link with -lqrencode. The code will then produce a PBM image file with the QR.
@@ -30,17 +70,106 @@
 #define MAX_NAME 100
 #define MAX_CLASS 20
 #define BOOKINGS_FILE "bookings.dat"
+#define INDEX_FILE "bookings.idx"
 #define MAX_TRAINS 5
 
+#ifdef _WIN32
+#define rb_fseek _fseeki64
+#else
+#define rb_fseek fseeko
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define rb_prefetch(p) __builtin_prefetch(p)
+#else
+#define rb_prefetch(p) ((void)(p))
+#endif
+
+/* Field order matches the portable on-disk record below, so on little-endian hosts a
+   record is read with one memcpy */
 typedef struct {
     int booking_id;
-    char passenger_name[MAX_NAME];
     int age;
-    char gender[10];
     int train_id;
+    int journey_date;           /* YYYYMMDD, 0 = not recorded (pre-archive bookings) */
+    char passenger_name[MAX_NAME];
+    char gender[10];
     char travel_class[MAX_CLASS];
+    int owner_id;               /* account that booked it, 0 = none */
 } Booking;
 
+/* bookings.dat format. All integers are little-endian.
+   Header:
+      0  char magic[8]      "RBSNAP1"
+      8  u32 version
+     12  u32 record_size
+     16  u64 record count
+     24  u64 seq            bumped on every save (version 3 and later)
+   Version 5 is followed by plain records, version 6 by LZ blocks of them.
+   Portable record (DISK_RECORD_SIZE bytes):
+      0  u32 booking_id
+      4  i32 age
+      8  u32 train_id
+     12  u32 journey_date
+     16  char passenger_name[100]     NUL-terminated
+    116  char gender[10]
+    126  char travel_class[20]
+    146  2 zero bytes
+    148  u32 owner_id
+    152  u32 checksum32 of bytes 0..151
+   Older layouts are still read (and converted by 'migrate'):
+     version 0: no header, 144-byte raw struct dump from the original program
+     version 1: 24-byte header (no seq), 148-byte raw struct with journey_date
+     version 2: as version 1, in LZ blocks
+     version 3: 152-byte portable records without owner_id, checksum at 148
+     version 4: as version 3, in LZ blocks
+*/
+#define SNAPSHOT_MAGIC "RBSNAP1"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_VERSION_LZ 6       /* records grouped into LZ-compressed blocks */
+#define SNAPSHOT_V3 3               /* first version with a seq and portable records */
+#define SNAPSHOT_HEADER_SIZE 32
+#define SNAPSHOT_V1_HEADER_SIZE 24
+#define SNAP_BLOCK_RECORDS 512
+
+#define DISK_RECORD_SIZE 156
+#define DISK_NAME_OFF 16
+#define DISK_NAME_LEN 100
+#define DISK_GENDER_OFF 116
+#define DISK_GENDER_LEN 10
+#define DISK_CLASS_OFF 126
+#define DISK_CLASS_LEN 20
+#define DISK_PAD_OFF 146
+#define DISK_OWNER_OFF 148
+#define DISK_CHECKED_LEN 152
+#define DISK_CHECKSUM_OFF 152
+#define V3_RECORD_SIZE 152          /* versions 3 and 4: checksum of 0..147 at 148 */
+#define V3_CHECKED_LEN 148
+
+#define V0_RECORD_SIZE 144          /* id@0 name@4 age@104 gender@108 train@120 class@124 */
+#define V1_RECORD_SIZE 148          /* as version 0, plus journey_date@144 */
+
+/* True when Booking is byte-for-byte the first DISK_CHECKED_LEN bytes of a record */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BOOKING_IS_DISK_LAYOUT (MAX_NAME == DISK_NAME_LEN && MAX_CLASS == DISK_CLASS_LEN && \
+    offsetof(Booking, passenger_name) == DISK_NAME_OFF && offsetof(Booking, gender) == DISK_GENDER_OFF && \
+    offsetof(Booking, travel_class) == DISK_CLASS_OFF && offsetof(Booking, owner_id) == DISK_OWNER_OFF && \
+    sizeof(Booking) == DISK_CHECKED_LEN)
+#else
+#define BOOKING_IS_DISK_LAYOUT 0
+#endif
+
+/* Where the records of a snapshot file start and how big they are */
+typedef struct {
+    int version;                /* 0 = legacy headerless file */
+    long long data_off;
+    int rec_size;
+    long long count;            /* whole records present in the file */
+    long long tail;             /* trailing bytes that do not form a whole record */
+    long long header_count;     /* count claimed by the header (-1 for legacy files) */
+    unsigned long long seq;
+} SnapshotInfo;
+
 typedef struct Node {
     Booking b;
     struct Node *next;
@@ -53,18 +182,125 @@ typedef struct {
     char from[50];
     char to[50];
     int total_seats;
+    int fare;           /* base fare in rupees */
 } Train;
 
-Train trains[MAX_TRAINS] = {
-    {1, "Express A", "Mumbai", "Delhi", 100},
-    {2, "Superfast B", "Kolkata", "Bangalore", 80},
-    {3, "Intercity C", "Chennai", "Hyderabad", 60},
-    {4, "Mail D", "Jaipur", "Lucknow", 50},
-    {5, "Shatabdi E", "Ahmedabad", "Pune", 90}
+/* Catalog of operators without a trains.txt of their own */
+const Train default_trains[MAX_TRAINS] = {
+    {1, "Express A", "Mumbai", "Delhi", 100, 1450},
+    {2, "Superfast B", "Kolkata", "Bangalore", 80, 1900},
+    {3, "Intercity C", "Chennai", "Hyderabad", 60, 750},
+    {4, "Mail D", "Jaipur", "Lucknow", 50, 620},
+    {5, "Shatabdi E", "Ahmedabad", "Pune", 90, 980}
 };
 
-Node *head = NULL;
-int next_booking_id = 1;
+#define MAX_TENANTS 16
+#define MAX_TENANT_NAME 32
+#define MAX_STORE_PATH 128
+
+/* One operator's store: its catalog, the booking list and everything derived from
+   it, its files and its quotas (see Tenants). A process can have several loaded at
+   once; each thread works on the one its `store` points at. Tables whose types are
+   defined with their subsystem further down are reached through pointers. */
+typedef struct Store {
+    char name[MAX_TENANT_NAME];         /* "" = the store in the starting directory */
+    char dir[MAX_STORE_PATH];           /* prefix of its file names: "" or "tenants/<name>/" */
+    int slot;                           /* position in stores[] */
+    Train trains[MAX_TRAINS];
+    Node *head;
+    /* Start of the next block of ids to lease (see allocate_booking_id) */
+    int next_booking_id;
+    /* Guards head, the indexes and the hold table. Never held across a payment call. */
+    pthread_mutex_t lock;
+    /* Guards next_booking_id once threads are running; taken inside lock, never around it */
+    pthread_mutex_t id_lease_lock;
+    _Atomic long long mem_bytes;        /* bookings, indexes and archive cache, for quota_mb */
+
+    /* Indexes */
+    struct IdSlot *id_slots;
+    unsigned int id_cap, id_used;
+    struct DupSlot *dup_slots;
+    unsigned int dup_cap, dup_used;
+    struct DupSlot *trip_slots;
+    unsigned int trip_cap, trip_used;
+    int train_booked[MAX_TRAINS];
+    unsigned int train_gen[MAX_TRAINS];
+    Node **by_ordinal;
+    unsigned int num_ordinals, ordinal_cap;
+    struct OwnerList *owner_lists;      /* indexed by owner_id */
+    int owner_lists_cap;
+    void *index_map;                    /* set while the tables live in a mapping of bookings.idx */
+    size_t index_map_len;
+
+    /* Snapshot and journals */
+    unsigned long long snapshot_seq;
+    unsigned long long commit_seq;      /* last sequence number handed out; guarded by lock */
+    unsigned long long journal_max_seq; /* highest seq found in the journals at startup */
+    struct Journal *journals;           /* MAX_JOURNALS */
+    int journals_open;
+    int journal_legacy_seen;            /* see load_store() */
+    int owner_fd;                       /* bookings.lock while this process owns the store */
+
+    /* Background load, guarded by lock */
+    pthread_cond_t load_cond;
+    int bg_loading, bg_started;
+    pthread_t bg_thread;
+    SnapshotInfo bg_si;
+    struct SnapBlock *bg_blocks;        /* compressed snapshots: one chunk per block */
+    long long bg_total;                 /* records (ordinals) the loader will fill in */
+    int bg_nchunks;
+    unsigned char *bg_chunk_loaded;
+    int bg_want;                        /* chunk a reader is waiting for */
+
+    /* Accounts (guarded by lock) and their sessions (guarded by session_lock) */
+    struct Account *accounts;           /* accounts[id - 1] */
+    int num_accounts, accounts_cap;
+    int *account_slots;                 /* open-addressed normalized name -> id, 0 = empty */
+    unsigned int account_slot_cap;
+    struct Session *sessions;           /* SESSION_SLOTS */
+    pthread_mutex_t session_lock;
+
+    /* Velocity counters, guarded by lock */
+    struct VelocitySlot *velocity_slots;
+    long long velocity_rejects, velocity_evictions;
+
+    _Atomic(struct Hitters*) hitters;
+
+    /* Seat holds and cached listings, guarded by lock */
+    struct Hold *holds;                 /* MAX_HOLDS */
+    unsigned long next_hold_token;
+    struct CachedResponse *response_cache;
+    long long response_hits, response_misses;
+
+    /* Archive */
+    struct ArchiveSegment *archive_segs;
+    int num_archive_segs;
+    pthread_mutex_t archive_lock;
+
+    struct StationIndex *stations;
+
+    /* Quotas from tenant.conf; the admission bucket is guarded by lock */
+    long long quota_bytes;              /* 0 = unlimited */
+    int ops_per_sec;                    /* 0 = unlimited */
+    double tokens;                      /* admission bucket, refilled at ops_per_sec */
+    long long refill_ns;
+    int serving;                        /* owned and loaded (see open_tenant) */
+
+    /* `serve` requests waiting for a worker, guarded by serve_lock (see Serving) */
+    struct ServeRequest *queue;         /* ring of queue_cap */
+    int queue_cap, queue_head, queue_len;
+    int max_workers;                    /* 0 = pool size less one per other operator */
+    int active;                         /* workers on this store right now */
+    long long served, rejected_busy;
+    long long *latency_ns;              /* queue wait plus service of each request served */
+    long long latency_cap;
+} Store;
+
+/* The store the calling thread works on */
+_Thread_local Store *store;
+
+/* Benchmarks run purely in memory and must not touch bookings.dat */
+int persist_enabled = 1;
 
 /* utils */
 void chomp(char *s) {
@@ -89,355 +325,7632 @@ int equalstr_nospaces_case(const char *a, const char *b) {
     return strcmp(ta,tb)==0;
 }
 
-/* file persistence */
-void load_bookings() {
-    FILE *fp = fopen(BOOKINGS_FILE, "rb");
-    if (!fp) return;
-    Booking tmp;
-    int maxid = 0;
-    while (fread(&tmp, sizeof(Booking), 1, fp) == 1) {
-        Node *n = (Node*)malloc(sizeof(Node));
-        n->b = tmp;
-        n->next = head;
-        head = n;
-        if (tmp.booking_id > maxid) maxid = tmp.booking_id;
-    }
-    next_booking_id = maxid + 1;
-    fclose(fp);
-}
-void save_bookings() {
-    FILE *fp = fopen(BOOKINGS_FILE, "wb");
-    if (!fp) {
-        printf("Error: could not open file to save bookings.\n");
-        return;
-    }
-    Node *cur = head;
-    while (cur) {
-        fwrite(&cur->b, sizeof(Booking), 1, fp);
-        cur = cur->next;
-    }
-    fclose(fp);
+/* ---------------- Code tables ----------------
+   Travel classes, genders and stations map to small integers through perfect hashes:
+   the key is normalized (whitespace dropped, lower-cased), hashed with a per-table
+   seed, and the top bits pick the only slot it can be in, so a lookup is one hash
+   and one compare. The seeds were found offline by trying seeds until every key got
+   its own slot; `bench codes` re-checks the tables. Unknown values miss and are
+   rejected where they are typed in.
+*/
+#define MAX_CODE_KEY 16
+
+enum { CLASS_SL, CLASS_2S, CLASS_3E, CLASS_3A, CLASS_2A, CLASS_1A, CLASS_CC, CLASS_EC, CLASS_FC, NUM_CLASSES };
+const char *class_codes[NUM_CLASSES] = {"SL", "2S", "3E", "3A", "2A", "1A", "CC", "EC", "FC"};
+
+enum { GENDER_MALE, GENDER_FEMALE, GENDER_OTHER, NUM_GENDERS };
+const char *gender_names[NUM_GENDERS] = {"Male", "Female", "Other"};
+
+#define NUM_STATION_CODES 10
+typedef struct {
+    const char *code;
+    const char *name;
+} StationCode;
+const StationCode station_codes[NUM_STATION_CODES] = {
+    {"CSMT", "Mumbai"}, {"NDLS", "Delhi"}, {"HWH", "Kolkata"}, {"SBC", "Bangalore"},
+    {"MAS", "Chennai"}, {"HYB", "Hyderabad"}, {"JP", "Jaipur"}, {"LKO", "Lucknow"},
+    {"ADI", "Ahmedabad"}, {"PUNE", "Pune"}
+};
+
+typedef struct {
+    const char *key;            /* normalized; NULL for an empty slot */
+    signed char id;
+} CodeSlot;
+
+typedef struct {
+    unsigned int seed;
+    int bits;
+    const CodeSlot *slots;      /* 1 << bits entries */
+} CodeTable;
+
+const CodeSlot class_slots[16] = {
+    {NULL, -1}, {NULL, -1}, {NULL, -1}, {"sl", CLASS_SL},
+    {"1a", CLASS_1A}, {"2a", CLASS_2A}, {"2s", CLASS_2S}, {"fc", CLASS_FC},
+    {"3e", CLASS_3E}, {"cc", CLASS_CC}, {"3a", CLASS_3A}, {NULL, -1},
+    {"sleeper", CLASS_SL}, {NULL, -1}, {NULL, -1}, {"ec", CLASS_EC}
+};
+const CodeSlot gender_slots[8] = {
+    {NULL, -1}, {"other", GENDER_OTHER}, {"m", GENDER_MALE}, {NULL, -1},
+    {"o", GENDER_OTHER}, {"female", GENDER_FEMALE}, {"f", GENDER_FEMALE}, {"male", GENDER_MALE}
+};
+/* Station codes and names both resolve to the index in station_codes */
+const CodeSlot station_slots[32] = {
+    {"mumbai", 0}, {NULL, -1}, {"ahmedabad", 8}, {"ndls", 1},
+    {NULL, -1}, {"csmt", 0}, {NULL, -1}, {NULL, -1},
+    {"jaipur", 6}, {NULL, -1}, {NULL, -1}, {"hwh", 2},
+    {NULL, -1}, {NULL, -1}, {"delhi", 1}, {"pune", 9},
+    {NULL, -1}, {"bangalore", 3}, {"sbc", 3}, {"lko", 7},
+    {"hyb", 5}, {NULL, -1}, {NULL, -1}, {NULL, -1},
+    {"jp", 6}, {"mas", 4}, {NULL, -1}, {"kolkata", 2},
+    {"adi", 8}, {"chennai", 4}, {"lucknow", 7}, {"hyderabad", 5}
+};
+const CodeTable class_table = {0x2a, 4, class_slots};
+const CodeTable gender_table = {0x2, 3, gender_slots};
+const CodeTable station_table = {0x19d, 5, station_slots};
+
+/* FNV-1a from a seeded basis plus a finalizer so the top bits mix well */
+unsigned int code_hash(const char *key, size_t n, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)key[i]) * 16777619u;
+    h ^= h >> 15; h *= 0x2c1b3c6du; h ^= h >> 12;
+    return h;
 }
 
-/* Count existing bookings for a given train */
-int count_bookings_for_train(int train_id) {
-    int cnt = 0;
-    Node *cur = head;
-    while (cur) {
-        if (cur->b.train_id == train_id) cnt++;
-        cur = cur->next;
+/* Small id for s, or -1 if it is not in the table */
+int code_lookup(const CodeTable *t, const char *s) {
+    char key[MAX_CODE_KEY];
+    size_t n = 0;
+    for (; *s; ++s) {
+        if (isspace((unsigned char)*s)) continue;
+        if (n + 1 >= sizeof(key)) return -1;
+        key[n++] = (char)tolower((unsigned char)*s);
     }
-    return cnt;
+    key[n] = 0;
+    const CodeSlot *slot = &t->slots[code_hash(key, n, t->seed) >> (32 - t->bits)];
+    return slot->key && strcmp(slot->key, key) == 0 ? slot->id : -1;
 }
 
-/* Duplicate detection:
-   Returns 1 if duplicate exists (same normalized name, same age, same train_id, same class)
-*/
-int is_duplicate_booking(const Booking *bk) {
-    Node *cur = head;
-    while (cur) {
-        if (cur->b.age == bk->age &&
-            cur->b.train_id == bk->train_id &&
-            equalstr_nospaces_case(cur->b.passenger_name, bk->passenger_name) &&
-            equalstr_nospaces_case(cur->b.travel_class, bk->travel_class)
-           ) {
-            return 1;
-        }
-        cur = cur->next;
-    }
-    return 0;
+int class_id(const char *s) { return code_lookup(&class_table, s); }
+int gender_id(const char *s) { return code_lookup(&gender_table, s); }
+int station_id(const char *s) { return code_lookup(&station_table, s); }
+
+/* Classes typed before the table existed are free text; those still compare as text */
+int same_class(const char *a, const char *b) {
+    int ia = class_id(a), ib = class_id(b);
+    if (ia >= 0 && ib >= 0) return ia == ib;
+    return equalstr_nospaces_case(a, b);
 }
 
-/* Create a text ticket file (always created) */
-void write_ticket_text(const Booking *bk) {
-    char fname[128];
-    snprintf(fname, sizeof(fname), "booking_%d.txt", bk->booking_id);
-    FILE *f = fopen(fname, "w");
-    if (!f) return;
-    fprintf(f, "Booking ID: %d\n", bk->booking_id);
-    fprintf(f, "Name: %s\n", bk->passenger_name);
-    fprintf(f, "Age: %d\n", bk->age);
-    fprintf(f, "Gender: %s\n", bk->gender);
-    fprintf(f, "Train ID: %d\n", bk->train_id);
-    fprintf(f, "Class: %s\n", bk->travel_class);
-    fprintf(f, "Generated: %s", ctime(&(time_t){time(NULL)}));
-    fclose(f);
+int same_station(const char *a, const char *b) {
+    int ia = station_id(a), ib = station_id(b);
+    if (ia >= 0 && ib >= 0) return ia == ib;
+    return equalstr_nospaces_case(a, b);
 }
 
-#ifdef HAVE_QRENCODE
-/* Generate a PBM QR image using libqrencode.
-   Output file: booking_<id>_qr.pbm (ASCII PBM format P1)
-*/
-void generate_qr_pbm_lib(const Booking *bk) {
-    char data[512];
-    snprintf(data, sizeof(data),
-             "BookingID:%d;Name:%s;Age:%d;Train:%d;Class:%s",
-             bk->booking_id, bk->passenger_name, bk->age, bk->train_id, bk->travel_class);
-    QRcode *q = QRcode_encodeString8bit(data, 0, QR_ECLEVEL_L);
-    if (!q) {
-        fprintf(stderr, "QR generation failed.\n");
-        return;
-    }
+/* Little-endian integer access for on-disk formats (a plain load on x86/ARM) */
+unsigned int le32_get(const unsigned char *p) {
+    return (unsigned int)p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
+unsigned long long le64_get(const unsigned char *p) {
+    return (unsigned long long)le32_get(p) | (unsigned long long)le32_get(p + 4) << 32;
+}
+void le32_put(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+void le64_put(unsigned char *p, unsigned long long v) {
+    le32_put(p, (unsigned int)v);
+    le32_put(p + 4, (unsigned int)(v >> 32));
+}
 
-    int size = q->width;
-    char fname[128];
-    snprintf(fname, sizeof(fname), "booking_%d_qr.pbm", bk->booking_id);
-    FILE *f = fopen(fname, "w");
-    if (!f) { QRcode_free(q); return; }
+/* Integer tunable from the environment, e.g. RB_PAY_LATENCY_MS=200 */
+int env_int(const char *name, int def) {
+    const char *v = getenv(name);
+    if (!v || !*v) return def;
+    return atoi(v);
+}
 
-    // Write ASCII PBM (P1)
-    fprintf(f, "P1\n%d %d\n", size, size);
-    unsigned char *d = q->data;
-    for (int y=0;y<size;y++) {
-        for (int x=0;x<size;x++) {
-            int isblack = d[y*size + x] & 1; // 1 = black
-            fprintf(f, "%d ", isblack ? 1 : 0);
-        }
-        fprintf(f, "\n");
-    }
-    fclose(f);
-    QRcode_free(q);
-    printf("QR code (PBM) saved to %s\n", fname);
+/* Monotonic clock in milliseconds (for hold expiry and benchmarks) */
+long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
-#endif
 
-/* Fallback ASCII "QR-like" generator if libqrencode not available */
-void generate_qr_fallback(const Booking *bk) {
-    // create a simple deterministic ascii block based on booking id and name hash
-    unsigned int h = 5381;
-    const char *s = bk->passenger_name;
-    while (*s) h = ((h << 5) + h) + (unsigned char)(*s++);
-    h ^= (unsigned int)bk->booking_id;
-    int dim = 21; // small square
-    char fname[128];
-    snprintf(fname, sizeof(fname), "booking_%d_qr.txt", bk->booking_id);
-    FILE *f = fopen(fname, "w");
-    if (!f) return;
-    fprintf(f, "ASCII QR placeholder for Booking %d\n\n", bk->booking_id);
-    for (int y=0;y<dim;y++) {
-        for (int x=0;x<dim;x++) {
-            unsigned int val = (h + x*131 + y*137) & 0xFF;
-            if (val % 3 == 0) fputc('#', f);
-            else fputc(' ', f);
-        }
-        fputc('\n', f);
-    }
-    fclose(f);
-    printf("ASCII QR placeholder saved to %s (real QR disabled)\n", fname);
+/* Journey dates are stored as YYYYMMDD integers */
+int valid_date(int ymd) {
+    int y = ymd / 10000, m = ymd / 100 % 100, d = ymd % 100;
+    static const int mdays[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
+    if (y < 1900 || y > 9999 || m < 1 || m > 12 || d < 1) return 0;
+    int leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    return d <= mdays[m-1] + (m == 2 && leap);
 }
 
-/* Generate QR (tries libqrencode if available) */
-void generate_qr(const Booking *bk) {
-    // always write text ticket too
-    write_ticket_text(bk);
-#ifdef HAVE_QRENCODE
-    generate_qr_pbm_lib(bk);
-#else
-    generate_qr_fallback(bk);
-#endif
+/* Days since 1970-01-01 (proleptic Gregorian calendar) */
+long days_from_date(int ymd) {
+    long y = ymd / 10000, m = ymd / 100 % 100, d = ymd % 100;
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
 }
 
-/* Print trains */
-void list_trains() {
-    printf("\nAvailable Trains:\n");
-    printf("ID   Name               From -> To           Seats Avail\n");
-    printf("-------------------------------------------------------\n");
-    for (int i = 0; i < MAX_TRAINS; ++i) {
-        int booked = count_bookings_for_train(trains[i].id);
-        int avail = trains[i].total_seats - booked;
-        printf("%-4d %-18s %-10s -> %-10s %5d\n",
-               trains[i].id,
-               trains[i].name,
-               trains[i].from,
-               trains[i].to,
-               avail);
-    }
+int today_date() {
+    time_t t = time(NULL);
+    struct tm *tm = localtime(&t);
+    return (tm->tm_year + 1900) * 10000 + (tm->tm_mon + 1) * 100 + tm->tm_mday;
 }
 
-/* Book ticket with duplicate check and QR generation */
-void book_ticket() {
-    Booking bk;
-    char temp[256];
+/* Parse YYYY-MM-DD. Returns 1 and sets *ymd on success. */
+int parse_date(const char *s, int *ymd) {
+    int y, m, d;
+    if (sscanf(s, "%d-%d-%d", &y, &m, &d) != 3) return 0;
+    int v = y * 10000 + m * 100 + d;
+    if (!valid_date(v)) return 0;
+    *ymd = v;
+    return 1;
+}
 
-    printf("\n--- Book Ticket ---\n");
-    printf("Enter passenger name: ");
-    fgets(temp, sizeof(temp), stdin); chomp(temp);
-    while (strlen(temp) == 0) {
-        printf("Name cannot be empty. Enter passenger name: ");
-        fgets(temp, sizeof(temp), stdin); chomp(temp);
-    }
-    strncpy(bk.passenger_name, temp, MAX_NAME);
+void format_date(int ymd, char *buf, size_t n) {
+    if (ymd == 0) snprintf(buf, n, "-");
+    else snprintf(buf, n, "%04d-%02d-%02d", ymd / 10000, ymd / 100 % 100, ymd % 100);
+}
 
-    printf("Enter age: ");
-    if (scanf("%d", &bk.age) != 1) {
-        printf("Invalid input. Booking canceled.\n");
-        while (getchar() != '\n');
-        return;
-    }
-    while (getchar() != '\n'); // clear the rest
+/* Size of a file in bytes, or -1 if it cannot be stat'ed */
+long long file_size(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    return (long long)st.st_size;
+}
 
-    printf("Enter gender (Male/Female/Other): ");
-    fgets(temp, sizeof(temp), stdin); chomp(temp);
-    strncpy(bk.gender, temp, sizeof(bk.gender));
+/* Path of one of the current store's files, e.g. store_path(BOOKINGS_FILE, ...) */
+void store_path(const char *file, char *buf, size_t n) {
+    snprintf(buf, n, "%s%s", store->dir, file);
+}
 
-    list_trains();
-    printf("Enter train ID to book: ");
-    if (scanf("%d", &bk.train_id) != 1) {
-        printf("Invalid train ID. Booking canceled.\n");
-        while (getchar() != '\n');
-        return;
-    }
-    while (getchar() != '\n');
+typedef struct {
+    void *(*fn)(void*);
+    void *arg;
+    Store *store;
+} StoreThread;
 
-    // validate train id
-    int found = 0;
-    Train chosenTrain;
-    for (int i = 0; i < MAX_TRAINS; ++i) {
-        if (trains[i].id == bk.train_id) {
-            found = 1;
-            chosenTrain = trains[i];
-            break;
-        }
-    }
-    if (!found) {
-        printf("Train ID not found. Booking canceled.\n");
-        return;
-    }
+void *store_thread_main(void *p) {
+    StoreThread st = *(StoreThread*)p;
+    free(p);
+    store = st.store;
+    return st.fn(st.arg);
+}
 
-    // check availability
-    int booked = count_bookings_for_train(bk.train_id);
-    if (booked >= chosenTrain.total_seats) {
-        printf("Sorry, no seats available on %s.\n", chosenTrain.name);
-        return;
-    }
+/* pthread_create() for a thread that works on the caller's store */
+int start_store_thread(pthread_t *tid, void *(*fn)(void*), void *arg) {
+    StoreThread *st = (StoreThread*)malloc(sizeof(StoreThread));
+    st->fn = fn;
+    st->arg = arg;
+    st->store = store;
+    int r = pthread_create(tid, NULL, store_thread_main, st);
+    if (r != 0) free(st);
+    return r;
+}
 
-    printf("Enter travel class (e.g. Sleeper, AC, 2A): ");
-    fgets(temp, sizeof(temp), stdin); chomp(temp);
-    strncpy(bk.travel_class, temp, MAX_CLASS);
+void sleep_ms(int ms) {
+    if (ms <= 0) return;
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
 
-    // duplicate check
-    if (is_duplicate_booking(&bk)) {
-        printf("\nDuplicate booking detected! A booking with the same details already exists.\n");
-        printf("To prevent fraud, the system will not create a duplicate booking.\n");
-        return;
-    }
+/* ---------------- Memory accounting ----------------
+   Long-lived allocations go through rb_malloc / rb_calloc / rb_realloc / rb_free
+   with a subsystem tag and their size (callers always know it: the node size, a
+   table's capacity), so live and peak bytes per subsystem are tracked without a
+   header on every block. Sizes are the bytes asked for; allocator overhead only
+   shows in the process RSS that 'stats' prints next to them. Buffers that live for
+   one command are not counted, except the snapshot and journal buffers used while
+   loading, which are added with mem_account(). Bookings, indexes, the index map and
+   the archive cache are also charged to the calling thread's store, for its quota.
+*/
+enum {
+    MEM_BOOKINGS,       /* booking list nodes */
+    MEM_INDEXES,        /* id index, duplicate set, ordinal table, owner lists */
+    MEM_INDEX_MAP,      /* bookings.idx mapping (pages are read in on use) */
+    MEM_LOADER,         /* snapshot records and block tables while loading */
+    MEM_JOURNAL,        /* journal entries read for recovery */
+    MEM_ARCHIVE,        /* archive catalog and cached segment indexes */
+    MEM_EVENTS,         /* event log rings */
+    MEM_LEASES,         /* per-thread booking id leases */
+    MEM_STATIONS,       /* station dictionary and its completion trie */
+    MEM_ACCOUNTS,       /* user accounts and their name hash */
+    MEM_VELOCITY,       /* sliding-window booking counters */
+    MEM_HITTERS,        /* heavy-hitter sketch and top lists */
+    NUM_MEM_TAGS
+};
+const char *mem_tag_names[NUM_MEM_TAGS] = {
+    "bookings", "indexes", "index map", "load buffers", "journal replay", "archive cache",
+    "event queues", "id leases", "stations", "accounts", "velocity",
+    "heavy hitters"
+};
 
-    bk.booking_id = next_booking_id++;
-    // insert at head
-    Node *n = (Node*)malloc(sizeof(Node));
-    n->b = bk;
-    n->next = head;
-    head = n;
+typedef struct {
+    _Atomic long long live, peak, allocs;
+} MemTag;
 
-    save_bookings();
-    printf("\nBooking successful! Booking ID: %d\n", bk.booking_id);
-    printf("Passenger: %s | Train: %s (%s -> %s) | Class: %s\n",
-           bk.passenger_name, chosenTrain.name, chosenTrain.from, chosenTrain.to, bk.travel_class);
+MemTag mem_tags[NUM_MEM_TAGS];
+MemTag mem_total;
 
-    // generate QR and ticket file
-    generate_qr(&bk);
+void mem_peak_update(_Atomic long long *peak, long long live) {
+    long long p = atomic_load_explicit(peak, memory_order_relaxed);
+    while (live > p && !atomic_compare_exchange_weak_explicit(peak, &p, live, memory_order_relaxed, memory_order_relaxed))
+        ;
 }
 
-/* View all bookings */
-void view_bookings() {
-    if (!head) {
-        printf("\nNo bookings found.\n");
-        return;
+void mem_add(int tag, long long delta, int new_block) {
+    long long live = atomic_fetch_add_explicit(&mem_tags[tag].live, delta, memory_order_relaxed) + delta;
+    long long total = atomic_fetch_add_explicit(&mem_total.live, delta, memory_order_relaxed) + delta;
+    if (new_block) {
+        atomic_fetch_add_explicit(&mem_tags[tag].allocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&mem_total.allocs, 1, memory_order_relaxed);
     }
-    printf("\n--- All Bookings ---\n");
-    printf("ID  Name                          Age Gender  Train           Class\n");
-    printf("---------------------------------------------------------------------\n");
-    Node *cur = head;
-    while (cur) {
-        // find train name
-        char trainname[80] = "Unknown";
-        for (int i = 0; i < MAX_TRAINS; ++i) {
-            if (trains[i].id == cur->b.train_id) {
-                strncpy(trainname, trains[i].name, sizeof(trainname));
-                break;
-            }
-        }
-        printf("%-4d %-28s %-3d  %-6s  %-15s %-s\n",
-               cur->b.booking_id,
-               cur->b.passenger_name,
-               cur->b.age,
-               cur->b.gender,
-               trainname,
-               cur->b.travel_class);
-        cur = cur->next;
+    if (delta > 0) {
+        mem_peak_update(&mem_tags[tag].peak, live);
+        mem_peak_update(&mem_total.peak, total);
     }
+    if (store && (tag == MEM_BOOKINGS || tag == MEM_INDEXES || tag == MEM_INDEX_MAP || tag == MEM_ARCHIVE))
+        atomic_fetch_add_explicit(&store->mem_bytes, delta, memory_order_relaxed);
 }
 
-/* Search booking by ID */
-void search_booking() {
-    printf("\nEnter Booking ID to search: ");
-    int id;
-    if (scanf("%d", &id) != 1) {
-        printf("Invalid input.\n");
-        while (getchar() != '\n');
+/* Count memory obtained some other way (mmap, a buffer owned by a caller): +bytes when
+   it is taken, -bytes when it is given back */
+void mem_account(int tag, long long bytes) {
+    mem_add(tag, bytes, bytes > 0);
+}
+
+void *rb_malloc(int tag, size_t n) {
+    void *p = malloc(n);
+    if (p) mem_add(tag, (long long)n, 1);
+    return p;
+}
+
+void *rb_calloc(int tag, size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (p) mem_add(tag, (long long)(count * size), 1);
+    return p;
+}
+
+void *rb_realloc(int tag, void *p, size_t old_n, size_t new_n) {
+    void *q = realloc(p, new_n);
+    if (q) mem_add(tag, (long long)new_n - (long long)old_n, p == NULL);
+    return q;
+}
+
+void rb_free(int tag, void *p, size_t n) {
+    if (!p) return;
+    free(p);
+    mem_add(tag, -(long long)n, 0);
+}
+
+/* Start peak tracking over from the current live sizes */
+void mem_reset_peaks() {
+    for (int i = 0; i < NUM_MEM_TAGS; ++i)
+        atomic_store_explicit(&mem_tags[i].peak, atomic_load_explicit(&mem_tags[i].live, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&mem_total.peak, atomic_load_explicit(&mem_total.live, memory_order_relaxed), memory_order_relaxed);
+}
+
+/* Resident set size of the process in bytes, -1 where it cannot be read */
+long long process_rss() {
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/statm", "r");
+    long long pages, resident;
+    if (!fp) return -1;
+    int ok = fscanf(fp, "%lld %lld", &pages, &resident) == 2;
+    fclose(fp);
+    return ok ? resident * sysconf(_SC_PAGESIZE) : -1;
+#else
+    return -1;
+#endif
+}
+
+/* ---------------- Event log ----------------
+   Binary record of what the store did (bookings and their outcome, cancellations,
+   checkpoints, recovery, tickets written), enabled with RB_EVENT_LOG=<file>.
+   Each thread owns a single-producer ring of fixed-size events; log_event() fills
+   one slot with a single memcpy and publishes it with a release store, so threads
+   never wait on each other or on the file. A background writer drains the rings
+   into the file; when a ring is full the event is dropped and counted rather than
+   blocking the caller. Render a log with: railway_booking events [file]
+
+   file: char magic[8] "RBEVT1", u32 version, u32 event size, then events of
+   EVENT_SIZE bytes, little-endian:
+      0  u64 wall-clock time in ns    8  u16 type   10 u16 ring (thread)
+     12  i32 a0   16 i32 a1   20 i32 a2   24 char text[40] (NUL-padded)
+   Events are in order per ring; the decoder merges rings by time.
+*/
+#define EVENT_MAGIC "RBEVT1"
+#define EVENT_VERSION 1
+#define EVENT_SIZE 64
+#define EVENT_RING_SIZE 4096        /* events per thread, power of two */
+#define MAX_EVENT_RINGS 256
+
+enum {
+    EV_BOOKING = 1,     /* a0 result (BOOK_*), a1 booking id, a2 train, text payment ref */
+    EV_CANCEL,          /* a0 booking id */
+    EV_CHECKPOINT,      /* a0 records, a1 ms, a2 low 32 bits of seq */
+    EV_RECOVERED,       /* a0 journal entries replayed, a1 discarded after a gap */
+    EV_TICKET,          /* a0 booking id, text file name */
+    EV_DROPPED,         /* a0 events lost to full rings */
+    EV_LOAD_DONE,       /* a0 records, a1 ms, a2 1 if damaged */
+    EV_FARE_BAND,       /* a0 train, a1 old band, a2 new band, text new fare */
+    NUM_EVENT_TYPES
+};
+
+typedef struct {
+    unsigned long long ts_ns;
+    unsigned short type;
+    unsigned short ring;
+    int a[3];
+    char text[40];
+} Event;
+
+typedef struct {
+    _Atomic unsigned long long head;     /* written by the owning thread */
+    _Atomic unsigned long long tail;     /* written by the writer */
+    _Atomic int dropped;
+    _Atomic int released;                /* owner exited; reusable once drained */
+    int in_use;
+    unsigned short id;
+    Event slots[EVENT_RING_SIZE];
+} EventRing;
+
+EventRing *event_rings[MAX_EVENT_RINGS];
+int num_event_rings = 0;
+pthread_mutex_t event_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t event_key;
+pthread_once_t event_key_once = PTHREAD_ONCE_INIT;
+int events_enabled = 0;
+_Atomic int events_stop_flag = 0;
+_Atomic int events_lost_no_ring = 0;
+pthread_t event_writer;
+FILE *event_fp = NULL;
+
+unsigned long long wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+void release_event_ring(void *p) {
+    atomic_store_explicit(&((EventRing*)p)->released, 1, memory_order_release);
+}
+
+void make_event_key() {
+    pthread_key_create(&event_key, release_event_ring);
+}
+
+/* The calling thread's ring, claimed on first use (NULL if all are taken) */
+EventRing *my_event_ring() {
+    EventRing *r = (EventRing*)pthread_getspecific(event_key);
+    if (r) return r;
+    pthread_mutex_lock(&event_ring_lock);
+    for (int i = 0; i < num_event_rings && !r; ++i)
+        if (!event_rings[i]->in_use) r = event_rings[i];
+    if (!r && num_event_rings < MAX_EVENT_RINGS) {
+        r = (EventRing*)rb_calloc(MEM_EVENTS, 1, sizeof(EventRing));
+        r->id = (unsigned short)num_event_rings;
+        event_rings[num_event_rings++] = r;
+    }
+    if (r) {
+        r->in_use = 1;
+        atomic_store_explicit(&r->released, 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&event_ring_lock);
+    if (r) pthread_setspecific(event_key, r);
+    return r;
+}
+
+void log_event(int type, int a0, int a1, int a2, const char *text) {
+    if (!events_enabled) return;
+    EventRing *r = my_event_ring();
+    if (!r) {
+        atomic_fetch_add_explicit(&events_lost_no_ring, 1, memory_order_relaxed);
+        return;
+    }
+    Event ev;
+    ev.ts_ns = wall_ns();
+    ev.type = (unsigned short)type;
+    ev.ring = r->id;
+    ev.a[0] = a0;
+    ev.a[1] = a1;
+    ev.a[2] = a2;
+    memset(ev.text, 0, sizeof(ev.text));
+    if (text) strncpy(ev.text, text, sizeof(ev.text) - 1);
+    unsigned long long h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (h - atomic_load_explicit(&r->tail, memory_order_acquire) == EVENT_RING_SIZE) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    memcpy(&r->slots[h & (EVENT_RING_SIZE - 1)], &ev, sizeof(ev));
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+void encode_event(const Event *ev, unsigned char *p) {
+    memset(p, 0, EVENT_SIZE);
+    le64_put(p, ev->ts_ns);
+    p[8] = (unsigned char)ev->type;
+    p[9] = (unsigned char)(ev->type >> 8);
+    p[10] = (unsigned char)ev->ring;
+    p[11] = (unsigned char)(ev->ring >> 8);
+    for (int i = 0; i < 3; ++i) le32_put(p + 12 + 4 * i, (unsigned int)ev->a[i]);
+    memcpy(p + 24, ev->text, sizeof(ev->text));
+}
+
+/* Move everything published so far to the file. Returns the number of events written. */
+int drain_event_rings() {
+    int total = 0;
+    unsigned char buf[EVENT_SIZE];
+    pthread_mutex_lock(&event_ring_lock);
+    int n = num_event_rings;
+    pthread_mutex_unlock(&event_ring_lock);
+    for (int i = 0; i < n; ++i) {
+        EventRing *r = event_rings[i];
+        int released = atomic_load_explicit(&r->released, memory_order_acquire);
+        unsigned long long t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        unsigned long long h = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; t < h; ++t, ++total) {
+            encode_event(&r->slots[t & (EVENT_RING_SIZE - 1)], buf);
+            fwrite(buf, sizeof(buf), 1, event_fp);
+        }
+        atomic_store_explicit(&r->tail, t, memory_order_release);
+        int dropped = atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+        if (i == 0) dropped += atomic_exchange_explicit(&events_lost_no_ring, 0, memory_order_relaxed);
+        if (dropped) {
+            Event ev = {wall_ns(), EV_DROPPED, r->id, {dropped, 0, 0}, ""};
+            encode_event(&ev, buf);
+            fwrite(buf, sizeof(buf), 1, event_fp);
+        }
+        if (released && h == t) {
+            // owner is gone and everything it wrote is out: let another thread claim it
+            pthread_mutex_lock(&event_ring_lock);
+            atomic_store_explicit(&r->released, 0, memory_order_relaxed);
+            r->in_use = 0;
+            pthread_mutex_unlock(&event_ring_lock);
+        }
+    }
+    if (total) fflush(event_fp);
+    return total;
+}
+
+void *event_writer_main(void *p) {
+    (void)p;
+    while (!atomic_load_explicit(&events_stop_flag, memory_order_acquire))
+        if (drain_event_rings() == 0) sleep_ms(5);
+    drain_event_rings();
+    return NULL;
+}
+
+/* Open the log and start the writer. Returns 0 on success. */
+int start_event_log(const char *path) {
+    event_fp = fopen(path, "ab");
+    if (!event_fp) return -1;
+    fseek(event_fp, 0, SEEK_END);
+    if (ftell(event_fp) == 0) {
+        unsigned char h[16];
+        memset(h, 0, sizeof(h));
+        memcpy(h, EVENT_MAGIC, strlen(EVENT_MAGIC));
+        le32_put(h + 8, EVENT_VERSION);
+        le32_put(h + 12, EVENT_SIZE);
+        fwrite(h, sizeof(h), 1, event_fp);
+    }
+    pthread_once(&event_key_once, make_event_key);
+    atomic_store_explicit(&events_stop_flag, 0, memory_order_relaxed);
+    events_enabled = 1;
+    if (pthread_create(&event_writer, NULL, event_writer_main, NULL) != 0) {
+        events_enabled = 0;
+        fclose(event_fp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Flush the rings and stop the writer (registered with atexit) */
+void stop_event_log() {
+    if (!events_enabled) return;
+    events_enabled = 0;
+    atomic_store_explicit(&events_stop_flag, 1, memory_order_release);
+    pthread_join(event_writer, NULL);
+    fclose(event_fp);
+    event_fp = NULL;
+}
+
+/* ---------------- Tracing ----------------
+   Span timings for single requests, enabled with RB_TRACE=<file>. book_ticket() and
+   cancel_booking() open a request; the stages they go through (validation, duplicate
+   check, hold, payment, confirm, persistence, ticket text, QR) add spans to it, and
+   when the request ends it is appended to the file in Chrome trace-event format
+   (open it in chrome://tracing or ui.perfetto.dev). Spans are kept in the caller's
+   stack frame and stamped with CLOCK_MONOTONIC, so a traced stage costs two clock
+   reads; stages of requests that are not sampled cost one pthread_getspecific.
+     RB_TRACE_SAMPLE=N   trace one request in N (default 1: all)
+     RB_TRACE_MIN_US=T   write a sampled request only if it took at least T us
+   The file is a JSON array that stays readable if the program dies mid-run.
+*/
+#define MAX_TRACE_SPANS 16
+
+typedef struct {
+    const char *name;
+    unsigned long long start_ns, end_ns;
+} TraceSpan;
+
+typedef struct {
+    int tid;
+    int nspans;
+    TraceSpan spans[MAX_TRACE_SPANS];   /* spans[0] is the whole request */
+} TraceRequest;
+
+FILE *trace_fp = NULL;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t trace_key;
+pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+int trace_sample = 1;
+long long trace_min_ns = 0;
+_Atomic unsigned int trace_counter = 0;
+_Atomic int trace_next_tid = 1;
+pthread_key_t trace_tid_key;        /* small per-thread number for the trace's tid field */
+unsigned long long trace_epoch_ns = 0;
+
+unsigned long long mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+void make_trace_key() {
+    pthread_key_create(&trace_key, NULL);
+    pthread_key_create(&trace_tid_key, NULL);
+}
+
+int start_trace(const char *path) {
+    trace_fp = fopen(path, "w");
+    if (!trace_fp) return -1;
+    pthread_once(&trace_key_once, make_trace_key);
+    trace_sample = env_int("RB_TRACE_SAMPLE", 1);
+    if (trace_sample < 1) trace_sample = 1;
+    trace_min_ns = (long long)env_int("RB_TRACE_MIN_US", 0) * 1000;
+    trace_epoch_ns = mono_ns();
+    fprintf(trace_fp, "[\n");
+    return 0;
+}
+
+/* Close the array (registered with atexit) */
+void stop_trace() {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fp) {
+        fprintf(trace_fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"railway_booking\"}}\n]\n");
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* Start tracing a request in *t if tracing is on and this request is sampled.
+   Returns t, or NULL when the request is not traced; pass the result to trace_request_end(). */
+TraceRequest *trace_request_begin(TraceRequest *t, const char *name) {
+    if (!trace_fp) return NULL;
+    if (atomic_fetch_add_explicit(&trace_counter, 1, memory_order_relaxed) % (unsigned int)trace_sample) return NULL;
+    t->tid = (int)(long)pthread_getspecific(trace_tid_key);
+    if (!t->tid) {
+        t->tid = atomic_fetch_add_explicit(&trace_next_tid, 1, memory_order_relaxed);
+        pthread_setspecific(trace_tid_key, (void*)(long)t->tid);
+    }
+    t->nspans = 1;
+    t->spans[0].name = name;
+    t->spans[0].start_ns = mono_ns();
+    t->spans[0].end_ns = 0;
+    pthread_setspecific(trace_key, t);
+    return t;
+}
+
+/* Open a span in the calling thread's request. Returns a handle for trace_end(), -1 if untraced. */
+int trace_begin(const char *name) {
+    if (!trace_fp) return -1;
+    TraceRequest *t = (TraceRequest*)pthread_getspecific(trace_key);
+    if (!t || t->nspans == MAX_TRACE_SPANS) return -1;
+    TraceSpan *s = &t->spans[t->nspans];
+    s->name = name;
+    s->end_ns = 0;
+    s->start_ns = mono_ns();
+    return t->nspans++;
+}
+
+void trace_end(int span) {
+    if (span < 0) return;
+    TraceRequest *t = (TraceRequest*)pthread_getspecific(trace_key);
+    if (t) t->spans[span].end_ns = mono_ns();
+}
+
+/* Finish the request and write it out if it is slow enough. Spans still open end with it. */
+void trace_request_end(TraceRequest *t, int booking_id, int result) {
+    if (!t) return;
+    unsigned long long end = mono_ns();
+    pthread_setspecific(trace_key, NULL);
+    t->spans[0].end_ns = end;
+    if ((long long)(end - t->spans[0].start_ns) < trace_min_ns) return;
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_fp) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    for (int i = 0; i < t->nspans; ++i) {
+        const TraceSpan *s = &t->spans[i];
+        unsigned long long e = s->end_ns ? s->end_ns : end;
+        fprintf(trace_fp, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                s->name, t->spans[0].name, t->tid, (s->start_ns - trace_epoch_ns) / 1e3, (e - s->start_ns) / 1e3);
+        if (i == 0) fprintf(trace_fp, ",\"args\":{\"booking_id\":%d,\"result\":%d}", booking_id, result);
+        fprintf(trace_fp, "},\n");
+    }
+    fflush(trace_fp);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* ---------------- LZ block codec ----------------
+   Byte-oriented LZ77 in the LZ4 style. Each sequence is a token (literal count in
+   the high nibble, match length - 4 in the low nibble, 15 = length bytes follow),
+   the literals, then a 2-byte little-endian match offset. The final sequence has
+   literals only. Blocks are compressed independently so they can be decoded in
+   parallel and looked up one at a time.
+*/
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+unsigned int lz_hash(unsigned int v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+unsigned char *lz_put_len(unsigned char *op, int len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Returns the compressed length, or -1 if it would exceed cap */
+int lz_compress(const unsigned char *src, int n, unsigned char *dst, int cap) {
+    int table[1 << LZ_HASH_BITS];
+    for (int i = 0; i < (1 << LZ_HASH_BITS); ++i) table[i] = -1;
+    unsigned char *op = dst, *end = dst + cap;
+    int ip = 0, anchor = 0;
+    while (ip + LZ_MIN_MATCH <= n) {
+        unsigned int v, rv;
+        memcpy(&v, src + ip, 4);
+        unsigned int h = lz_hash(v);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || ip - ref > LZ_MAX_OFFSET || (memcpy(&rv, src + ref, 4), rv != v)) {
+            ip++;
+            continue;
+        }
+        int len = LZ_MIN_MATCH;
+        while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+
+        int lit = ip - anchor;
+        if (end - op < 1 + lit / 255 + 1 + lit + 2 + len / 255 + 1) return -1;
+        unsigned char *tok = op++;
+        *tok = (unsigned char)((lit < 15 ? lit : 15) << 4);
+        if (lit >= 15) op = lz_put_len(op, lit - 15);
+        memcpy(op, src + anchor, (size_t)lit);
+        op += lit;
+        *op++ = (unsigned char)((ip - ref) & 0xFF);
+        *op++ = (unsigned char)((ip - ref) >> 8);
+        int ml = len - LZ_MIN_MATCH;
+        *tok |= (unsigned char)(ml < 15 ? ml : 15);
+        if (ml >= 15) op = lz_put_len(op, ml - 15);
+        ip += len;
+        anchor = ip;
+    }
+    int lit = n - anchor;
+    if (end - op < 1 + lit / 255 + 1 + lit) return -1;
+    *op++ = (unsigned char)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = lz_put_len(op, lit - 15);
+    memcpy(op, src + anchor, (size_t)lit);
+    op += lit;
+    return (int)(op - dst);
+}
+
+/* Returns the decompressed length, or -1 if the input is malformed or exceeds cap */
+int lz_decompress(const unsigned char *src, int n, unsigned char *dst, int cap) {
+    int ip = 0, op = 0;
+    while (ip < n) {
+        unsigned int tok = src[ip++];
+        int lit = (int)(tok >> 4);
+        if (lit == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > n - ip || lit > cap - op) return -1;
+        memcpy(dst + op, src + ip, (size_t)lit);
+        ip += lit;
+        op += lit;
+        if (ip == n) break;         // final literal-only sequence
+        if (n - ip < 2) return -1;
+        int off = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (off == 0 || off > op) return -1;
+        int ml = (int)(tok & 15);
+        if (ml == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return -1;
+                b = src[ip++];
+                ml += b;
+            } while (b == 255);
+        }
+        ml += LZ_MIN_MATCH;
+        if (ml > cap - op) return -1;
+        if (off >= ml) memcpy(dst + op, dst + op - off, (size_t)ml);
+        else if (off == 1) memset(dst + op, dst[op - 1], (size_t)ml);     // run of one byte
+        else for (int i = 0; i < ml; ++i) dst[op + i] = dst[op - off + i]; // overlapping copy
+        op += ml;
+    }
+    return op;
+}
+
+/* Block checksum: multiply-xorshift over 8-byte words, folded to 32 bits */
+unsigned int checksum32(const void *data, size_t n) {
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned long long h = 0x9E3779B97F4A7C15ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        h = (h ^ le64_get(p + i)) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i) h = (h ^ p[i]) * 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 29;
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+/* Header in front of every compressed block in snapshots and archive segments,
+   stored as four little-endian u32 in this order */
+typedef struct {
+    unsigned int raw_len;
+    unsigned int comp_len;      /* == raw_len: payload is stored uncompressed */
+    unsigned int records;
+    unsigned int checksum;      /* checksum32 of the uncompressed payload */
+} BlockHeader;
+#define BLOCK_HEADER_SIZE 16
+
+void put_block_header(unsigned char *p, const BlockHeader *bh) {
+    le32_put(p, bh->raw_len);
+    le32_put(p + 4, bh->comp_len);
+    le32_put(p + 8, bh->records);
+    le32_put(p + 12, bh->checksum);
+}
+
+void get_block_header(const unsigned char *p, BlockHeader *bh) {
+    bh->raw_len = le32_get(p);
+    bh->comp_len = le32_get(p + 4);
+    bh->records = le32_get(p + 8);
+    bh->checksum = le32_get(p + 12);
+}
+
+/* Compress one block and write header + payload. Returns bytes written or -1. */
+long long write_block(FILE *fp, const unsigned char *raw, int raw_len, int records, unsigned char *scratch) {
+    BlockHeader bh;
+    unsigned char hdr[BLOCK_HEADER_SIZE];
+    bh.raw_len = (unsigned int)raw_len;
+    bh.records = (unsigned int)records;
+    bh.checksum = checksum32(raw, (size_t)raw_len);
+    int c = lz_compress(raw, raw_len, scratch, raw_len - 1);
+    const unsigned char *payload = scratch;
+    if (c < 0) {
+        c = raw_len;
+        payload = raw;
+    }
+    bh.comp_len = (unsigned int)c;
+    put_block_header(hdr, &bh);
+    if (fwrite(hdr, sizeof(hdr), 1, fp) != 1 || fwrite(payload, 1, (size_t)c, fp) != (size_t)c) return -1;
+    return BLOCK_HEADER_SIZE + c;
+}
+
+/* Decode a block payload into dst (raw_len bytes). Returns 0 if it decoded and the checksum matches. */
+int read_block_payload(const BlockHeader *bh, const unsigned char *payload, unsigned char *dst) {
+    if (bh->comp_len == bh->raw_len) memcpy(dst, payload, bh->raw_len);
+    else if (lz_decompress(payload, (int)bh->comp_len, dst, (int)bh->raw_len) != (int)bh->raw_len) return -1;
+    return checksum32(dst, bh->raw_len) == bh->checksum ? 0 : -1;
+}
+
+/* file persistence */
+int record_size_for_version(int version) {
+    switch (version) {
+        case 0: return V0_RECORD_SIZE;
+        case 1: case 2: return V1_RECORD_SIZE;
+        case 3: case 4: return V3_RECORD_SIZE;
+        case SNAPSHOT_VERSION: case SNAPSHOT_VERSION_LZ: return DISK_RECORD_SIZE;
+        default: return 0;
+    }
+}
+
+int snapshot_is_compressed(int version) {
+    return version == 2 || version == 4 || version == SNAPSHOT_VERSION_LZ;
+}
+
+/* Identify the snapshot format of an open file of the given size. Leaves fp at the
+   first record (or block). rec_size is 0 for versions this build does not know. */
+void probe_snapshot(FILE *fp, long long size, SnapshotInfo *si) {
+    unsigned char h[SNAPSHOT_HEADER_SIZE];
+    memset(si, 0, sizeof(*si));
+    si->header_count = -1;
+    if (size >= SNAPSHOT_V1_HEADER_SIZE && fread(h, SNAPSHOT_V1_HEADER_SIZE, 1, fp) == 1 &&
+        memcmp(h, SNAPSHOT_MAGIC, 8) == 0) {
+        si->version = (int)le32_get(h + 8);
+        si->header_count = (long long)le64_get(h + 16);
+        si->data_off = SNAPSHOT_V1_HEADER_SIZE;
+        if (si->version >= SNAPSHOT_V3) {
+            si->data_off = SNAPSHOT_HEADER_SIZE;
+            if (fread(h + SNAPSHOT_V1_HEADER_SIZE, SNAPSHOT_HEADER_SIZE - SNAPSHOT_V1_HEADER_SIZE, 1, fp) == 1)
+                si->seq = le64_get(h + 24);
+        }
+        si->rec_size = record_size_for_version(si->version);
+        if ((int)le32_get(h + 12) != si->rec_size) si->rec_size = 0;
+    } else {
+        si->version = 0;
+        si->data_off = 0;
+        si->rec_size = V0_RECORD_SIZE;
+    }
+    if (!snapshot_is_compressed(si->version)) {
+        long long body = size > si->data_off ? size - si->data_off : 0;
+        si->count = si->rec_size > 0 ? body / si->rec_size : 0;
+        si->tail = si->rec_size > 0 ? body % si->rec_size : body;
+    }
+    rb_fseek(fp, si->data_off, SEEK_SET);
+}
+
+void write_snapshot_header(unsigned char *h, int version, long long count, unsigned long long seq) {
+    memset(h, 0, SNAPSHOT_HEADER_SIZE);
+    memcpy(h, SNAPSHOT_MAGIC, 8);
+    le32_put(h + 8, (unsigned int)version);
+    le32_put(h + 12, DISK_RECORD_SIZE);
+    le64_put(h + 16, (unsigned long long)count);
+    le64_put(h + 24, seq);
+}
+
+void copy_field(char *dst, size_t dst_len, const unsigned char *src, size_t src_len) {
+    size_t n = src_len < dst_len ? src_len : dst_len;
+    memcpy(dst, src, n);
+    if (n < dst_len) memset(dst + n, 0, dst_len - n);
+}
+
+/* Encode a booking as a portable record (DISK_RECORD_SIZE bytes) */
+void encode_disk_record(const Booking *b, unsigned char *rec) {
+    if (BOOKING_IS_DISK_LAYOUT) {
+        memcpy(rec, b, DISK_CHECKED_LEN);
+    } else {
+        memset(rec, 0, DISK_CHECKED_LEN);
+        le32_put(rec, (unsigned int)b->booking_id);
+        le32_put(rec + 4, (unsigned int)b->age);
+        le32_put(rec + 8, (unsigned int)b->train_id);
+        le32_put(rec + 12, (unsigned int)b->journey_date);
+        memcpy(rec + DISK_NAME_OFF, b->passenger_name, strnlen(b->passenger_name, DISK_NAME_LEN - 1));
+        memcpy(rec + DISK_GENDER_OFF, b->gender, strnlen(b->gender, DISK_GENDER_LEN - 1));
+        memcpy(rec + DISK_CLASS_OFF, b->travel_class, strnlen(b->travel_class, DISK_CLASS_LEN - 1));
+        le32_put(rec + DISK_OWNER_OFF, (unsigned int)b->owner_id);
+    }
+    memset(rec + DISK_PAD_OFF, 0, 2);
+    le32_put(rec + DISK_CHECKSUM_OFF, checksum32(rec, DISK_CHECKED_LEN));
+}
+
+/* Decode one record of the given snapshot version. Returns 0, or -1 if a portable
+   record fails its checksum. Legacy layouts are decoded by explicit offsets, so they
+   do not depend on how this build lays out Booking. */
+int decode_record(int version, const unsigned char *raw, Booking *out) {
+    if (version >= SNAPSHOT_V3) {
+        int v3 = version < SNAPSHOT_VERSION;
+        int checked = v3 ? V3_CHECKED_LEN : DISK_CHECKED_LEN;
+        if (le32_get(raw + checked) != checksum32(raw, (size_t)checked)) return -1;
+        if (BOOKING_IS_DISK_LAYOUT) {
+            memcpy(out, raw, (size_t)checked);
+            if (v3) out->owner_id = 0;
+        } else {
+            out->booking_id = (int)le32_get(raw);
+            out->age = (int)le32_get(raw + 4);
+            out->train_id = (int)le32_get(raw + 8);
+            out->journey_date = (int)le32_get(raw + 12);
+            copy_field(out->passenger_name, sizeof(out->passenger_name), raw + DISK_NAME_OFF, DISK_NAME_LEN);
+            copy_field(out->gender, sizeof(out->gender), raw + DISK_GENDER_OFF, DISK_GENDER_LEN);
+            copy_field(out->travel_class, sizeof(out->travel_class), raw + DISK_CLASS_OFF, DISK_CLASS_LEN);
+            out->owner_id = v3 ? 0 : (int)le32_get(raw + DISK_OWNER_OFF);
+        }
+        return 0;
+    }
+    out->booking_id = (int)le32_get(raw);
+    copy_field(out->passenger_name, sizeof(out->passenger_name), raw + 4, 100);
+    out->age = (int)le32_get(raw + 104);
+    copy_field(out->gender, sizeof(out->gender), raw + 108, 10);
+    out->train_id = (int)le32_get(raw + 120);
+    copy_field(out->travel_class, sizeof(out->travel_class), raw + 124, 20);
+    out->journey_date = version >= 1 ? (int)le32_get(raw + 144) : 0;
+    out->owner_id = 0;
+    return 0;
+}
+
+/* Location of one block in a compressed snapshot */
+typedef struct SnapBlock {
+    long long file_off;         /* offset of the block header */
+    long long first_record;
+    BlockHeader bh;
+} SnapBlock;
+
+/* Whether a block header at off frames a plausible block of a size-byte file. Writers
+   never put more than SNAP_BLOCK_RECORDS records in a block, so readers may size their
+   buffers by it. */
+int block_framed(const BlockHeader *bh, int rec_size, long long off, long long size) {
+    return bh->records > 0 && bh->records <= SNAP_BLOCK_RECORDS && bh->comp_len <= bh->raw_len &&
+           (size_t)bh->raw_len == (size_t)bh->records * (size_t)rec_size &&
+           off + BLOCK_HEADER_SIZE + (long long)bh->comp_len <= size;
+}
+
+/* Walk the block headers of a compressed snapshot. Returns the number of well-framed
+   blocks; *bad_off receives the offset where framing broke, or -1 if the file ends cleanly. */
+int scan_snapshot_blocks(FILE *fp, const SnapshotInfo *si, long long size, SnapBlock **out, long long *bad_off) {
+    int n = 0, cap = 0;
+    SnapBlock *blocks = NULL;
+    long long off = si->data_off, rec = 0;
+    *bad_off = -1;
+    while (off < size) {
+        unsigned char raw[BLOCK_HEADER_SIZE];
+        BlockHeader bh;
+        if (rb_fseek(fp, off, SEEK_SET) != 0 || fread(raw, sizeof(raw), 1, fp) != 1) {
+            *bad_off = off;
+            break;
+        }
+        get_block_header(raw, &bh);
+        if (!block_framed(&bh, si->rec_size, off, size)) {
+            *bad_off = off;
+            break;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            blocks = (SnapBlock*)realloc(blocks, sizeof(SnapBlock) * cap);
+        }
+        blocks[n].file_off = off;
+        blocks[n].first_record = rec;
+        blocks[n].bh = bh;
+        n++;
+        rec += bh.records;
+        off += BLOCK_HEADER_SIZE + bh.comp_len;
+    }
+    *out = blocks;
+    return n;
+}
+
+/* Read and decode one block into out[0..records). Records that fail to decode get
+   booking_id 0. Returns 0, or -1 if the block (or any record in it) was damaged. */
+int read_snapshot_block(FILE *fp, int version, const SnapBlock *sb, unsigned char **buf, size_t *cap, Booking *out) {
+    size_t need = (size_t)sb->bh.comp_len + sb->bh.raw_len;
+    if (need > *cap) {
+        *cap = need;
+        *buf = (unsigned char*)realloc(*buf, need);
+    }
+    unsigned char *payload = *buf, *raw = *buf + sb->bh.comp_len;
+    if (rb_fseek(fp, sb->file_off + BLOCK_HEADER_SIZE, SEEK_SET) != 0 ||
+        fread(payload, 1, sb->bh.comp_len, fp) != sb->bh.comp_len ||
+        read_block_payload(&sb->bh, payload, raw) != 0) {
+        memset(out, 0, sizeof(Booking) * sb->bh.records);
+        return -1;
+    }
+    int rs = record_size_for_version(version), damaged = 0;
+    for (unsigned int k = 0; k < sb->bh.records; ++k) {
+        if (decode_record(version, raw + (size_t)k * rs, &out[k]) != 0) {
+            out[k].booking_id = 0;
+            damaged = 1;
+        }
+    }
+    return damaged ? -1 : 0;
+}
+
+/* Decodes a contiguous run of blocks into the shared record array */
+typedef struct {
+    const char *path;
+    int version;
+    const SnapBlock *blocks;
+    int first, count;
+    Booking *out;
+    int damaged;
+} BlockDecoder;
+
+void *decode_blocks_worker(void *p) {
+    BlockDecoder *d = (BlockDecoder*)p;
+    FILE *fp = fopen(d->path, "rb");
+    if (!fp) { d->damaged = 1; return NULL; }
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    for (int i = d->first; i < d->first + d->count; ++i) {
+        const SnapBlock *sb = &d->blocks[i];
+        if (read_snapshot_block(fp, d->version, sb, &buf, &cap, d->out + sb->first_record) != 0)
+            d->damaged = 1;
+    }
+    free(buf);
+    fclose(fp);
+    return NULL;
+}
+
+int load_threads = 4;
+
+/* Read every record of a snapshot file into a malloc'd array.
+   Returns -1 if the file cannot be read at all; otherwise 0, with *damaged set when
+   framing or checksums failed (lost records are returned with booking_id 0). */
+int read_snapshot(const char *path, Booking **out, long long *n, int *damaged) {
+    *out = NULL;
+    *n = 0;
+    *damaged = 0;
+    long long size = file_size(path);
+    FILE *fp = size >= 0 ? fopen(path, "rb") : NULL;
+    if (!fp) return -1;
+    SnapshotInfo si;
+    probe_snapshot(fp, size, &si);
+    if (si.rec_size == 0) { fclose(fp); return -1; }
+    store->snapshot_seq = si.seq;
+
+    if (snapshot_is_compressed(si.version)) {
+        SnapBlock *blocks;
+        long long bad_off;
+        int nblocks = scan_snapshot_blocks(fp, &si, size, &blocks, &bad_off);
+        fclose(fp);
+        long long total = nblocks ? blocks[nblocks-1].first_record + blocks[nblocks-1].bh.records : 0;
+        Booking *arr = (Booking*)malloc(sizeof(Booking) * (total > 0 ? total : 1));
+        int nthreads = load_threads < nblocks ? load_threads : nblocks;
+        if (nthreads < 1) nthreads = 1;
+        pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+        BlockDecoder *dec = (BlockDecoder*)calloc(nthreads, sizeof(BlockDecoder));
+        for (int i = 0, first = 0; i < nthreads; ++i) {
+            dec[i].path = path;
+            dec[i].version = si.version;
+            dec[i].blocks = blocks;
+            dec[i].first = first;
+            dec[i].count = nblocks / nthreads + (i < nblocks % nthreads);
+            dec[i].out = arr;
+            first += dec[i].count;
+            pthread_create(&tids[i], NULL, decode_blocks_worker, &dec[i]);
+        }
+        for (int i = 0; i < nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+            *damaged |= dec[i].damaged;
+        }
+        *damaged |= bad_off >= 0 || total != si.header_count;
+        free(dec);
+        free(tids);
+        free(blocks);
+        *out = arr;
+        *n = total;
+        return 0;
+    }
+
+    Booking *arr = (Booking*)malloc(sizeof(Booking) * (si.count > 0 ? si.count : 1));
+    unsigned char *buf = (unsigned char*)malloc((size_t)si.rec_size * SNAP_BLOCK_RECORDS);
+    long long k = 0;
+    while (k < si.count) {
+        long long want = si.count - k < SNAP_BLOCK_RECORDS ? si.count - k : SNAP_BLOCK_RECORDS;
+        size_t got = fread(buf, (size_t)si.rec_size, (size_t)want, fp);
+        for (size_t i = 0; i < got; ++i, ++k) {
+            if (decode_record(si.version, buf + i * si.rec_size, &arr[k]) != 0) {
+                arr[k].booking_id = 0;
+                *damaged = 1;
+            }
+        }
+        if ((long long)got < want) break;
+    }
+    free(buf);
+    fclose(fp);
+    *damaged |= k != si.count || si.tail != 0 || (si.header_count >= 0 && si.header_count != si.count);
+    *out = arr;
+    *n = k;
+    return 0;
+}
+
+/* Flush fp and push its data to disk, so a rename that follows cannot expose a
+   file whose blocks never made it */
+int sync_stream(FILE *fp) {
+    if (fflush(fp) != 0) return -1;
+#ifndef _WIN32
+    return fsync(fileno(fp));
+#else
+    return _commit(_fileno(fp));
+#endif
+}
+
+/* Atomically replace dst with src */
+int replace_file(const char *src, const char *dst) {
+#ifdef _WIN32
+    remove(dst);
+#endif
+    return rename(src, dst);
+}
+
+/* ---------------- Indexes ----------------
+   Kept up to date by every insert and remove on the booking list:
+    - id index:   open-addressed booking_id -> ordinal, where by_ordinal[ordinal] is the Node
+    - dup set:    hash of (normalized name, age, train, normalized class) -> live count,
+                  so is_duplicate_booking() is one probe instead of a list walk
+    - train_booked[]: bookings per train
+    - train_gen[]: bumped whenever a train's free seats or fare may have changed (its
+                  bookings or seat holds), for the response cache; never reset
+    - owner lists: the booking ids of each account, so listing someone's bookings
+                  costs their bookings only (not in bookings.idx; filled while loading)
+    - trip set:   hash of (normalized name, age, journey date[, route]) -> live count,
+                  for the same-day rule below
+   The tables hold no pointers, and ordinals are record positions in bookings.dat, so
+   save_bookings() writes them to bookings.idx next to the snapshot. At startup a
+   bookings.idx whose seq and record count match the snapshot is mapped and used
+   in place (copy-on-write) instead of being rebuilt.
+   There are no per-train postings or name index to persist: per-train questions
+   (free seats, fares, listings) need only train_booked[], and names are looked up
+   through the dup and trip sets. Owner lists are rebuilt as records load, because
+   listing an account's bookings needs the records themselves anyway.
+
+   bookings.idx (little-endian):
+      0  char magic[8] "RBIDX1"   8  u32 version      12  u32 train count
+     16  u64 snapshot seq        24  u64 record count
+     32  u32 id_cap  36 u32 id_used  40 u32 dup_cap  44 u32 dup_used
+     48  u32 next booking id     52 u32 trip_cap  56 u32 trip_used  60 u32 trip stamp
+     64  u32 train_booked[train count], padded to 8 bytes
+         IdSlot[id_cap]  then  DupSlot[dup_cap]  then  DupSlot[trip_cap]
+   The version changes whenever a stored key changes meaning (version 3: dup keys hash
+   the canonical class code; version 4 adds the trip set), so an older file is rebuilt
+   rather than probed with keys it never held. Trip keys also depend on RB_DUP_SAME_DAY
+   and the catalog's routes, which the trip stamp covers.
+*/
+#define INDEX_MAGIC "RBIDX1"
+#define INDEX_VERSION 4
+#define INDEX_HEADER_SIZE 64
+
+typedef struct IdSlot {
+    unsigned int id;            /* 0 = empty */
+    unsigned int ordinal;
+} IdSlot;
+
+typedef struct DupSlot {
+    unsigned long long key;     /* 0 = empty */
+    unsigned int count;         /* 0 = no live booking with this key */
+    unsigned int pad;
+} DupSlot;
+
+unsigned int hash_id(unsigned int id) {
+    id ^= id >> 16; id *= 0x7feb352du;
+    id ^= id >> 15; id *= 0x846ca68bu;
+    return id ^ (id >> 16);
+}
+
+/* Normalize like equalstr_nospaces_case(): drop whitespace, lower-case, cap at MAX_NAME-1 */
+size_t normalize_key(const char *s, char *out) {
+    size_t n = 0;
+    for (; *s && n + 1 < MAX_NAME; ++s)
+        if (!isspace((unsigned char)*s)) out[n++] = (char)tolower((unsigned char)*s);
+    out[n] = 0;
+    return n;
+}
+
+unsigned long long dup_key(const Booking *b) {
+    char name[MAX_NAME], cls[MAX_NAME];
+    size_t nl = normalize_key(b->passenger_name, name);
+    int c = class_id(b->travel_class);
+    size_t cl = normalize_key(c >= 0 ? class_codes[c] : b->travel_class, cls);
+    unsigned long long h = 1469598103934665603ull;
+    for (size_t i = 0; i < nl; ++i) h = (h ^ (unsigned char)name[i]) * 1099511628211ull;
+    h = (h ^ 0xFF) * 1099511628211ull;
+    for (size_t i = 0; i < cl; ++i) h = (h ^ (unsigned char)cls[i]) * 1099511628211ull;
+    h = (h ^ (unsigned int)b->age) * 1099511628211ull;
+    h = (h ^ (unsigned int)b->train_id) * 1099511628211ull;
+    return h ? h : 1;
+}
+
+void release_index_map() {
+    if (!store->index_map) return;
+    mem_account(MEM_INDEX_MAP, -(long long)store->index_map_len);
+#ifndef _WIN32
+    munmap(store->index_map, store->index_map_len);
+#else
+    free(store->index_map);
+#endif
+    store->index_map = NULL;
+    store->index_map_len = 0;
+}
+
+/* Tables that point into a mapping are never freed individually */
+void free_index_table(void *p, size_t bytes) {
+    char *c = (char*)p;
+    if (store->index_map && c >= (char*)store->index_map && c < (char*)store->index_map + store->index_map_len) return;
+    rb_free(MEM_INDEXES, p, bytes);
+}
+
+void id_index_resize(unsigned int cap) {
+    IdSlot *old = store->id_slots;
+    unsigned int old_cap = store->id_cap;
+    store->id_slots = (IdSlot*)rb_calloc(MEM_INDEXES, cap, sizeof(IdSlot));
+    store->id_cap = cap;
+    for (unsigned int i = 0; i < old_cap; ++i) {
+        if (!old[i].id) continue;
+        unsigned int j = hash_id(old[i].id) & (cap - 1);
+        while (store->id_slots[j].id) j = (j + 1) & (cap - 1);
+        store->id_slots[j] = old[i];
+    }
+    free_index_table(old, sizeof(IdSlot) * old_cap);
+}
+
+/* Slot holding id, or -1 */
+long id_index_find(unsigned int id) {
+    if (!store->id_cap) return -1;
+    for (unsigned int j = hash_id(id) & (store->id_cap - 1); store->id_slots[j].id; j = (j + 1) & (store->id_cap - 1))
+        if (store->id_slots[j].id == id) return (long)j;
+    return -1;
+}
+
+void id_index_put(unsigned int id, unsigned int ordinal) {
+    if ((store->id_used + 1) * 10 > store->id_cap * 7) id_index_resize(store->id_cap ? store->id_cap * 2 : 1024);
+    unsigned int j = hash_id(id) & (store->id_cap - 1);
+    while (store->id_slots[j].id && store->id_slots[j].id != id) j = (j + 1) & (store->id_cap - 1);
+    if (!store->id_slots[j].id) store->id_used++;
+    store->id_slots[j].id = id;
+    store->id_slots[j].ordinal = ordinal;
+}
+
+/* Linear-probing delete: shift later members of the cluster back */
+void id_index_del(unsigned int id) {
+    long found = id_index_find(id);
+    if (found < 0) return;
+    unsigned int i = (unsigned int)found, mask = store->id_cap - 1;
+    store->id_slots[i].id = 0;
+    store->id_used--;
+    for (unsigned int j = (i + 1) & mask; store->id_slots[j].id; j = (j + 1) & mask) {
+        unsigned int home = hash_id(store->id_slots[j].id) & mask;
+        // move j into the hole if its home position is not in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            store->id_slots[i] = store->id_slots[j];
+            store->id_slots[j].id = 0;
+            i = j;
+        }
+    }
+}
+
+void dup_resize(unsigned int cap) {
+    DupSlot *old = store->dup_slots;
+    unsigned int old_cap = store->dup_cap;
+    store->dup_slots = (DupSlot*)rb_calloc(MEM_INDEXES, cap, sizeof(DupSlot));
+    store->dup_cap = cap;
+    store->dup_used = 0;
+    for (unsigned int i = 0; i < old_cap; ++i) {
+        if (!old[i].key || !old[i].count) continue;    // drop dead keys while rehashing
+        unsigned int j = (unsigned int)old[i].key & (cap - 1);
+        while (store->dup_slots[j].key) j = (j + 1) & (cap - 1);
+        store->dup_slots[j] = old[i];
+        store->dup_used++;
+    }
+    free_index_table(old, sizeof(DupSlot) * old_cap);
+}
+
+DupSlot *dup_find(unsigned long long key) {
+    if (!store->dup_cap) return NULL;
+    for (unsigned int j = (unsigned int)key & (store->dup_cap - 1); store->dup_slots[j].key; j = (j + 1) & (store->dup_cap - 1))
+        if (store->dup_slots[j].key == key) return &store->dup_slots[j];
+    return NULL;
+}
+
+void dup_add(unsigned long long key) {
+    DupSlot *d = dup_find(key);
+    if (d) { d->count++; return; }
+    if ((store->dup_used + 1) * 10 > store->dup_cap * 7) dup_resize(store->dup_cap ? store->dup_cap * 2 : 1024);
+    unsigned int j = (unsigned int)key & (store->dup_cap - 1);
+    while (store->dup_slots[j].key) j = (j + 1) & (store->dup_cap - 1);
+    store->dup_slots[j].key = key;
+    store->dup_slots[j].count = 1;
+    store->dup_used++;
+}
+
+void dup_remove(unsigned long long key) {
+    DupSlot *d = dup_find(key);
+    if (d && d->count) d->count--;
+}
+
+int train_slot(int train_id) {
+    for (int i = 0; i < MAX_TRAINS; ++i) if (store->trains[i].id == train_id) return i;
+    return -1;
+}
+
+void bump_train_gen(int train_id) {
+    int t = train_slot(train_id);
+    if (t >= 0) store->train_gen[t]++;
+}
+
+void bump_all_train_gens() {
+    for (int i = 0; i < MAX_TRAINS; ++i) store->train_gen[i]++;
+}
+
+int cmp_int(const void *a, const void *b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Booking ids of one account, in the order they were indexed */
+typedef struct OwnerList {
+    int *ids;
+    int n, cap;
+} OwnerList;
+
+void owner_add(const Booking *b) {
+    int o = b->owner_id;
+    if (o <= 0) return;
+    if (o >= store->owner_lists_cap) {
+        int cap = store->owner_lists_cap ? store->owner_lists_cap : 64;
+        while (cap <= o) cap *= 2;
+        store->owner_lists = (OwnerList*)rb_realloc(MEM_INDEXES, store->owner_lists, sizeof(OwnerList) * store->owner_lists_cap,
+                                             sizeof(OwnerList) * cap);
+        memset(store->owner_lists + store->owner_lists_cap, 0, sizeof(OwnerList) * (cap - store->owner_lists_cap));
+        store->owner_lists_cap = cap;
+    }
+    OwnerList *l = &store->owner_lists[o];
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 4;
+        l->ids = (int*)rb_realloc(MEM_INDEXES, l->ids, sizeof(int) * l->cap, sizeof(int) * cap);
+        l->cap = cap;
+    }
+    l->ids[l->n++] = b->booking_id;
+}
+
+void owner_remove(const Booking *b) {
+    int o = b->owner_id;
+    if (o <= 0 || o >= store->owner_lists_cap) return;
+    OwnerList *l = &store->owner_lists[o];
+    for (int i = l->n - 1; i >= 0; --i)
+        if (l->ids[i] == b->booking_id) {
+            memmove(l->ids + i, l->ids + i + 1, sizeof(int) * (l->n - i - 1));
+            l->n--;
+            return;
+        }
+}
+
+void reset_owner_lists() {
+    for (int i = 0; i < store->owner_lists_cap; ++i) rb_free(MEM_INDEXES, store->owner_lists[i].ids, sizeof(int) * store->owner_lists[i].cap);
+    rb_free(MEM_INDEXES, store->owner_lists, sizeof(OwnerList) * store->owner_lists_cap);
+    store->owner_lists = NULL;
+    store->owner_lists_cap = 0;
+}
+
+/* Same-day rule (RB_DUP_SAME_DAY): a passenger, by normalized name and age, may hold
+   one journey per date: 1 (default) on a given route (from -> to), whatever the
+   train or class, 2 on any train at all, 0 turns the rule off. The catalog has no
+   timetable, so any two journeys on the same date count as overlapping. Bookings
+   without a journey date are not covered. */
+int dup_same_day = 1;
+
+/* Trip set key of a booking, 0 if the rule does not cover it */
+unsigned long long trip_key(const Booking *b) {
+    if (!dup_same_day || !b->journey_date) return 0;
+    char name[MAX_NAME];
+    size_t nl = normalize_key(b->passenger_name, name);
+    unsigned long long h = 1469598103934665603ull;
+    for (size_t i = 0; i < nl; ++i) h = (h ^ (unsigned char)name[i]) * 1099511628211ull;
+    h = (h ^ 0xFF) * 1099511628211ull;
+    h = (h ^ (unsigned int)b->age) * 1099511628211ull;
+    h = (h ^ (unsigned int)b->journey_date) * 1099511628211ull;
+    if (dup_same_day == 1) {
+        int t = train_slot(b->train_id);
+        if (t < 0) return 0;
+        const char *ends[2] = { store->trains[t].from, store->trains[t].to };
+        for (int e = 0; e < 2; ++e) {
+            int sid = station_id(ends[e]);     // "NDLS" and "Delhi" are the same end
+            char st[MAX_NAME];
+            size_t sl = normalize_key(sid >= 0 ? station_codes[sid].name : ends[e], st);
+            h = (h ^ 0xFF) * 1099511628211ull;
+            for (size_t i = 0; i < sl; ++i) h = (h ^ (unsigned char)st[i]) * 1099511628211ull;
+        }
+    }
+    return h ? h : 1;
+}
+
+/* Fingerprint of what trip keys depend on: the rule and every train's route */
+unsigned int trip_stamp() {
+    Booking b;
+    memset(&b, 0, sizeof(b));
+    strcpy(b.passenger_name, "-");
+    b.journey_date = 1;
+    unsigned long long h = 1469598103934665603ull;
+    h = (h ^ (unsigned int)dup_same_day) * 1099511628211ull;
+    for (int t = 0; t < MAX_TRAINS; ++t) {
+        b.train_id = store->trains[t].id;
+        h = (h ^ trip_key(&b)) * 1099511628211ull;
+    }
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+void trip_resize(unsigned int cap) {
+    DupSlot *old = store->trip_slots;
+    unsigned int old_cap = store->trip_cap;
+    store->trip_slots = (DupSlot*)rb_calloc(MEM_INDEXES, cap, sizeof(DupSlot));
+    store->trip_cap = cap;
+    store->trip_used = 0;
+    for (unsigned int i = 0; i < old_cap; ++i) {
+        if (!old[i].key || !old[i].count) continue;
+        unsigned int j = (unsigned int)old[i].key & (cap - 1);
+        while (store->trip_slots[j].key) j = (j + 1) & (cap - 1);
+        store->trip_slots[j] = old[i];
+        store->trip_used++;
+    }
+    free_index_table(old, sizeof(DupSlot) * old_cap);
+}
+
+DupSlot *trip_find(unsigned long long key) {
+    if (!store->trip_cap) return NULL;
+    for (unsigned int j = (unsigned int)key & (store->trip_cap - 1); store->trip_slots[j].key; j = (j + 1) & (store->trip_cap - 1))
+        if (store->trip_slots[j].key == key) return &store->trip_slots[j];
+    return NULL;
+}
+
+void trip_add(const Booking *b) {
+    unsigned long long key = trip_key(b);
+    if (!key) return;
+    DupSlot *d = trip_find(key);
+    if (d) { d->count++; return; }
+    if ((store->trip_used + 1) * 10 > store->trip_cap * 7) trip_resize(store->trip_cap ? store->trip_cap * 2 : 1024);
+    unsigned int j = (unsigned int)key & (store->trip_cap - 1);
+    while (store->trip_slots[j].key) j = (j + 1) & (store->trip_cap - 1);
+    store->trip_slots[j].key = key;
+    store->trip_slots[j].count = 1;
+    store->trip_used++;
+}
+
+void trip_remove(const Booking *b) {
+    DupSlot *d = trip_find(trip_key(b));
+    if (d && d->count) d->count--;
+}
+
+void reset_trips() {
+    free_index_table(store->trip_slots, sizeof(DupSlot) * store->trip_cap);
+    store->trip_slots = NULL;
+    store->trip_cap = store->trip_used = 0;
+}
+
+void set_ordinal(unsigned int ordinal, Node *n) {
+    if (ordinal >= store->ordinal_cap) {
+        unsigned int cap = store->ordinal_cap ? store->ordinal_cap : 1024;
+        while (cap <= ordinal) cap *= 2;
+        store->by_ordinal = (Node**)rb_realloc(MEM_INDEXES, store->by_ordinal, sizeof(Node*) * store->ordinal_cap, sizeof(Node*) * cap);
+        memset(store->by_ordinal + store->ordinal_cap, 0, sizeof(Node*) * (cap - store->ordinal_cap));
+        store->ordinal_cap = cap;
+    }
+    store->by_ordinal[ordinal] = n;
+    if (ordinal >= store->num_ordinals) store->num_ordinals = ordinal + 1;
+}
+
+/* Add a node that was just linked into the list. Caller holds store->lock. */
+void index_insert(Node *n) {
+    unsigned int ord = store->num_ordinals;
+    set_ordinal(ord, n);
+    id_index_put((unsigned int)n->b.booking_id, ord);
+    dup_add(dup_key(&n->b));
+    owner_add(&n->b);
+    trip_add(&n->b);
+    int t = train_slot(n->b.train_id);
+    if (t >= 0) {
+        store->train_booked[t]++;
+        store->train_gen[t]++;
+    }
+}
+
+/* Drop a node that is being unlinked. Caller holds store->lock. */
+void index_remove(Node *n) {
+    long j = id_index_find((unsigned int)n->b.booking_id);
+    if (j >= 0) {
+        store->by_ordinal[store->id_slots[j].ordinal] = NULL;
+        id_index_del((unsigned int)n->b.booking_id);
+    }
+    dup_remove(dup_key(&n->b));
+    owner_remove(&n->b);
+    trip_remove(&n->b);
+    int t = train_slot(n->b.train_id);
+    if (t >= 0) {
+        store->train_booked[t]--;
+        store->train_gen[t]++;
+    }
+}
+
+Node *index_lookup(int id) {
+    long j = id_index_find((unsigned int)id);
+    return j >= 0 ? store->by_ordinal[store->id_slots[j].ordinal] : NULL;
+}
+
+void reset_indexes() {
+    free_index_table(store->id_slots, sizeof(IdSlot) * store->id_cap);
+    free_index_table(store->dup_slots, sizeof(DupSlot) * store->dup_cap);
+    reset_trips();
+    release_index_map();
+    store->id_slots = NULL; store->id_cap = store->id_used = 0;
+    store->dup_slots = NULL; store->dup_cap = store->dup_used = 0;
+    rb_free(MEM_INDEXES, store->by_ordinal, sizeof(Node*) * store->ordinal_cap);
+    store->by_ordinal = NULL;
+    store->num_ordinals = store->ordinal_cap = 0;
+    memset(store->train_booked, 0, sizeof(store->train_booked));
+    bump_all_train_gens();      // the catalog may change with the store
+    reset_owner_lists();
+}
+
+/* Renumber ordinals to list order, which is the order save_bookings() writes records in */
+void renumber_ordinals() {
+    unsigned int pos = 0;
+    for (Node *c = store->head; c; c = c->next, ++pos) {
+        long j = id_index_find((unsigned int)c->b.booking_id);
+        if (j >= 0) store->id_slots[j].ordinal = pos;
+        set_ordinal(pos, c);
+    }
+    store->num_ordinals = pos;
+}
+
+/* Write the index tables for the snapshot with the given seq. Returns 0 on success. */
+int write_index_file(const char *path, unsigned long long seq, long long count) {
+    unsigned char h[INDEX_HEADER_SIZE];
+    memset(h, 0, sizeof(h));
+    memcpy(h, INDEX_MAGIC, strlen(INDEX_MAGIC));
+    le32_put(h + 8, INDEX_VERSION);
+    le32_put(h + 12, MAX_TRAINS);
+    le64_put(h + 16, seq);
+    le64_put(h + 24, (unsigned long long)count);
+    le32_put(h + 32, store->id_cap);
+    le32_put(h + 36, store->id_used);
+    le32_put(h + 40, store->dup_cap);
+    le32_put(h + 44, store->dup_used);
+    pthread_mutex_lock(&store->id_lease_lock);
+    le32_put(h + 48, (unsigned int)store->next_booking_id);
+    pthread_mutex_unlock(&store->id_lease_lock);
+    le32_put(h + 52, store->trip_cap);
+    le32_put(h + 56, store->trip_used);
+    le32_put(h + 60, trip_stamp());
+    unsigned char counts[(MAX_TRAINS + 1) / 2 * 8];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < MAX_TRAINS; ++i) le32_put(counts + 4 * i, (unsigned int)store->train_booked[i]);
+
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+    // the tables are written as they sit in memory, which is the file layout on little-endian hosts
+    int ok = fwrite(h, sizeof(h), 1, fp) == 1 && fwrite(counts, sizeof(counts), 1, fp) == 1 &&
+             fwrite(store->id_slots, sizeof(IdSlot), store->id_cap, fp) == store->id_cap &&
+             fwrite(store->dup_slots, sizeof(DupSlot), store->dup_cap, fp) == store->dup_cap &&
+             fwrite(store->trip_slots, sizeof(DupSlot), store->trip_cap, fp) == store->trip_cap;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Map bookings.idx and adopt its tables if it belongs to the snapshot (seq, count).
+   Returns 1 (and the saved next booking id) if the index was attached, 0 if it has to be rebuilt. */
+int attach_index_file(const char *path, unsigned long long seq, long long count, int *next_id) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    long long size = file_size(path);
+    if (size < INDEX_HEADER_SIZE) return 0;
+    unsigned char *base;
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    void *m = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return 0;
+    base = (unsigned char*)m;
+#else
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    base = (unsigned char*)malloc((size_t)size);
+    int got = fread(base, 1, (size_t)size, fp) == (size_t)size;
+    fclose(fp);
+    if (!got) { free(base); return 0; }
+#endif
+    store->index_map = base;
+    store->index_map_len = (size_t)size;
+    mem_account(MEM_INDEX_MAP, size);
+    size_t counts_len = (MAX_TRAINS + 1) / 2 * 8;
+    unsigned int icap = le32_get(base + 32), dcap = le32_get(base + 40), tcap = le32_get(base + 52);
+    int ok = memcmp(base, INDEX_MAGIC, strlen(INDEX_MAGIC)) == 0 &&
+             le32_get(base + 8) == INDEX_VERSION && le32_get(base + 12) == MAX_TRAINS &&
+             le64_get(base + 16) == seq && (long long)le64_get(base + 24) == count &&
+             le32_get(base + 60) == trip_stamp() &&
+             (icap & (icap - 1)) == 0 && (dcap & (dcap - 1)) == 0 && (tcap & (tcap - 1)) == 0 &&
+             (long long)(INDEX_HEADER_SIZE + counts_len + (size_t)icap * sizeof(IdSlot) +
+                         ((size_t)dcap + tcap) * sizeof(DupSlot)) == size;
+    if (!ok) {
+        release_index_map();
+        return 0;
+    }
+    store->id_cap = icap;
+    store->id_used = le32_get(base + 36);
+    store->dup_cap = dcap;
+    store->dup_used = le32_get(base + 44);
+    // an empty store has no tables; a pointer at the end of the mapping is not in it
+    store->id_slots = icap ? (IdSlot*)(base + INDEX_HEADER_SIZE + counts_len) : NULL;
+    store->dup_slots = dcap ? (DupSlot*)(base + INDEX_HEADER_SIZE + counts_len + (size_t)icap * sizeof(IdSlot)) : NULL;
+    store->trip_cap = tcap;
+    store->trip_used = le32_get(base + 56);
+    store->trip_slots = tcap ? (DupSlot*)(base + INDEX_HEADER_SIZE + counts_len + (size_t)icap * sizeof(IdSlot) +
+                                   (size_t)dcap * sizeof(DupSlot)) : NULL;
+    for (int i = 0; i < MAX_TRAINS; ++i) store->train_booked[i] = (int)le32_get(base + INDEX_HEADER_SIZE + 4 * i);
+    bump_all_train_gens();
+    *next_id = (int)le32_get(base + 48);
+    return 1;
+#else
+    (void)path; (void)seq; (void)count; (void)next_id;
+    return 0;
+#endif
+}
+
+/* ---------------- Journal ----------------
+   A commit appends one fixed-size entry to a journal file instead of rewriting
+   bookings.dat. Every thread appends to its own journal (journal_NN.log; RB_JOURNALS
+   files, handed to threads round-robin), so commits from different threads never
+   share a file position; store->lock is held only to apply the change in memory and
+   take the next global sequence number.
+   Every RB_CHECKPOINT_EVERY commits, and at exit, bookings.dat is rewritten as a
+   checkpoint: its header seq is a sequence number of its own, newer than every commit
+   it contains, after which the journals are emptied. Recovery reads all journals,
+   drops entries the snapshot already contains (seq below its seq) and applies the
+   rest in sequence order. RB_JOURNAL=0 goes back to saving bookings.dat on every
+   commit; RB_JOURNAL_FSYNC=1 syncs each entry before the booking is confirmed.
+   Only the process that owns the store (holds an exclusive flock on bookings.lock)
+   checkpoints, truncates journals or writes bookings.dat after recovery. Anyone else
+   that loads the store (lookup, stats, stations, replay) applies the journals in
+   memory only and leaves every file as it found it.
+
+   entry (little-endian, JOURNAL_ENTRY_SIZE bytes):
+      0  u64 seq    8  u32 op (1 book, 2 cancel)    12  u32 checksum32 of the entry
+     16  the booking as a portable snapshot record (a cancel only needs booking_id)
+   Journals written before owner ids hold version 3 records (LEGACY_JOURNAL_ENTRY_SIZE
+   bytes per entry); the size is told from whichever checksums the first entry.
+   The checksum is computed with its own field zeroed; a torn entry at the end of a
+   journal is the tail of a commit that was never confirmed and is ignored.
+*/
+#define JOURNAL_PREFIX "journal_"
+#define OWNER_LOCK_FILE "bookings.lock"
+#define JOURNAL_ENTRY_SIZE (16 + DISK_RECORD_SIZE)
+#define LEGACY_JOURNAL_ENTRY_SIZE (16 + V3_RECORD_SIZE)
+#define MAX_JOURNALS 64
+#define JOURNAL_BOOK 1
+#define JOURNAL_CANCEL 2
+
+typedef struct Journal {
+    pthread_mutex_t lock;
+    int fd;
+} Journal;
+
+typedef struct {
+    unsigned long long seq;
+    int op;
+    Booking b;
+} JournalEntry;
+
+int journal_enabled = 1;
+int num_journals = 4;
+int journal_fsync = 0;
+int checkpoint_every = 10000;
+const char *journal_prefix = JOURNAL_PREFIX;
+
+pthread_key_t journal_key;          /* 1 + the calling thread's journal number */
+pthread_once_t journal_key_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t journal_assign_lock = PTHREAD_MUTEX_INITIALIZER;
+int next_journal = 0;
+
+/* Journal i of the current store */
+void journal_path(const char *prefix, int i, char *buf, size_t n) {
+    snprintf(buf, n, "%s%s%02d.log", store->dir, prefix, i);
+}
+
+void journal_encode(unsigned char *e, unsigned long long seq, int op, const Booking *b) {
+    le64_put(e, seq);
+    le32_put(e + 8, (unsigned int)op);
+    le32_put(e + 12, 0);
+    encode_disk_record(b, e + 16);
+    le32_put(e + 12, checksum32(e, JOURNAL_ENTRY_SIZE));
+}
+
+/* Returns 0 if the entry (size bytes, holding a record of the given snapshot version)
+   is intact */
+int journal_decode(unsigned char *e, size_t size, int version, JournalEntry *out) {
+    unsigned int sum = le32_get(e + 12);
+    le32_put(e + 12, 0);
+    int ok = checksum32(e, size) == sum;
+    le32_put(e + 12, sum);
+    if (!ok) return -1;
+    out->seq = le64_get(e);
+    out->op = (int)le32_get(e + 8);
+    if (out->op != JOURNAL_BOOK && out->op != JOURNAL_CANCEL) return -1;
+    return decode_record(version, e + 16, &out->b);
+}
+
+/* Append the intact entries of one journal file to *arr. Returns the offset of the
+   first bad entry, or -1 if the whole file was read; *torn tells whether that bad
+   entry is an incomplete one at the very end. */
+long long read_journal_file(const char *path, JournalEntry **arr, int *n, int *cap, int *torn) {
+    *torn = 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    unsigned char e[JOURNAL_ENTRY_SIZE];
+    long long off = 0, bad = -1;
+    size_t got, size = JOURNAL_ENTRY_SIZE;
+    int version = SNAPSHOT_VERSION;
+    JournalEntry je;
+    if (fread(e, 1, LEGACY_JOURNAL_ENTRY_SIZE, fp) == LEGACY_JOURNAL_ENTRY_SIZE &&
+        journal_decode(e, LEGACY_JOURNAL_ENTRY_SIZE, SNAPSHOT_V3, &je) == 0) {
+        size = LEGACY_JOURNAL_ENTRY_SIZE;
+        version = SNAPSHOT_V3;
+        store->journal_legacy_seen = 1;
+    }
+    rewind(fp);
+    while ((got = fread(e, 1, size, fp)) > 0) {
+        if (got < size || journal_decode(e, size, version, &je) != 0) {
+            bad = off;
+            *torn = got < size;
+            break;
+        }
+        if (*n == *cap) {
+            *cap = *cap ? *cap * 2 : 256;
+            *arr = (JournalEntry*)realloc(*arr, sizeof(JournalEntry) * *cap);
+        }
+        (*arr)[(*n)++] = je;
+        off += (long long)got;
+    }
+    fclose(fp);
+    return bad;
+}
+
+int cmp_journal_seq(const void *a, const void *b) {
+    unsigned long long x = ((const JournalEntry*)a)->seq, y = ((const JournalEntry*)b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+/* Merge every journal with the given prefix into one array sorted by seq.
+   *damaged counts journals with a bad entry that is not just a torn tail. */
+int read_journals(const char *prefix, JournalEntry **out, int *damaged) {
+    JournalEntry *arr = NULL;
+    int n = 0, cap = 0;
+    *damaged = 0;
+    for (int i = 0; i < MAX_JOURNALS; ++i) {
+        char path[256];
+        int torn;
+        journal_path(prefix, i, path, sizeof(path));
+        if (read_journal_file(path, &arr, &n, &cap, &torn) >= 0 && !torn) (*damaged)++;
+    }
+    qsort(arr, (size_t)n, sizeof(JournalEntry), cmp_journal_seq);
+    *out = arr;
+    return n;
+}
+
+void make_journal_key() {
+    pthread_key_create(&journal_key, NULL);
+}
+
+/* The journal this thread appends to in the current store. Threads are numbered
+   once and take the same journal number in every store. */
+Journal *my_journal() {
+    pthread_once(&journal_key_once, make_journal_key);
+    long n = (long)pthread_getspecific(journal_key);
+    if (!n) {
+        pthread_mutex_lock(&journal_assign_lock);
+        n = ++next_journal;
+        pthread_mutex_unlock(&journal_assign_lock);
+        pthread_setspecific(journal_key, (void*)n);
+    }
+    return &store->journals[(n - 1) % store->journals_open];
+}
+
+/* Open (creating) the journals commits go to. Returns 0 on success. */
+int journal_open_all() {
+#ifndef _WIN32
+    if (num_journals < 1) num_journals = 1;
+    if (num_journals > MAX_JOURNALS) num_journals = MAX_JOURNALS;
+    for (int i = 0; i < num_journals; ++i) {
+        char path[256];
+        journal_path(journal_prefix, i, path, sizeof(path));
+        store->journals[i].fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (store->journals[i].fd < 0) {
+            while (i-- > 0) close(store->journals[i].fd);
+            return -1;
+        }
+        pthread_mutex_init(&store->journals[i].lock, NULL);
+    }
+    store->journals_open = num_journals;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void journal_close_all() {
+#ifndef _WIN32
+    for (int i = 0; i < store->journals_open; ++i) {
+        close(store->journals[i].fd);
+        pthread_mutex_destroy(&store->journals[i].lock);
+    }
+#endif
+    store->journals_open = 0;
+}
+
+/* Write one entry to the calling thread's journal. Returns 0 once it is in the file. */
+int journal_append(const unsigned char *e) {
+#ifndef _WIN32
+    Journal *j = my_journal();
+    pthread_mutex_lock(&j->lock);    // only contended by threads sharing this journal
+    int ok = write(j->fd, e, JOURNAL_ENTRY_SIZE) == JOURNAL_ENTRY_SIZE;
+    if (ok && journal_fsync) ok = fsync(j->fd) == 0;
+    pthread_mutex_unlock(&j->lock);
+    if (!ok) printf("Error: could not write journal entry.\n");
+    return ok ? 0 : -1;
+#else
+    (void)e;
+    return -1;
+#endif
+}
+
+/* Take the owner lock at path; returns its descriptor, or -1 if another process
+   holds it. The lock goes away with the descriptor, so a crashed owner never
+   leaves the store locked. */
+int lock_store_file(const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    (void)path;
+    return 0;
+#endif
+}
+
+/* Become the owner of the current store. Returns 0 on success, -1 if another
+   process owns it. */
+int claim_store() {
+#ifndef _WIN32
+    if (store->owner_fd >= 0) return 0;
+    char path[MAX_STORE_PATH];
+    store_path(OWNER_LOCK_FILE, path, sizeof(path));
+    store->owner_fd = lock_store_file(path);
+    if (store->owner_fd < 0) return -1;
+#endif
+    return 0;
+}
+
+void release_store() {
+#ifndef _WIN32
+    if (store->owner_fd >= 0) close(store->owner_fd);
+    store->owner_fd = -1;
+#endif
+}
+
+int owns_store() {
+#ifndef _WIN32
+    return store->owner_fd >= 0;
+#else
+    return 1;       // no journals and no other processes to share them with
+#endif
+}
+
+/* Empty the journals after a checkpoint; journals this process does not use are removed */
+void journal_truncate_all() {
+    if (!owns_store()) return;
+    for (int i = 0; i < MAX_JOURNALS; ++i) {
+#ifndef _WIN32
+        if (i < store->journals_open) {
+            pthread_mutex_lock(&store->journals[i].lock);
+            if (ftruncate(store->journals[i].fd, 0) != 0) printf("Error: could not truncate journal.\n");
+            pthread_mutex_unlock(&store->journals[i].lock);
+            continue;
+        }
+#endif
+        char path[256];
+        journal_path(journal_prefix, i, path, sizeof(path));
+        remove(path);
+    }
+}
+
+/* ---------------- Background load ----------------
+   With a matching bookings.idx the menu does not wait for bookings.dat: the index
+   header already carries the seat counters and next booking id, and the mapped
+   tables answer availability and duplicate probes. Records are then decoded by a
+   loader thread one chunk (SNAP_BLOCK_RECORDS records, or one compressed block) at
+   a time. A lookup whose record is not in memory yet asks the loader for that chunk
+   next and waits only for it; saving and listing wait for the whole file.
+   All bg_* state is guarded by store->lock.
+*/
+long long bg_chunk_first(int c) {
+    return store->bg_blocks ? store->bg_blocks[c].first_record : (long long)c * SNAP_BLOCK_RECORDS;
+}
+
+long long bg_chunk_records(int c) {
+    if (store->bg_blocks) return store->bg_blocks[c].bh.records;
+    long long left = store->bg_total - bg_chunk_first(c);
+    return left < SNAP_BLOCK_RECORDS ? left : SNAP_BLOCK_RECORDS;
+}
+
+int bg_chunk_of(long long ord) {
+    if (!store->bg_blocks) return (int)(ord / SNAP_BLOCK_RECORDS);
+    int lo = 0, hi = store->bg_nchunks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (store->bg_blocks[mid].first_record <= ord) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Wait (holding store->lock) until ordinal ord has been loaded */
+void await_ordinal_locked(unsigned int ord) {
+    if (!store->bg_loading || ord >= store->bg_total) return;
+    int c = bg_chunk_of(ord);
+    while (store->bg_loading && !store->bg_chunk_loaded[c]) {
+        store->bg_want = c;
+        pthread_cond_wait(&store->load_cond, &store->lock);
+    }
+}
+
+/* Wait (holding store->lock) until every record is in the list */
+void await_load_locked() {
+    while (store->bg_loading) pthread_cond_wait(&store->load_cond, &store->lock);
+}
+
+void rebuild_indexes() {
+    reset_indexes();
+    for (Node *c = store->head; c; c = c->next) index_insert(c);
+}
+
+void *background_load_worker(void *p) {
+    (void)p;
+    long long start = now_ms();
+    char path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    Booking *recs = (Booking*)rb_malloc(MEM_LOADER, sizeof(Booking) * SNAP_BLOCK_RECORDS);
+    size_t buf_len = store->bg_blocks ? 0 : (size_t)store->bg_si.rec_size * SNAP_BLOCK_RECORDS;
+    unsigned char *buf = store->bg_blocks ? NULL : (unsigned char*)rb_malloc(MEM_LOADER, buf_len);
+    size_t cap = 0;
+    int damaged = !fp, next = 0;
+    for (;;) {
+        pthread_mutex_lock(&store->lock);
+        int c = store->bg_want;
+        if (c < 0 || store->bg_chunk_loaded[c]) {
+            while (next < store->bg_nchunks && store->bg_chunk_loaded[next]) next++;
+            c = next < store->bg_nchunks ? next : -1;
+        }
+        pthread_mutex_unlock(&store->lock);
+        if (c < 0) break;
+
+        long long first = bg_chunk_first(c), cnt = bg_chunk_records(c);
+        if (cnt > SNAP_BLOCK_RECORDS) {     // recs holds one chunk; block_framed() keeps blocks within it
+            cnt = 0;
+            damaged = 1;
+        } else if (!fp) {
+            memset(recs, 0, sizeof(Booking) * cnt);
+        } else if (store->bg_blocks) {
+            if (read_snapshot_block(fp, store->bg_si.version, &store->bg_blocks[c], &buf, &cap, recs) != 0) damaged = 1;
+        } else {
+            size_t got = 0;
+            if (rb_fseek(fp, store->bg_si.data_off + first * store->bg_si.rec_size, SEEK_SET) == 0)
+                got = fread(buf, (size_t)store->bg_si.rec_size, (size_t)cnt, fp);
+            for (long long i = 0; i < cnt; ++i)
+                if ((size_t)i >= got || decode_record(store->bg_si.version, buf + i * store->bg_si.rec_size, &recs[i]) != 0) {
+                    recs[i].booking_id = 0;
+                    damaged = 1;
+                }
+        }
+
+        pthread_mutex_lock(&store->lock);
+        for (long long i = 0; i < cnt; ++i) {
+            if (recs[i].booking_id == 0) continue;
+            Node *node = (Node*)rb_malloc(MEM_BOOKINGS, sizeof(Node));
+            node->b = recs[i];
+            node->next = store->head;
+            store->head = node;
+            set_ordinal((unsigned int)(first + i), node);
+            owner_add(&node->b);
+        }
+        store->bg_chunk_loaded[c] = 1;
+        if (store->bg_want == c) store->bg_want = -1;
+        pthread_cond_broadcast(&store->load_cond);
+        pthread_mutex_unlock(&store->lock);
+    }
+    if (fp) fclose(fp);
+    // for LZ blocks read_snapshot_block() owns buf and its few KB are not counted
+    free(buf);
+    mem_account(MEM_LOADER, -(long long)buf_len);
+    rb_free(MEM_LOADER, recs, sizeof(Booking) * SNAP_BLOCK_RECORDS);
+
+    pthread_mutex_lock(&store->lock);
+    if (damaged) {
+        // the index described records that were lost: derive it from what was read
+        rebuild_indexes();
+        printf("\nWarning: %s is damaged or truncated; run 'fsck' to locate damage.\n", path);
+    }
+    rb_free(MEM_LOADER, store->bg_blocks, sizeof(SnapBlock) * store->bg_nchunks);
+    rb_free(MEM_LOADER, store->bg_chunk_loaded, (size_t)store->bg_nchunks);
+    store->bg_blocks = NULL;
+    store->bg_chunk_loaded = NULL;
+    store->bg_loading = 0;
+    pthread_cond_broadcast(&store->load_cond);
+    pthread_mutex_unlock(&store->lock);
+    log_event(EV_LOAD_DONE, (int)store->bg_total, (int)(now_ms() - start), damaged, NULL);
+    return NULL;
+}
+
+/* Start loading bookings.dat in the background. Returns 0 (nothing started) when the
+   file is missing, looks damaged, or has no matching index; the caller then loads it
+   synchronously. */
+int start_background_load() {
+    char path[MAX_STORE_PATH], index_path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, path, sizeof(path));
+    store_path(INDEX_FILE, index_path, sizeof(index_path));
+    long long size = file_size(path);
+    FILE *fp = size >= 0 ? fopen(path, "rb") : NULL;
+    if (!fp) return 0;
+    SnapshotInfo si;
+    probe_snapshot(fp, size, &si);
+    SnapBlock *blocks = NULL;
+    int nchunks = 0;
+    long long total = si.count;
+    int ok = si.rec_size != 0;
+    if (ok && snapshot_is_compressed(si.version)) {
+        long long bad_off;
+        nchunks = scan_snapshot_blocks(fp, &si, size, &blocks, &bad_off);
+        total = nchunks ? blocks[nchunks-1].first_record + blocks[nchunks-1].bh.records : 0;
+        ok = bad_off < 0;
+    } else if (ok) {
+        nchunks = (int)((total + SNAP_BLOCK_RECORDS - 1) / SNAP_BLOCK_RECORDS);
+        ok = si.tail == 0;
+    }
+    fclose(fp);
+    int next_id = 0;
+    if (!ok || total != si.header_count || store->journal_max_seq > si.seq ||    // journaled changes need replay
+        !attach_index_file(index_path, si.seq, total, &next_id)) {
+        free(blocks);
+        return 0;
+    }
+    store->snapshot_seq = si.seq;
+    store->next_booking_id = next_id;
+    if (total == 0) {
+        free(blocks);
+        return 1;
+    }
+    store->bg_si = si;
+    store->bg_blocks = blocks;
+    if (blocks) mem_account(MEM_LOADER, (long long)sizeof(SnapBlock) * nchunks);
+    store->bg_total = total;
+    store->bg_nchunks = nchunks;
+    store->bg_chunk_loaded = (unsigned char*)rb_calloc(MEM_LOADER, (size_t)nchunks, 1);
+    store->bg_want = -1;
+    set_ordinal((unsigned int)(total - 1), NULL);   // reserve the loaded ordinals; new bookings go after them
+    store->bg_loading = 1;
+    if (start_store_thread(&store->bg_thread, background_load_worker, NULL) != 0) {
+        store->bg_loading = 0;
+        rb_free(MEM_LOADER, store->bg_chunk_loaded, (size_t)nchunks);
+        rb_free(MEM_LOADER, store->bg_blocks, sizeof(SnapBlock) * nchunks);
+        store->bg_chunk_loaded = NULL;
+        store->bg_blocks = NULL;
+        reset_indexes();
+        return 0;
+    }
+    store->bg_started = 1;
+    return 1;
+}
+
+/* Let a running background load finish (before exit) */
+void finish_background_load() {
+    if (!store->bg_started) return;
+    pthread_join(store->bg_thread, NULL);
+    store->bg_started = 0;
+}
+
+/* Node for a hot booking id, waiting for its chunk if it is still loading. Caller holds store->lock. */
+Node *lookup_booking_locked(int id) {
+    long j = id_index_find((unsigned int)id);
+    if (j >= 0 && store->bg_loading) {
+        await_ordinal_locked(store->id_slots[j].ordinal);
+        j = id_index_find((unsigned int)id);      // the index is rebuilt if the file was damaged
+    }
+    return j >= 0 ? store->by_ordinal[store->id_slots[j].ordinal] : NULL;
+}
+
+/* Load bookings.dat; with background set, return as soon as the index is attached
+   and let the records stream in (see start_background_load) */
+void load_bookings(int background) {
+    if (background && start_background_load()) return;
+    Booking *arr;
+    long long n;
+    int damaged, next_id;
+    char path[MAX_STORE_PATH], index_path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, path, sizeof(path));
+    store_path(INDEX_FILE, index_path, sizeof(index_path));
+    if (read_snapshot(path, &arr, &n, &damaged) != 0) {
+        if (file_size(path) >= 0)
+            printf("Warning: %s could not be read; run 'fsck' for details.\n", path);
+        return;
+    }
+    mem_account(MEM_LOADER, (long long)sizeof(Booking) * n);
+    int maxid = 0;
+    int attached = !damaged && attach_index_file(index_path, store->snapshot_seq, n, &next_id);
+    for (long long i = 0; i < n; ++i) {
+        if (arr[i].booking_id == 0) continue;   // lost to damage
+        Node *node = (Node*)rb_malloc(MEM_BOOKINGS, sizeof(Node));
+        node->b = arr[i];
+        node->next = store->head;
+        store->head = node;
+        if (attached) {
+            set_ordinal((unsigned int)i, node);
+            owner_add(&node->b);
+        } else {
+            index_insert(node);
+        }
+        if (arr[i].booking_id > maxid) maxid = arr[i].booking_id;
+    }
+    if (damaged)
+        printf("Warning: %s is damaged or truncated; run 'fsck' to locate damage.\n", path);
+    store->next_booking_id = maxid + 1;
+    free(arr);
+    mem_account(MEM_LOADER, -(long long)sizeof(Booking) * n);
+}
+
+/* Set from RB_COMPRESS: write snapshots as LZ-compressed blocks */
+int snapshot_compress = 0;
+
+/* Streams portable records to a snapshot file, one block at a time */
+typedef struct {
+    FILE *fp;
+    int compress;
+    unsigned char *block;       /* SNAP_BLOCK_RECORDS encoded records */
+    unsigned char *scratch;
+    int pending;
+    long long count;
+    int ok;
+} SnapshotWriter;
+
+int snapshot_writer_open(SnapshotWriter *w, const char *path, int compress) {
+    memset(w, 0, sizeof(*w));
+    w->fp = fopen(path, "wb");
+    if (!w->fp) return -1;
+    w->compress = compress;
+    w->block = (unsigned char*)malloc((size_t)DISK_RECORD_SIZE * SNAP_BLOCK_RECORDS);
+    w->scratch = (unsigned char*)malloc((size_t)DISK_RECORD_SIZE * SNAP_BLOCK_RECORDS);
+    unsigned char h[SNAPSHOT_HEADER_SIZE];
+    write_snapshot_header(h, compress ? SNAPSHOT_VERSION_LZ : SNAPSHOT_VERSION, 0, 0);
+    w->ok = fwrite(h, sizeof(h), 1, w->fp) == 1;
+    return 0;
+}
+
+void snapshot_writer_flush(SnapshotWriter *w) {
+    if (w->pending == 0 || !w->ok) return;
+    int len = w->pending * DISK_RECORD_SIZE;
+    if (w->compress) w->ok = write_block(w->fp, w->block, len, w->pending, w->scratch) > 0;
+    else w->ok = fwrite(w->block, 1, (size_t)len, w->fp) == (size_t)len;
+    w->pending = 0;
+}
+
+void snapshot_writer_add(SnapshotWriter *w, const Booking *b) {
+    encode_disk_record(b, w->block + (size_t)w->pending * DISK_RECORD_SIZE);
+    w->count++;
+    if (++w->pending == SNAP_BLOCK_RECORDS) snapshot_writer_flush(w);
+}
+
+/* Flush, fill in the final count and seq, close. Returns 0 on success. */
+int snapshot_writer_close(SnapshotWriter *w, unsigned long long seq) {
+    snapshot_writer_flush(w);
+    unsigned char h[SNAPSHOT_HEADER_SIZE];
+    write_snapshot_header(h, w->compress ? SNAPSHOT_VERSION_LZ : SNAPSHOT_VERSION, w->count, seq);
+    if (w->ok) w->ok = rb_fseek(w->fp, 0, SEEK_SET) == 0 && fwrite(h, sizeof(h), 1, w->fp) == 1;
+    if (w->ok) w->ok = sync_stream(w->fp) == 0;
+    if (fclose(w->fp) != 0) w->ok = 0;
+    free(w->block);
+    free(w->scratch);
+    return w->ok ? 0 : -1;
+}
+
+/* Write the booking list to path. Returns 0 on success. */
+int write_snapshot(const char *path, int compress, unsigned long long seq) {
+    SnapshotWriter w;
+    if (snapshot_writer_open(&w, path, compress) != 0) return -1;
+    for (Node *c = store->head; c; c = c->next) snapshot_writer_add(&w, &c->b);
+    return snapshot_writer_close(&w, seq);
+}
+
+/* Write to a temp file and rename it over bookings.dat, so readers (and hot
+   backups) never see a half-written file */
+void save_bookings() {
+    if (!owns_store()) {
+        printf("Error: this process does not own the store; bookings not saved.\n");
+        return;
+    }
+    await_load_locked();    // callers hold store->lock whenever a background load can be running
+    unsigned long long seq = (store->commit_seq > store->snapshot_seq ? store->commit_seq : store->snapshot_seq) + 1;
+    long long start = now_ms();
+    char path[MAX_STORE_PATH], tmp[MAX_STORE_PATH], index_path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, path, sizeof(path));
+    store_path(BOOKINGS_FILE ".tmp", tmp, sizeof(tmp));
+    store_path(INDEX_FILE, index_path, sizeof(index_path));
+    if (write_snapshot(tmp, snapshot_compress, seq) != 0 || replace_file(tmp, path) != 0) {
+        printf("Error: could not save bookings.\n");
+        return;
+    }
+    store->snapshot_seq = store->commit_seq = seq;
+    journal_truncate_all();     // everything journaled so far is in the new snapshot
+    // the index is derived data: if it cannot be written, the next start rebuilds it
+    renumber_ordinals();
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (write_index_file(index_path, store->snapshot_seq, store->num_ordinals) != 0) remove(index_path);
+#else
+    remove(index_path);
+#endif
+    log_event(EV_CHECKPOINT, (int)store->num_ordinals, (int)(now_ms() - start), (int)seq, NULL);
+}
+
+/* Called with store->lock held after a change has been applied to the list.
+   Returns 1 when the caller must journal_append(entry) after unlocking, 0 when
+   the change was persisted by a checkpoint instead. */
+int commit_locked(int op, const Booking *b, unsigned char *entry) {
+    if (!journal_enabled || !store->journals_open ||
+        (checkpoint_every > 0 && store->commit_seq - store->snapshot_seq >= (unsigned long long)checkpoint_every)) {
+        save_bookings();
+        return 0;
+    }
+    journal_encode(entry, ++store->commit_seq, op, b);
+    return 1;
+}
+
+/* Apply journal entries newer than the loaded snapshot, in sequence order. Replay stops
+   at the first missing sequence number: later entries were made on top of a change that
+   is lost, so they are reported and discarded rather than applied out of context. The
+   owner then checkpoints so the journals can be emptied; other processes keep the
+   changes in memory only. Returns the number applied. */
+int replay_journal(const JournalEntry *je, int n) {
+    int applied = 0, discarded = 0;
+    unsigned long long expect = store->snapshot_seq + 1;
+    for (int i = 0; i < n; ++i) {
+        if (je[i].seq < expect) continue;           // already in the snapshot or applied
+        if (je[i].seq != expect) {
+            for (int k = i; k < n; ++k) discarded += je[k].seq > store->snapshot_seq;
+            break;
+        }
+        expect++;
+        const Booking *b = &je[i].b;
+        Node *cur = index_lookup(b->booking_id);
+        if (je[i].op == JOURNAL_BOOK && !cur) {
+            Node *node = (Node*)rb_malloc(MEM_BOOKINGS, sizeof(Node));
+            node->b = *b;
+            node->next = store->head;
+            store->head = node;
+            index_insert(node);
+            if (b->booking_id >= store->next_booking_id) store->next_booking_id = b->booking_id + 1;
+        } else if (je[i].op == JOURNAL_CANCEL && cur) {
+            Node **pp = &store->head;
+            while (*pp != cur) pp = &(*pp)->next;
+            *pp = cur->next;
+            index_remove(cur);
+            rb_free(MEM_BOOKINGS, cur, sizeof(Node));
+        }
+        applied++;
+    }
+    if (store->snapshot_seq > store->commit_seq) store->commit_seq = store->snapshot_seq;
+    if (store->journal_max_seq > store->commit_seq) store->commit_seq = store->journal_max_seq;
+    if ((applied || discarded) && persist_enabled && owns_store()) {
+        printf("Recovered %d journaled change%s.\n", applied, applied == 1 ? "" : "s");
+        if (discarded)
+            printf("Warning: journal entry %llu is missing; discarded %d later change%s.\n",
+                   expect, discarded, discarded == 1 ? "" : "s");
+        log_event(EV_RECOVERED, applied, discarded, 0, NULL);
+        save_bookings();
+    }
+    return applied;
+}
+
+/* Count existing bookings for a given train */
+int count_bookings_for_train(int train_id) {
+    int t = train_slot(train_id);
+    return t >= 0 ? store->train_booked[t] : 0;
+}
+
+/* Duplicate detection:
+   Returns 1 if duplicate exists (same normalized name, same age, same train_id, same class)
+   The dup set answers the common "no" case with one probe; a hit is confirmed
+   against the list so a hash collision can never reject a booking.
+*/
+int is_duplicate_booking(const Booking *bk) {
+    DupSlot *d = dup_find(dup_key(bk));
+    if (!d || d->count == 0) return 0;
+    await_load_locked();
+    Node *cur = store->head;
+    while (cur) {
+        if (cur->b.age == bk->age &&
+            cur->b.train_id == bk->train_id &&
+            equalstr_nospaces_case(cur->b.passenger_name, bk->passenger_name) &&
+            same_class(cur->b.travel_class, bk->travel_class)
+           ) {
+            return 1;
+        }
+        cur = cur->next;
+    }
+    return 0;
+}
+
+/* ---------------- Fares ----------------
+   With RB_DYNAMIC_FARES on (the default) a train's fare rises with its occupancy:
+   the base fare up to half full, then the fare_bands steps below. Seats are per
+   train, not per class, so every class on a train is in the same band. The band
+   comes from train_booked[], which booking and cancelling already keep, so a quote
+   is one division and never counts bookings. A live booking or cancellation that
+   moves a train into another band logs EV_FARE_BAND; the listing cache notices through
+   train_gen[], which the same change bumps. Seats mid-payment do not move the band.
+   The fare is fixed when the seat is held, and a booking that was quoted a fare is
+   refused with BOOK_FARE_CHANGED, before anything is held or charged, if the fare at
+   that point differs.
+*/
+typedef struct {
+    int from_pct;       /* band starts at this occupancy, percent of total seats */
+    int fare_pct;       /* fare, percent of the base fare */
+} FareBand;
+
+const FareBand fare_bands[] = { {0, 100}, {50, 110}, {75, 125}, {90, 150} };
+#define NUM_FARE_BANDS (int)(sizeof(fare_bands) / sizeof(fare_bands[0]))
+
+int dynamic_fares = 1;
+
+int fare_band(int booked, int total) {
+    if (!dynamic_fares || total <= 0) return 0;
+    int b = 0;
+    while (b + 1 < NUM_FARE_BANDS && (long long)booked * 100 >= (long long)fare_bands[b + 1].from_pct * total) b++;
+    return b;
+}
+
+int band_fare(const Train *t, int band) {
+    return (int)((long long)t->fare * fare_bands[band].fare_pct / 100);
+}
+
+/* Fare of a train right now. Caller holds store->lock. */
+int current_fare(const Train *t) {
+    return band_fare(t, fare_band(count_bookings_for_train(t->id), t->total_seats));
+}
+
+/* After a live booking (+1) or cancellation (-1) on train slot t. Caller holds store->lock. */
+void occupancy_changed(int t, int delta) {
+    if (t < 0) return;
+    int booked = store->train_booked[t], total = store->trains[t].total_seats;
+    int before = fare_band(booked - delta, total), after = fare_band(booked, total);
+    if (before == after) return;
+    int fare = band_fare(&store->trains[t], after);
+    char text[16];
+    snprintf(text, sizeof(text), "%d", fare);
+    log_event(EV_FARE_BAND, store->trains[t].id, before, after, text);
+}
+
+/* ---------------- Booking ids ----------------
+   Ids are handed out in leased blocks: a thread takes RB_ID_BLOCK ids at a time from
+   next_booking_id (under id_lease_lock) and then numbers its bookings from its own
+   block without touching shared state. The end of the last leased block is written
+   to bookings.lease before any id of the block is used, so after a restart, even a
+   crash that lost the snapshot's tail, new ids start above every id ever handed out.
+   Ids stay unique and increase across restarts; the unused rest of each block is
+   skipped. A thread keeps one block per store it books in.
+
+   bookings.lease (little-endian): char magic[8] "RBLEASE1", u64 end of the leased ids
+*/
+#define LEASE_FILE "bookings.lease"
+#define LEASE_MAGIC "RBLEASE1"
+
+typedef struct {
+    int next;
+    int end;
+} IdLease;
+
+int id_block = 64;
+pthread_key_t lease_key;
+pthread_once_t lease_key_once = PTHREAD_ONCE_INIT;
+
+void free_id_lease(void *p) {
+    rb_free(MEM_LEASES, p, sizeof(IdLease) * MAX_TENANTS);
+}
+
+void make_lease_key() {
+    pthread_key_create(&lease_key, free_id_lease);
+}
+
+/* Persist the end of the leased range. Returns 0 on success. */
+int save_id_lease(int end) {
+    unsigned char buf[16];
+    memcpy(buf, LEASE_MAGIC, 8);
+    le64_put(buf + 8, (unsigned long long)end);
+    char path[MAX_STORE_PATH], tmp[MAX_STORE_PATH];
+    store_path(LEASE_FILE, path, sizeof(path));
+    store_path(LEASE_FILE ".tmp", tmp, sizeof(tmp));
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+    int ok = fwrite(buf, sizeof(buf), 1, fp) == 1 && sync_stream(fp) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Make sure next_booking_id is past every id leased by an earlier run */
+void load_id_lease() {
+    unsigned char buf[16];
+    char path[MAX_STORE_PATH];
+    store_path(LEASE_FILE, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return;
+    if (fread(buf, sizeof(buf), 1, fp) == 1 && memcmp(buf, LEASE_MAGIC, 8) == 0) {
+        unsigned long long end = le64_get(buf + 8);
+        if (end > (unsigned long long)store->next_booking_id && end < 0x7fffffffull) store->next_booking_id = (int)end;
+    }
+    fclose(fp);
+}
+
+/* Next booking id for the calling thread */
+int allocate_booking_id() {
+    pthread_once(&lease_key_once, make_lease_key);
+    IdLease *leases = (IdLease*)pthread_getspecific(lease_key);
+    if (!leases) {
+        leases = (IdLease*)rb_calloc(MEM_LEASES, MAX_TENANTS, sizeof(IdLease));
+        pthread_setspecific(lease_key, leases);
+    }
+    IdLease *l = &leases[store->slot];
+    if (l->next == l->end) {
+        pthread_mutex_lock(&store->id_lease_lock);
+        int block = id_block > 0 ? id_block : 1;
+        if (persist_enabled && save_id_lease(store->next_booking_id + block) != 0)
+            printf("Error: could not save %s.\n", LEASE_FILE);
+        l->next = store->next_booking_id;
+        l->end = store->next_booking_id += block;
+        pthread_mutex_unlock(&store->id_lease_lock);
+    }
+    return l->next++;
+}
+
+/* ---------------- Accounts ----------------
+   Passengers log in with a user name. Bookings made while logged in carry the
+   account id in owner_id, and the owner lists (see Indexes) give "my bookings"
+   without looking at anyone else's. Accounts identify a passenger; they do not
+   authenticate one (there are no passwords).
+
+   users.dat (little-endian, append-only): char magic[8] "RBUSERS1", then one
+   USER_RECORD_SIZE record per account: u32 id, char name[MAX_USER_NAME], u32
+   checksum32 of the id and name. Ids count up from 1 in file order. A torn or
+   damaged tail is ignored, and the file is rewritten without it before the next
+   account is added.
+
+   A login hands out a random 64-bit session token. Tokens live in a fixed table of
+   SESSION_SLOTS entries (open addressing over SESSION_PROBES slots) and expire after
+   RB_SESSION_IDLE_S seconds without use; when every slot in a token's probe run is
+   live, the least recently used one is evicted.
+*/
+#define USERS_FILE "users.dat"
+#define USERS_MAGIC "RBUSERS1"
+#define MAX_USER_NAME 32
+#define USER_RECORD_SIZE (8 + MAX_USER_NAME)
+#define SESSION_SLOTS 4096
+#define SESSION_PROBES 8
+
+typedef struct Account {
+    char name[MAX_USER_NAME];
+} Account;
+
+typedef struct Session {
+    unsigned long long token;       /* 0 = empty */
+    int user_id;
+    long long last_used_ms;
+} Session;
+
+int session_idle_s = 1800;
+
+unsigned int account_hash(const char *name) {
+    char key[MAX_NAME];
+    size_t n = normalize_key(name, key);
+    return code_hash(key, n, 0);
+}
+
+/* Id of the account with this name (compared like passenger names), or 0 */
+int find_account(const char *name) {
+    if (!store->account_slot_cap) return 0;
+    for (unsigned int j = account_hash(name) & (store->account_slot_cap - 1); store->account_slots[j];
+         j = (j + 1) & (store->account_slot_cap - 1))
+        if (equalstr_nospaces_case(store->accounts[store->account_slots[j] - 1].name, name)) return store->account_slots[j];
+    return 0;
+}
+
+void account_slot_put(int id) {
+    unsigned int j = account_hash(store->accounts[id - 1].name) & (store->account_slot_cap - 1);
+    while (store->account_slots[j]) j = (j + 1) & (store->account_slot_cap - 1);
+    store->account_slots[j] = id;
+}
+
+/* Add an account in memory. Returns its id. */
+int add_account(const char *name) {
+    if (store->num_accounts == store->accounts_cap) {
+        int cap = store->accounts_cap ? store->accounts_cap * 2 : 64;
+        store->accounts = (Account*)rb_realloc(MEM_ACCOUNTS, store->accounts, sizeof(Account) * store->accounts_cap, sizeof(Account) * cap);
+        store->accounts_cap = cap;
+    }
+    snprintf(store->accounts[store->num_accounts].name, MAX_USER_NAME, "%s", name);
+    int id = ++store->num_accounts;
+    if ((unsigned int)store->num_accounts * 2 > store->account_slot_cap) {
+        rb_free(MEM_ACCOUNTS, store->account_slots, sizeof(int) * store->account_slot_cap);
+        store->account_slot_cap = store->account_slot_cap ? store->account_slot_cap * 2 : 128;
+        store->account_slots = (int*)rb_calloc(MEM_ACCOUNTS, store->account_slot_cap, sizeof(int));
+        for (int i = 1; i <= store->num_accounts; ++i) account_slot_put(i);
+    } else {
+        account_slot_put(id);
+    }
+    return id;
+}
+
+void reset_accounts() {
+    rb_free(MEM_ACCOUNTS, store->accounts, sizeof(Account) * store->accounts_cap);
+    rb_free(MEM_ACCOUNTS, store->account_slots, sizeof(int) * store->account_slot_cap);
+    store->accounts = NULL;
+    store->account_slots = NULL;
+    store->num_accounts = store->accounts_cap = 0;
+    store->account_slot_cap = 0;
+}
+
+void encode_user_record(int id, const char *name, unsigned char *rec) {
+    memset(rec, 0, USER_RECORD_SIZE);
+    le32_put(rec, (unsigned int)id);
+    memcpy(rec + 4, name, strnlen(name, MAX_USER_NAME - 1));
+    le32_put(rec + 4 + MAX_USER_NAME, checksum32(rec, 4 + MAX_USER_NAME));
+}
+
+/* Read users.dat into the account table (replacing what was there) */
+void load_accounts() {
+    reset_accounts();
+    char path[MAX_STORE_PATH];
+    store_path(USERS_FILE, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) return;
+    unsigned char rec[USER_RECORD_SIZE];
+    if (fread(rec, 8, 1, f) != 1 || memcmp(rec, USERS_MAGIC, 8) != 0) {
+        printf("Warning: %s is not an account file, ignored.\n", path);
+        fclose(f);
+        return;
+    }
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        if (le32_get(rec + 4 + MAX_USER_NAME) != checksum32(rec, 4 + MAX_USER_NAME) ||
+            (int)le32_get(rec) != store->num_accounts + 1 || rec[4 + MAX_USER_NAME - 1] != 0) {
+            printf("Warning: %s is damaged after %d accounts.\n", path, store->num_accounts);
+            break;
+        }
+        add_account((const char*)rec + 4);
+    }
+    fclose(f);
+}
+
+/* Rewrite users.dat from the account table. Returns 0 on success. */
+int save_accounts() {
+    char path[MAX_STORE_PATH], tmp[MAX_STORE_PATH];
+    store_path(USERS_FILE, path, sizeof(path));
+    store_path(USERS_FILE ".tmp", tmp, sizeof(tmp));
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    int ok = fwrite(USERS_MAGIC, 8, 1, f) == 1;
+    for (int i = 0; i < store->num_accounts && ok; ++i) {
+        unsigned char rec[USER_RECORD_SIZE];
+        encode_user_record(i + 1, store->accounts[i].name, rec);
+        ok = fwrite(rec, sizeof(rec), 1, f) == 1;
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Create an account and append it to users.dat. Returns its id, or 0 if the name is
+   unusable, taken, or the file cannot be written. Caller holds store->lock. */
+int create_account(const char *name) {
+    char key[MAX_NAME];
+    size_t len = strlen(name);
+    if (len == 0 || len >= MAX_USER_NAME || normalize_key(name, key) == 0 || find_account(name)) return 0;
+    if (persist_enabled) {
+        char path[MAX_STORE_PATH];
+        store_path(USERS_FILE, path, sizeof(path));
+        long long size = file_size(path);
+        if (size > 0 && size != 8 + (long long)store->num_accounts * USER_RECORD_SIZE) {
+            if (save_accounts() != 0) return 0;     // drop a damaged tail before appending
+            size = file_size(path);
+        }
+        FILE *f = fopen(path, "ab");
+        if (!f) return 0;
+        unsigned char rec[USER_RECORD_SIZE];
+        encode_user_record(store->num_accounts + 1, name, rec);
+        int ok = (size > 0 || fwrite(USERS_MAGIC, 8, 1, f) == 1) && fwrite(rec, sizeof(rec), 1, f) == 1;
+        if (fclose(f) != 0) ok = 0;
+        if (!ok) return 0;
+    }
+    return add_account(name);
+}
+
+unsigned long long random_token() {
+    unsigned long long t = 0;
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (f) {
+        if (fread(&t, sizeof(t), 1, f) != 1) t = 0;
+        fclose(f);
+    }
+    if (!t) {
+        // no urandom: splitmix64 of the clock and a counter
+        static _Atomic unsigned long long counter;
+        t = wall_ns() + atomic_fetch_add(&counter, 1) * 0x9e3779b97f4a7c15ull;
+        t = (t ^ (t >> 30)) * 0xbf58476d1ce4e5b9ull;
+        t = (t ^ (t >> 27)) * 0x94d049bb133111ebull;
+        t ^= t >> 31;
+    }
+    return t ? t : 1;
+}
+
+int session_live(const Session *s, long long now) {
+    return s->token && now - s->last_used_ms < (long long)session_idle_s * 1000;
+}
+
+/* Start a session for user_id. Returns its token. */
+unsigned long long start_session(int user_id) {
+    unsigned long long token = random_token();
+    long long now = now_ms();
+    pthread_mutex_lock(&store->session_lock);
+    unsigned int j = (unsigned int)(token ^ (token >> 32)) & (SESSION_SLOTS - 1), victim = j;
+    for (int p = 0; p < SESSION_PROBES; ++p, j = (j + 1) & (SESSION_SLOTS - 1)) {
+        if (!session_live(&store->sessions[j], now)) { victim = j; break; }
+        if (store->sessions[j].last_used_ms < store->sessions[victim].last_used_ms) victim = j;
+    }
+    store->sessions[victim].token = token;
+    store->sessions[victim].user_id = user_id;
+    store->sessions[victim].last_used_ms = now;
+    pthread_mutex_unlock(&store->session_lock);
+    return token;
+}
+
+Session *find_session_locked(unsigned long long token, long long now) {
+    if (!token) return NULL;
+    unsigned int j = (unsigned int)(token ^ (token >> 32)) & (SESSION_SLOTS - 1);
+    for (int p = 0; p < SESSION_PROBES; ++p, j = (j + 1) & (SESSION_SLOTS - 1))
+        if (store->sessions[j].token == token) return session_live(&store->sessions[j], now) ? &store->sessions[j] : NULL;
+    return NULL;
+}
+
+/* Account behind a session token, or 0 if it is unknown or expired */
+int session_user(unsigned long long token) {
+    long long now = now_ms();
+    pthread_mutex_lock(&store->session_lock);
+    Session *s = find_session_locked(token, now);
+    int user = s ? s->user_id : 0;
+    if (s) s->last_used_ms = now;
+    pthread_mutex_unlock(&store->session_lock);
+    return user;
+}
+
+void end_session(unsigned long long token) {
+    pthread_mutex_lock(&store->session_lock);
+    Session *s = find_session_locked(token, now_ms());
+    if (s) s->token = 0;
+    pthread_mutex_unlock(&store->session_lock);
+}
+
+/* ---------------- Velocity checks ----------------
+   Limits how often the same passenger can book the same train, whatever age or class
+   they type: at most RB_VELOCITY_NAME bookings per normalized name and train, and
+   RB_VELOCITY_USER per account and train, within RB_VELOCITY_WINDOW_S seconds
+   (0 turns a rule off). Attempts count once they pass the seat and duplicate checks,
+   whether or not payment goes through.
+   Each (rule, key, train) has a slot in a fixed table of VELOCITY_SLOTS: a ring of
+   VELOCITY_BUCKETS counters, each covering 1/VELOCITY_BUCKETS of the window, so a
+   count is the sum of the buckets still inside the window and old ones decay as the
+   ring turns. A key probes at most VELOCITY_PROBES slots and, if it is not there,
+   takes the one with the lowest count (empty and fully decayed slots count 0). Each
+   check is O(1) and memory stays fixed however many keys an attack throws at it.
+   Counters live in memory only and start empty after a restart.
+*/
+#define VELOCITY_SLOTS 65536
+#define VELOCITY_PROBES 8
+#define VELOCITY_BUCKETS 12
+
+typedef struct VelocitySlot {
+    unsigned long long key;                 /* 0 = empty */
+    unsigned int newest;                    /* bucket number counts[newest % VELOCITY_BUCKETS] holds */
+    unsigned short counts[VELOCITY_BUCKETS];
+} VelocitySlot;
+
+int velocity_name_limit = 4;
+int velocity_user_limit = 6;
+int velocity_window_s = 3600;
+
+unsigned int velocity_bucket(long long now_ms) {
+    long long width = (long long)velocity_window_s * 1000 / VELOCITY_BUCKETS;
+    return (unsigned int)(now_ms / (width > 0 ? width : 1));
+}
+
+/* Bookings counted for the slot within the window ending at bucket */
+int velocity_count(VelocitySlot *v, unsigned int bucket) {
+    if (!v->key || bucket - v->newest >= VELOCITY_BUCKETS) return 0;
+    int sum = 0;
+    for (unsigned int k = 0; k < VELOCITY_BUCKETS && k <= v->newest; ++k)
+        if (v->newest - k + VELOCITY_BUCKETS > bucket) sum += v->counts[(v->newest - k) % VELOCITY_BUCKETS];
+    return sum;
+}
+
+/* Slot for key, claimed (and reset) if the key is not in the table. The victim is
+   the probed slot with the lowest count, so keys close to a limit outlive a flood
+   of one-off keys. */
+VelocitySlot *velocity_slot(unsigned long long key, unsigned int bucket) {
+    if (!store->velocity_slots) store->velocity_slots = (VelocitySlot*)rb_calloc(MEM_VELOCITY, VELOCITY_SLOTS, sizeof(VelocitySlot));
+    unsigned int j = (unsigned int)(key ^ (key >> 32)) & (VELOCITY_SLOTS - 1);
+    VelocitySlot *victim = NULL;
+    int victim_count = 0;
+    for (int p = 0; p < VELOCITY_PROBES; ++p, j = (j + 1) & (VELOCITY_SLOTS - 1)) {
+        VelocitySlot *v = &store->velocity_slots[j];
+        if (v->key == key) return v;
+        int c = velocity_count(v, bucket);
+        if (!victim || c < victim_count || (c == victim_count && v->newest < victim->newest)) {
+            victim = v;
+            victim_count = c;
+        }
+    }
+    if (victim_count) store->velocity_evictions++;
+    memset(victim, 0, sizeof(*victim));
+    victim->key = key;
+    victim->newest = bucket;
+    return victim;
+}
+
+void velocity_add(VelocitySlot *v, unsigned int bucket) {
+    if (bucket != v->newest) {
+        unsigned int gap = bucket - v->newest;
+        for (unsigned int k = 1; k <= gap && k <= VELOCITY_BUCKETS; ++k)
+            v->counts[(v->newest + k) % VELOCITY_BUCKETS] = 0;
+        v->newest = bucket;
+    }
+    if (v->counts[bucket % VELOCITY_BUCKETS] < 0xFFFF) v->counts[bucket % VELOCITY_BUCKETS]++;
+}
+
+/* Key of one rule for a booking: rule tag, the name or account, and the train */
+unsigned long long velocity_key(int rule, const Booking *b) {
+    unsigned long long h = 1469598103934665603ull;
+    h = (h ^ (unsigned int)rule) * 1099511628211ull;
+    if (rule == 0) {
+        char name[MAX_NAME];
+        size_t n = normalize_key(b->passenger_name, name);
+        for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)name[i]) * 1099511628211ull;
+    } else {
+        h = (h ^ (unsigned int)b->owner_id) * 1099511628211ull;
+    }
+    h = (h ^ 0xFF) * 1099511628211ull;
+    h = (h ^ (unsigned int)b->train_id) * 1099511628211ull;
+    return h ? h : 1;
+}
+
+/* Count a booking attempt against every rule. Returns 0, counting nothing, if any
+   rule is already at its limit. Caller holds store->lock. */
+int velocity_admit(const Booking *b, long long now_ms) {
+    int limits[2] = { velocity_name_limit, b->owner_id > 0 ? velocity_user_limit : 0 };
+    VelocitySlot *slots[2] = { NULL, NULL };
+    unsigned int bucket = velocity_bucket(now_ms);
+    for (int r = 0; r < 2; ++r) {
+        if (limits[r] <= 0) continue;
+        slots[r] = velocity_slot(velocity_key(r, b), bucket);
+        if (velocity_count(slots[r], bucket) >= limits[r]) {
+            store->velocity_rejects++;
+            return 0;
+        }
+    }
+    for (int r = 0; r < 2; ++r) if (slots[r]) velocity_add(slots[r], bucket);
+    return 1;
+}
+
+/* ---------------- Heavy hitters ----------------
+   The passenger names, accounts and trains with the most booking attempts, and with
+   the most rejected ones (duplicates, velocity and quota refusals, full trains,
+   failed payments), kept live without storing the attempts. place_booking() counts
+   every outcome in a count-min sketch: HITTER_DEPTH rows of HITTER_WIDTH counters,
+   one shared by all six lists with the list in the key. An estimate is the smallest
+   of a key's row counters, so it never undercounts; it is over by at most
+   e * (keys counted) / HITTER_WIDTH except with probability e^-HITTER_DEPTH.
+   Each list keeps the HITTER_K keys with the highest estimates; a key is offered
+   to a list only when its estimate beats the list's floor (its lowest count), and
+   then takes its own slot or the lowest one. Counters are bumped with relaxed
+   atomics, and a slot is rewritten under a sequence count: a writer that finds the
+   slot busy drops that update (the next attempt for the key corrects it), readers
+   retry. Nothing on the booking path takes a lock or waits. Memory is fixed (about
+   1 MB). Counts live in memory only, per operator.
+*/
+#define HITTER_DEPTH 4
+#define HITTER_WIDTH 65536          /* power of two */
+#define HITTER_K 32
+
+enum {
+    HIT_NAME_ATTEMPTS, HIT_NAME_REJECTS,
+    HIT_USER_ATTEMPTS, HIT_USER_REJECTS,
+    HIT_TRAIN_ATTEMPTS, HIT_TRAIN_REJECTS,
+    NUM_HITTER_LISTS
+};
+const char *hitter_list_names[NUM_HITTER_LISTS] = {
+    "names by attempts", "names by rejects", "accounts by attempts", "accounts by rejects",
+    "trains by attempts", "trains by rejects"
+};
+
+typedef struct {
+    _Atomic unsigned int seq;           /* odd while the slot is being rewritten */
+    _Atomic unsigned int count;
+    _Atomic unsigned long long key;     /* 0 = empty */
+    int id;                             /* account or train id */
+    char label[MAX_NAME];               /* passenger name as first typed */
+} HitterSlot;
+
+typedef struct Hitters {
+    _Atomic unsigned int cells[HITTER_DEPTH][HITTER_WIDTH];
+    _Atomic unsigned int floor[NUM_HITTER_LISTS];
+    _Atomic long long attempts, rejects, added;
+    HitterSlot top[NUM_HITTER_LISTS][HITTER_K];
+} Hitters;
+
+typedef struct {
+    unsigned int count;
+    int id;
+    char label[MAX_NAME];
+} HitterRow;
+
+/* The store's table, allocated by whichever thread gets there first */
+Hitters *hitters_table() {
+    Hitters *h = atomic_load_explicit(&store->hitters, memory_order_acquire);
+    if (h) return h;
+    Hitters *fresh = (Hitters*)rb_calloc(MEM_HITTERS, 1, sizeof(Hitters));
+    if (atomic_compare_exchange_strong(&store->hitters, &h, fresh)) return fresh;
+    rb_free(MEM_HITTERS, fresh, sizeof(Hitters));
+    return h;
+}
+
+/* Forget all of the store's counts. Updates racing with this land in the cleared
+   table. */
+void reset_hitters() {
+    Hitters *h = atomic_load_explicit(&store->hitters, memory_order_acquire);
+    if (h) memset((void*)h, 0, sizeof(*h));
+}
+
+/* Add one to key's counters and return its estimate */
+unsigned int hitter_sketch_add(Hitters *h, unsigned long long key) {
+    static const unsigned long long mult[HITTER_DEPTH] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull
+    };
+    unsigned int est = ~0u;
+    for (int r = 0; r < HITTER_DEPTH; ++r) {
+        unsigned int j = (unsigned int)((key * mult[r]) >> 48) & (HITTER_WIDTH - 1);
+        unsigned int c = atomic_fetch_add_explicit(&h->cells[r][j], 1, memory_order_relaxed) + 1;
+        if (c < est) est = c;
+    }
+    return est;
+}
+
+/* Put key with estimate est in a list if it beats the slot it would take */
+void hitter_offer(Hitters *h, int list, unsigned long long key, unsigned int est, int id, const char *label) {
+    HitterSlot *top = h->top[list], *slot = NULL;
+    unsigned int low = 0;
+    for (int i = 0; i < HITTER_K; ++i) {
+        if (atomic_load_explicit(&top[i].key, memory_order_relaxed) == key) {
+            slot = &top[i];
+            break;
+        }
+        unsigned int c = atomic_load_explicit(&top[i].count, memory_order_relaxed);
+        if (!slot || c < low) {
+            slot = &top[i];
+            low = c;
+        }
+    }
+    if (atomic_load_explicit(&slot->key, memory_order_relaxed) == key) {
+        // already listed: raise its count, no need to touch the label
+        unsigned int c = atomic_load_explicit(&slot->count, memory_order_relaxed);
+        while (est > c && !atomic_compare_exchange_weak_explicit(&slot->count, &c, est, memory_order_relaxed,
+                                                                 memory_order_relaxed)) {}
+        if (c > atomic_load_explicit(&h->floor[list], memory_order_relaxed)) return;   // it was not the lowest
+    } else {
+        if (est <= low) return;
+        unsigned int s = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        if ((s & 1) || !atomic_compare_exchange_strong_explicit(&slot->seq, &s, s + 1, memory_order_acquire,
+                                                                memory_order_relaxed))
+            return;             // someone else is rewriting it
+        atomic_store_explicit(&slot->key, key, memory_order_relaxed);
+        slot->id = id;
+        snprintf(slot->label, sizeof(slot->label), "%s", label ? label : "");
+        atomic_store_explicit(&slot->count, est, memory_order_relaxed);
+        atomic_store_explicit(&slot->seq, s + 2, memory_order_release);
+    }
+    unsigned int floor = ~0u;
+    for (int i = 0; i < HITTER_K; ++i) {
+        unsigned int c = atomic_load_explicit(&top[i].count, memory_order_relaxed);
+        if (c < floor) floor = c;
+    }
+    atomic_store_explicit(&h->floor[list], floor, memory_order_relaxed);
+}
+
+unsigned long long hitter_key(int list, unsigned long long base) {
+    unsigned long long k = (base ^ ((unsigned long long)list << 56)) * 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    return k ? k : 1;
+}
+
+/* Count one booking attempt in every list it belongs to */
+void hitters_count(const Booking *b, int rejected) {
+    Hitters *h = hitters_table();
+    atomic_fetch_add_explicit(&h->attempts, 1, memory_order_relaxed);
+    if (rejected) atomic_fetch_add_explicit(&h->rejects, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->added, (2 + (b->owner_id > 0)) * (1 + rejected), memory_order_relaxed);
+    char name[MAX_NAME];
+    size_t n = normalize_key(b->passenger_name, name);
+    unsigned long long base[3] = { 1469598103934665603ull, (unsigned int)b->owner_id, (unsigned int)b->train_id };
+    for (size_t i = 0; i < n; ++i) base[0] = (base[0] ^ (unsigned char)name[i]) * 1099511628211ull;
+    for (int kind = 0; kind < 3; ++kind) {
+        if (kind == 1 && b->owner_id <= 0) continue;
+        for (int m = 0; m <= rejected; ++m) {
+            int list = kind * 2 + m;
+            unsigned long long key = hitter_key(list, base[kind]);
+            unsigned int est = hitter_sketch_add(h, key);
+            if (est > atomic_load_explicit(&h->floor[list], memory_order_relaxed))
+                hitter_offer(h, list, key, est, kind == 1 ? b->owner_id : b->train_id,
+                             kind == 0 ? b->passenger_name : NULL);
+        }
+    }
+}
+
+int cmp_hitter_rows(const void *a, const void *b) {
+    unsigned int x = ((const HitterRow*)a)->count, y = ((const HitterRow*)b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Consistent copy of a list, highest count first; returns the number of rows */
+int hitter_rows(int list, HitterRow *out) {
+    Hitters *h = atomic_load_explicit(&store->hitters, memory_order_acquire);
+    int n = 0;
+    if (!h) return 0;
+    for (int i = 0; i < HITTER_K; ++i) {
+        HitterSlot *slot = &h->top[list][i];
+        for (int tries = 0; tries < 100; ++tries) {
+            unsigned int s = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if (s & 1) continue;
+            HitterRow row;
+            row.count = atomic_load_explicit(&slot->count, memory_order_relaxed);
+            row.id = slot->id;
+            memcpy(row.label, slot->label, sizeof(row.label));
+            row.label[sizeof(row.label) - 1] = 0;
+            int empty = !atomic_load_explicit(&slot->key, memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != s) continue;
+            if (!empty && row.count) out[n++] = row;
+            break;
+        }
+    }
+    qsort(out, n, sizeof(HitterRow), cmp_hitter_rows);
+    return n;
+}
+
+/* The top `show` of every list. Account and train names are looked up here, so the
+   caller must not hold store->lock. */
+void print_hitters(int show) {
+    Hitters *h = atomic_load_explicit(&store->hitters, memory_order_acquire);
+    long long attempts = h ? atomic_load(&h->attempts) : 0, rejects = h ? atomic_load(&h->rejects) : 0;
+    long long added = h ? atomic_load(&h->added) : 0;
+    printf("Heavy hitters: %lld booking attempts, %lld rejected (estimates, within %lld of the true count)\n",
+           attempts, rejects, (long long)(2.72 * added / HITTER_WIDTH));
+    for (int list = 0; list < NUM_HITTER_LISTS; ++list) {
+        HitterRow rows[HITTER_K];
+        int n = hitter_rows(list, rows);
+        if (!n) continue;
+        printf("  %s:\n", hitter_list_names[list]);
+        for (int i = 0; i < n && i < show; ++i) {
+            char label[MAX_NAME + 32];
+            if (list <= HIT_NAME_REJECTS) {
+                snprintf(label, sizeof(label), "%s", rows[i].label);
+            } else if (list <= HIT_USER_REJECTS) {
+                pthread_mutex_lock(&store->lock);
+                if (rows[i].id <= store->num_accounts) snprintf(label, sizeof(label), "%s", store->accounts[rows[i].id - 1].name);
+                else snprintf(label, sizeof(label), "account %d", rows[i].id);
+                pthread_mutex_unlock(&store->lock);
+            } else {
+                const char *name = "(not in catalog)";
+                for (int t = 0; t < MAX_TRAINS; ++t) if (store->trains[t].id == rows[i].id) name = store->trains[t].name;
+                snprintf(label, sizeof(label), "%d %s", rows[i].id, name);
+            }
+            printf("    %8u  %s\n", rows[i].count, label);
+        }
+    }
+}
+
+/* ---------------- Tenants ----------------
+   A process hosts any number of operators (up to MAX_TENANTS) side by side, each in
+   its own Store. Each tenant is a directory tenants/<name>/ under the starting
+   directory holding that operator's store (bookings.dat, journals, archive, lease)
+   and optionally:
+     trains.txt   its catalog, one train per line: id|name|from|to|seats|fare
+                  (exactly MAX_TRAINS trains, the size of the index file's seat table)
+     tenant.conf  quotas, one key=value per line:
+                    quota_mb=N      bookings and their indexes may use N MiB
+                    ops_per_sec=N   bookings admitted per second, bursts of up to N
+                    workers=N       at most N of the shared `serve` workers at once
+                    queue=N         requests waiting for a worker before new ones are
+                                    answered "busy" (default 1024)
+   The default store (name "") lives in the starting directory itself. Threads, the
+   payment gateway, the event log and tracing are shared; everything else (catalog,
+   bookings, indexes, journals, store lock, holds, sessions, caches and quota
+   buckets) belongs to one store, so one operator's flash sale neither locks nor
+   charges another's. Quotas are checked as a booking is admitted.
+*/
+#define TENANTS_DIR "tenants"
+#define TENANT_CONF "tenant.conf"
+#define CATALOG_FILE "trains.txt"
+#define SERVE_QUEUE 1024
+
+/* Tenant names become directory names: letters, digits, '-' and '_' only */
+int valid_tenant_name(const char *name) {
+    size_t n = strlen(name);
+    if (n == 0 || n >= MAX_TENANT_NAME) return 0;
+    for (size_t i = 0; i < n; ++i)
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_') return 0;
+    return 1;
+}
+
+/* Replace the store's trains[] with the catalog in path. Returns 0 on success; on
+   any error trains[] is left alone. */
+int load_catalog(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    Train t[MAX_TRAINS];
+    char line[256];
+    int n = 0, lineno = 0, bad = 0;
+    while (fgets(line, sizeof(line), f) && !bad) {
+        lineno++;
+        chomp(line);
+        if (line[0] == 0 || line[0] == '#') continue;
+        if (n == MAX_TRAINS) { bad = lineno; break; }
+        Train *tr = &t[n];
+        memset(tr, 0, sizeof(*tr));
+        char *fields[6], *p = line;
+        int nf = 0;
+        while (nf < 6) {
+            fields[nf++] = p;
+            p = strchr(p, '|');
+            if (!p) break;
+            *p++ = 0;
+        }
+        if (nf != 6 || p) { bad = lineno; break; }
+        tr->id = atoi(fields[0]);
+        snprintf(tr->name, sizeof(tr->name), "%s", fields[1]);
+        snprintf(tr->from, sizeof(tr->from), "%s", fields[2]);
+        snprintf(tr->to, sizeof(tr->to), "%s", fields[3]);
+        tr->total_seats = atoi(fields[4]);
+        tr->fare = atoi(fields[5]);
+        if (tr->id <= 0 || tr->total_seats < 0 || tr->fare < 0 || !tr->name[0] || !tr->from[0] || !tr->to[0]) bad = lineno;
+        for (int i = 0; i < n && !bad; ++i) if (t[i].id == tr->id) bad = lineno;
+        n++;
+    }
+    fclose(f);
+    if (bad || n != MAX_TRAINS) {
+        if (bad) printf("Error: %s line %d: expected id|name|from|to|seats|fare.\n", path, bad);
+        else printf("Error: %s lists %d trains; it must list %d.\n", path, n, MAX_TRAINS);
+        return -2;
+    }
+    memcpy(store->trains, t, sizeof(t));
+    return 0;
+}
+
+/* Quotas from the store's tenant.conf (none if it is missing) */
+void load_tenant_conf() {
+    store->quota_bytes = 0;
+    store->ops_per_sec = 0;
+    store->max_workers = 0;
+    store->queue_cap = SERVE_QUEUE;
+    char path[MAX_STORE_PATH];
+    store_path(TENANT_CONF, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        chomp(line);
+        char *eq = strchr(line, '=');
+        if (line[0] == '#' || !eq) continue;
+        *eq = 0;
+        if (strcmp(line, "quota_mb") == 0) store->quota_bytes = atoll(eq + 1) * 1024 * 1024;
+        else if (strcmp(line, "ops_per_sec") == 0) store->ops_per_sec = atoi(eq + 1);
+        else if (strcmp(line, "workers") == 0) store->max_workers = atoi(eq + 1);
+        else if (strcmp(line, "queue") == 0 && atoi(eq + 1) > 0) store->queue_cap = atoi(eq + 1);
+        else printf("Warning: unknown %s key '%s' ignored.\n", TENANT_CONF, line);
+    }
+    fclose(f);
+    store->tokens = store->ops_per_sec;
+    store->refill_ns = mono_ns();
+}
+
+/* Bytes the store holds in memory, counted against quota_mb */
+long long tenant_bytes() {
+    return atomic_load(&store->mem_bytes);
+}
+
+/* Take one booking from the store's admission bucket. Call with store->lock held. */
+int tenant_take_token() {
+    if (store->ops_per_sec <= 0) return 1;
+    long long now = mono_ns();
+    store->tokens += (double)(now - store->refill_ns) * store->ops_per_sec / 1e9;
+    if (store->tokens > store->ops_per_sec) store->tokens = store->ops_per_sec;
+    store->refill_ns = now;
+    if (store->tokens < 1) return 0;
+    store->tokens -= 1;
+    return 1;
+}
+
+/* ---------------- Payment ----------------
+   Booking is a three step flow:
+     1. hold    - under store->lock: check seats and duplicates, reserve a hold slot
+     2. pay     - no lock held: charge the fare through the configured gateway
+     3. confirm - under store->lock: turn the hold into a booking (or release it)
+   Holds that are not confirmed within RB_HOLD_TIMEOUT_S seconds stop counting
+   against availability and are released by the next caller that sees them.
+*/
+enum { PAY_OK = 0, PAY_DECLINED = 1, PAY_ERROR = 2 };
+
+typedef struct PaymentGateway {
+    const char *name;
+    void *ctx;
+    /* Charge amount (rupees) for the booking and write the gateway reference to ref.
+       Returns PAY_OK, PAY_DECLINED or PAY_ERROR. May block. */
+    int (*charge)(void *ctx, const Booking *bk, int amount, char *ref, size_t reflen);
+    /* Return money for a charge whose hold expired before it could be confirmed */
+    void (*refund)(void *ctx, const char *ref, int amount);
+} PaymentGateway;
+
+/* Local simulator: fixed latency and a percentage of declined payments */
+typedef struct {
+    int latency_ms;
+    int failure_pct;
+    pthread_mutex_t lock;   /* guards seq only, never held while sleeping */
+    unsigned int seq;
+} SimGateway;
+
+int sim_charge(void *ctx, const Booking *bk, int amount, char *ref, size_t reflen) {
+    SimGateway *g = (SimGateway*)ctx;
+    pthread_mutex_lock(&g->lock);
+    unsigned int seq = ++g->seq;
+    pthread_mutex_unlock(&g->lock);
+
+    sleep_ms(g->latency_ms);
+
+    // deterministic pseudo-random outcome per request
+    unsigned int h = seq * 2654435761u ^ (unsigned int)amount ^ (unsigned int)bk->train_id;
+    h ^= h >> 15; h *= 2246822519u; h ^= h >> 13;
+    if ((int)(h % 100) < g->failure_pct) return PAY_DECLINED;
+    snprintf(ref, reflen, "SIM%08u", seq);
+    return PAY_OK;
+}
+
+void sim_refund(void *ctx, const char *ref, int amount) {
+    SimGateway *g = (SimGateway*)ctx;
+    sleep_ms(g->latency_ms);
+    (void)ref; (void)amount;
+}
+
+SimGateway sim_gateway = { 0, 0, PTHREAD_MUTEX_INITIALIZER, 0 };
+PaymentGateway default_gateway = { "simulator", &sim_gateway, sim_charge, sim_refund };
+PaymentGateway *gateway = &default_gateway;
+
+#define MAX_HOLDS 256
+
+typedef struct Hold {
+    int in_use;
+    unsigned long token;    /* distinguishes a reused slot from the original hold */
+    long long expires_ms;
+    unsigned long long trip;    /* trip_key(&b) */
+    Booking b;
+} Hold;
+
+int hold_timeout_ms = 600 * 1000;
+
+/* Simulator settings come from RB_PAY_LATENCY_MS and RB_PAY_FAIL_PCT */
+void init_payment() {
+    sim_gateway.latency_ms = env_int("RB_PAY_LATENCY_MS", 0);
+    sim_gateway.failure_pct = env_int("RB_PAY_FAIL_PCT", 0);
+    hold_timeout_ms = env_int("RB_HOLD_TIMEOUT_S", 600) * 1000;
+}
+
+/* Release expired holds. Caller holds store->lock. */
+void reap_expired_holds(long long now) {
+    for (int i = 0; i < MAX_HOLDS; ++i)
+        if (store->holds[i].in_use && store->holds[i].expires_ms <= now) store->holds[i].in_use = 0;
+}
+
+/* Live holds for a train. Caller holds store->lock. */
+int count_holds_for_train(int train_id) {
+    int cnt = 0;
+    long long now = now_ms();
+    for (int i = 0; i < MAX_HOLDS; ++i)
+        if (store->holds[i].in_use && store->holds[i].expires_ms > now && store->holds[i].b.train_id == train_id) cnt++;
+    return cnt;
+}
+
+/* Same rule as is_duplicate_booking(), applied to seats that are mid-payment */
+int is_duplicate_hold(const Booking *bk) {
+    for (int i = 0; i < MAX_HOLDS; ++i) {
+        if (store->holds[i].in_use &&
+            store->holds[i].b.age == bk->age &&
+            store->holds[i].b.train_id == bk->train_id &&
+            equalstr_nospaces_case(store->holds[i].b.passenger_name, bk->passenger_name) &&
+            same_class(store->holds[i].b.travel_class, bk->travel_class))
+            return 1;
+    }
+    return 0;
+}
+
+/* Same-day rule against booked journeys and seats mid-payment. The trip set is
+   filled while loading, so this waits for a background load to finish. */
+int is_same_day_trip(const Booking *bk, unsigned long long trip) {
+    for (int i = 0; i < MAX_HOLDS; ++i)
+        if (store->holds[i].in_use && store->holds[i].trip == trip) return 1;
+    DupSlot *d = trip_find(trip);
+    if (!d || d->count == 0) return 0;
+    // the key is a hash: confirm against the bookings themselves
+    await_load_locked();
+    for (Node *cur = store->head; cur; cur = cur->next)
+        if (cur->b.age == bk->age && cur->b.journey_date == bk->journey_date &&
+            equalstr_nospaces_case(cur->b.passenger_name, bk->passenger_name) && trip_key(&cur->b) == trip)
+            return 1;
+    return 0;
+}
+
+enum {
+    BOOK_OK = 0,
+    BOOK_NO_TRAIN,
+    BOOK_NO_SEATS,
+    BOOK_DUPLICATE,
+    BOOK_BUSY,
+    BOOK_PAYMENT_FAILED,
+    BOOK_HOLD_EXPIRED,
+    BOOK_QUOTA,             /* the tenant's rate or memory quota is used up */
+    BOOK_VELOCITY,          /* too many recent bookings for this passenger and train */
+    BOOK_SAME_DAY,          /* the passenger already has a journey that day (RB_DUP_SAME_DAY) */
+    BOOK_FARE_CHANGED       /* the fare is no longer the one quoted; *fare holds the new one */
+};
+
+const Train *find_train(int train_id) {
+    for (int i = 0; i < MAX_TRAINS; ++i)
+        if (store->trains[i].id == train_id) return &store->trains[i];
+    return NULL;
+}
+
+/* Hold a seat, take payment, confirm. On BOOK_OK bk->booking_id is set.
+   quote (may be NULL) holds the fare quoted to the customer, or 0 to take the current
+   one; it receives the fare charged, or the new fare with BOOK_FARE_CHANGED.
+   payref (may be NULL) receives the gateway reference. */
+int place_booking_steps(Booking *bk, int *quote, char *payref, size_t payref_len) {
+    // spans left open by an early return are closed when the traced request ends
+    int span = trace_begin("validate");
+    const Train *t = find_train(bk->train_id);
+    if (!t) return BOOK_NO_TRAIN;
+
+    // 1. hold
+    pthread_mutex_lock(&store->lock);
+    if ((store->quota_bytes && tenant_bytes() >= store->quota_bytes) || !tenant_take_token()) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_QUOTA;
+    }
+    long long now = now_ms();
+    reap_expired_holds(now);
+    if (count_bookings_for_train(t->id) + count_holds_for_train(t->id) >= t->total_seats) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_NO_SEATS;
+    }
+    trace_end(span);
+    span = trace_begin("duplicate_check");
+    if (is_duplicate_booking(bk) || is_duplicate_hold(bk)) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_DUPLICATE;
+    }
+    unsigned long long trip = trip_key(bk);
+    if (trip && is_same_day_trip(bk, trip)) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_SAME_DAY;
+    }
+    trace_end(span);
+    span = trace_begin("hold");
+    int slot = -1;
+    for (int i = 0; i < MAX_HOLDS; ++i) if (!store->holds[i].in_use) { slot = i; break; }
+    if (slot < 0) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_BUSY;
+    }
+    int fare = current_fare(t);
+    if (quote && *quote && *quote != fare) {
+        *quote = fare;
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_FARE_CHANGED;
+    }
+    if (quote) *quote = fare;
+    if (!velocity_admit(bk, now)) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_VELOCITY;
+    }
+    Hold *h = &store->holds[slot];
+    h->in_use = 1;
+    h->token = store->next_hold_token++;
+    h->expires_ms = now + hold_timeout_ms;
+    h->trip = trip;
+    h->b = *bk;
+    bump_train_gen(bk->train_id);
+    unsigned long my_token = h->token;
+    long long my_expiry = h->expires_ms;
+    pthread_mutex_unlock(&store->lock);
+    trace_end(span);
+
+    // 2. pay (no lock held)
+    char ref[64] = "";
+    span = trace_begin("payment");
+    int pay = gateway->charge(gateway->ctx, bk, fare, ref, sizeof(ref));
+    trace_end(span);
+
+    // 3. confirm or release
+    span = trace_begin("confirm");
+    pthread_mutex_lock(&store->lock);
+    // the slot is still ours only if nobody reaped it in the meantime
+    int still_held = h->in_use && h->token == my_token && now_ms() < my_expiry;
+    if (still_held) {
+        h->in_use = 0;
+        bump_train_gen(bk->train_id);
+    }
+    if (pay != PAY_OK) {
+        pthread_mutex_unlock(&store->lock);
+        return BOOK_PAYMENT_FAILED;
+    }
+    if (!still_held) {
+        pthread_mutex_unlock(&store->lock);
+        gateway->refund(gateway->ctx, ref, fare);
+        return BOOK_HOLD_EXPIRED;
+    }
+    bk->booking_id = allocate_booking_id();
+    Node *n = (Node*)rb_malloc(MEM_BOOKINGS, sizeof(Node));
+    n->b = *bk;
+    n->next = store->head;
+    store->head = n;
+    index_insert(n);
+    occupancy_changed(train_slot(n->b.train_id), 1);
+    trace_end(span);
+    span = trace_begin("persist");
+    unsigned char entry[JOURNAL_ENTRY_SIZE];
+    int logged = persist_enabled && commit_locked(JOURNAL_BOOK, &n->b, entry);
+    pthread_mutex_unlock(&store->lock);
+    if (logged) journal_append(entry);
+    trace_end(span);
+
+    if (payref) snprintf(payref, payref_len, "%s", ref);
+    return BOOK_OK;
+}
+
+/* place_booking_steps(), counted in the heavy hitters, and an EV_BOOKING event with
+   the outcome */
+int place_booking(Booking *bk, int *fare, char *payref, size_t payref_len) {
+    char ref[64] = "";
+    int r = place_booking_steps(bk, fare, ref, sizeof(ref));
+    hitters_count(bk, r != BOOK_OK);
+    log_event(EV_BOOKING, r, r == BOOK_OK ? bk->booking_id : 0, bk->train_id, ref);
+    if (payref) snprintf(payref, payref_len, "%s", ref);
+    return r;
+}
+
+/* ---------------- Response cache ----------------
+   The train listing and per-train seat availability are built once and then served
+   from the cache until something they show changes. An entry records train_gen[] of
+   the trains it covers (all of them for the listing, one for an availability
+   lookup) and the earliest expiry among those trains' seat holds, since an expiring
+   hold frees a seat without anything else happening. A lookup that finds the same
+   generations before that time copies the stored answer instead of recounting and
+   reformatting. Entries are indexed by query: 0 is the listing, 1 + slot is the
+   availability of trains[slot]. Guarded by store->lock.
+*/
+#define LISTING_TEXT_SIZE (MAX_TRAINS * 256)   /* a row is at most about 200 bytes */
+
+typedef struct CachedResponse {
+    int valid;
+    unsigned int gens[MAX_TRAINS];
+    long long expires_ms;               /* rebuild from this time on (LLONG_MAX = never) */
+    int avail[MAX_TRAINS];
+    char text[LISTING_TEXT_SIZE];       /* listing rows; empty for availability entries */
+} CachedResponse;
+
+int seats_left_locked(int slot, long long now) {
+    int cnt = 0;
+    for (int i = 0; i < MAX_HOLDS; ++i)
+        if (store->holds[i].in_use && store->holds[i].expires_ms > now && store->holds[i].b.train_id == store->trains[slot].id) cnt++;
+    return store->trains[slot].total_seats - store->train_booked[slot] - cnt;
+}
+
+/* Build the answer to query q (see above) into e */
+void build_response(CachedResponse *e, int q, long long now) {
+    int first = q ? q - 1 : 0, last = q ? q : MAX_TRAINS;
+    e->expires_ms = LLONG_MAX;
+    for (int i = 0; i < MAX_HOLDS; ++i) {
+        if (!store->holds[i].in_use || store->holds[i].expires_ms <= now || store->holds[i].expires_ms >= e->expires_ms) continue;
+        int t = train_slot(store->holds[i].b.train_id);
+        if (t >= first && t < last) e->expires_ms = store->holds[i].expires_ms;
+    }
+    size_t off = 0;
+    e->text[0] = 0;
+    for (int t = first; t < last; ++t) {
+        e->gens[t] = store->train_gen[t];
+        e->avail[t] = seats_left_locked(t, now);
+        if (q) continue;
+        int n = snprintf(e->text + off, sizeof(e->text) - off, "%-4d %-18s %-10s -> %-10s %5d %6d\n",
+                         store->trains[t].id, store->trains[t].name, store->trains[t].from, store->trains[t].to, e->avail[t],
+                         current_fare(&store->trains[t]));
+        if (n < 0 || (size_t)n >= sizeof(e->text) - off) break;
+        off += (size_t)n;
+    }
+    e->valid = 1;
+}
+
+/* Answer to query q, from the cache when it is still current. Caller holds store->lock. */
+const CachedResponse *cached_response(int q) {
+    CachedResponse *e = &store->response_cache[q];
+    long long now = now_ms();
+    int fresh = e->valid && now < e->expires_ms;
+    int first = q ? q - 1 : 0, last = q ? q : MAX_TRAINS;
+    for (int t = first; t < last && fresh; ++t) fresh = e->gens[t] == store->train_gen[t];
+    if (fresh) {
+        store->response_hits++;
+        return e;
+    }
+    store->response_misses++;
+    build_response(e, q, now);
+    return e;
+}
+
+/* Free seats on a train right now (seats on hold count as taken). Caller holds store->lock. */
+int seats_left(int train_id) {
+    int t = train_slot(train_id);
+    return t >= 0 ? cached_response(1 + t)->avail[t] : 0;
+}
+
+/* ---------------- Archive ----------------
+   railway_booking archive <days>
+   Bookings whose journey date is more than <days> days in the past are moved out of
+   bookings.dat into an immutable segment file archive_NNNN.seg:
+     ArchiveHeader | ArchiveIndexEntry[count] sorted by id | packed records
+   Packed records keep only the used bytes of each string, which shrinks a booking
+   to roughly a quarter of its in-memory size. Segments are never rewritten; each
+   archive pass adds a new one. search_booking() falls back to them by id.
+   With RB_COMPRESS set (version 4) the packed records are cut into LZ blocks of
+   about ARCHIVE_BLOCK_BYTES, listed in a block table after the id index; index
+   offsets then refer to the uncompressed record stream.
+
+   Segment layout (little-endian):
+      0  char magic[8] "RBARCH1"  8  u32 version      12  u32 count
+     16  i32 min_id  20 i32 max_id  24 i32 oldest date  28 i32 newest date
+     32  u64 index_off           40  u64 data_off     48  u64 data_len
+     56  u32 block_count         60  reserved         64  u64 blocks_off
+   index entry (8 bytes):  i32 booking id, u32 offset in the record stream
+   block entry (16 bytes): u32 raw_start, u32 raw_len, u64 file offset of the block
+   Versions 1 (plain) and 2 (LZ) were the raw host structs; written on the usual
+   little-endian 64-bit hosts they have exactly this layout, so they are read with
+   the same decoder (version 1 headers stop at byte 56).
+*/
+#define ARCHIVE_MAGIC "RBARCH1"
+#define ARCHIVE_VERSION 3
+#define ARCHIVE_VERSION_LZ 4
+#define ARCHIVE_HEADER_SIZE 72
+#define ARCHIVE_V1_HEADER_SIZE 56
+#define ARCHIVE_INDEX_ENTRY_SIZE 8
+#define ARCHIVE_BLOCK_ENTRY_SIZE 16
+#define ARCHIVE_BLOCK_BYTES (64 * 1024)
+#define MAX_PACKED (16 + MAX_NAME + 10 + MAX_CLASS)
+
+typedef struct {
+    char magic[8];
+    int version;
+    int count;
+    int min_id, max_id;
+    int oldest_date, newest_date;
+    long long index_off;
+    long long data_off;
+    long long data_len;
+    /* compressed segments only */
+    int block_count;
+    long long blocks_off;       /* ArchiveBlockEntry[block_count] */
+} ArchiveHeader;
+
+typedef struct {
+    unsigned int raw_start;     /* offset of the block in the uncompressed record stream */
+    unsigned int raw_len;
+    long long file_off;         /* BlockHeader position in the segment */
+} ArchiveBlockEntry;
+
+typedef struct {
+    int booking_id;
+    unsigned int offset;        /* relative to data_off */
+} ArchiveIndexEntry;
+
+typedef struct ArchiveSegment {
+    char path[MAX_STORE_PATH];
+    ArchiveHeader h;
+    ArchiveIndexEntry *index;   /* loaded on first lookup */
+    ArchiveBlockEntry *blocks;  /* compressed segments, loaded with the index */
+} ArchiveSegment;
+
+void put_i32(unsigned char *p, int v) { le32_put(p, (unsigned int)v); }
+int get_i32(const unsigned char *p) { return (int)le32_get(p); }
+
+size_t put_str(unsigned char *p, const char *s, size_t cap) {
+    size_t n = strnlen(s, cap - 1);
+    memcpy(p, s, n);
+    p[n] = 0;
+    return n + 1;
+}
+
+/* Pack a booking into out (at least MAX_PACKED bytes). Returns the packed length. */
+size_t pack_booking(const Booking *b, unsigned char *out) {
+    size_t n = 0;
+    put_i32(out + n, b->booking_id); n += 4;
+    put_i32(out + n, b->age); n += 4;
+    put_i32(out + n, b->train_id); n += 4;
+    put_i32(out + n, b->journey_date); n += 4;
+    n += put_str(out + n, b->passenger_name, sizeof(b->passenger_name));
+    n += put_str(out + n, b->gender, sizeof(b->gender));
+    n += put_str(out + n, b->travel_class, sizeof(b->travel_class));
+    return n;
+}
+
+int get_str(const unsigned char *p, size_t avail, char *dst, size_t cap) {
+    const unsigned char *z = memchr(p, 0, avail);
+    if (!z || (size_t)(z - p) >= cap) return -1;
+    memcpy(dst, p, (size_t)(z - p) + 1);
+    return (int)(z - p) + 1;
+}
+
+/* Inverse of pack_booking(). Returns bytes consumed or -1 if the record is malformed. */
+int unpack_booking(const unsigned char *in, size_t avail, Booking *b) {
+    memset(b, 0, sizeof(*b));
+    if (avail < 16) return -1;
+    b->booking_id = get_i32(in);
+    b->age = get_i32(in + 4);
+    b->train_id = get_i32(in + 8);
+    b->journey_date = get_i32(in + 12);
+    size_t n = 16;
+    int k;
+    if ((k = get_str(in + n, avail - n, b->passenger_name, sizeof(b->passenger_name))) < 0) return -1;
+    n += (size_t)k;
+    if ((k = get_str(in + n, avail - n, b->gender, sizeof(b->gender))) < 0) return -1;
+    n += (size_t)k;
+    if ((k = get_str(in + n, avail - n, b->travel_class, sizeof(b->travel_class))) < 0) return -1;
+    n += (size_t)k;
+    return (int)n;
+}
+
+int archive_is_compressed(int version) {
+    return version == 2 || version == ARCHIVE_VERSION_LZ;
+}
+
+void put_archive_header(unsigned char *p, const ArchiveHeader *h) {
+    memset(p, 0, ARCHIVE_HEADER_SIZE);
+    memcpy(p, h->magic, 8);
+    le32_put(p + 8, (unsigned int)h->version);
+    le32_put(p + 12, (unsigned int)h->count);
+    put_i32(p + 16, h->min_id);
+    put_i32(p + 20, h->max_id);
+    put_i32(p + 24, h->oldest_date);
+    put_i32(p + 28, h->newest_date);
+    le64_put(p + 32, (unsigned long long)h->index_off);
+    le64_put(p + 40, (unsigned long long)h->data_off);
+    le64_put(p + 48, (unsigned long long)h->data_len);
+    le32_put(p + 56, (unsigned int)h->block_count);
+    le64_put(p + 64, (unsigned long long)h->blocks_off);
+}
+
+/* Decode the first n bytes of a segment. Returns 0 if they hold a header this build reads. */
+int get_archive_header(const unsigned char *p, size_t n, ArchiveHeader *h) {
+    memset(h, 0, sizeof(*h));
+    if (n < ARCHIVE_V1_HEADER_SIZE || memcmp(p, ARCHIVE_MAGIC, sizeof(h->magic)) != 0) return -1;
+    memcpy(h->magic, p, 8);
+    h->version = (int)le32_get(p + 8);
+    h->count = (int)le32_get(p + 12);
+    h->min_id = get_i32(p + 16);
+    h->max_id = get_i32(p + 20);
+    h->oldest_date = get_i32(p + 24);
+    h->newest_date = get_i32(p + 28);
+    h->index_off = (long long)le64_get(p + 32);
+    h->data_off = (long long)le64_get(p + 40);
+    h->data_len = (long long)le64_get(p + 48);
+    if (h->version < 1 || h->version > ARCHIVE_VERSION_LZ || h->count < 0) return -1;
+    if (archive_is_compressed(h->version)) {
+        if (n < ARCHIVE_HEADER_SIZE) return -1;
+        h->block_count = (int)le32_get(p + 56);
+        h->blocks_off = (long long)le64_get(p + 64);
+        if (h->block_count < 0) return -1;
+    }
+    return 0;
+}
+
+void archive_segment_path(int seq, char *buf, size_t n) {
+    snprintf(buf, n, "%sarchive_%04d.seg", store->dir, seq);
+}
+
+/* Read the header of every archive segment (archive_0001.seg, archive_0002.seg, ...) */
+void load_archive_catalog() {
+    for (int seq = 1; ; ++seq) {
+        char path[MAX_STORE_PATH];
+        archive_segment_path(seq, path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        if (!f) break;
+        unsigned char buf[ARCHIVE_HEADER_SIZE];
+        ArchiveHeader h;
+        int ok = get_archive_header(buf, fread(buf, 1, sizeof(buf), f), &h) == 0;
+        fclose(f);
+        if (!ok) {
+            printf("Warning: %s is not a valid archive segment, skipped.\n", path);
+            continue;
+        }
+        store->archive_segs = (ArchiveSegment*)rb_realloc(MEM_ARCHIVE, store->archive_segs, sizeof(ArchiveSegment) * store->num_archive_segs,
+                                                   sizeof(ArchiveSegment) * (store->num_archive_segs + 1));
+        ArchiveSegment *seg = &store->archive_segs[store->num_archive_segs++];
+        snprintf(seg->path, sizeof(seg->path), "%s", path);
+        seg->h = h;
+        seg->index = NULL;
+        seg->blocks = NULL;
+    }
+}
+
+void free_archive_catalog() {
+    for (int i = 0; i < store->num_archive_segs; ++i) {
+        ArchiveSegment *seg = &store->archive_segs[i];
+        if (seg->index) rb_free(MEM_ARCHIVE, seg->index, sizeof(ArchiveIndexEntry) * seg->h.count);
+        if (seg->blocks) rb_free(MEM_ARCHIVE, seg->blocks, sizeof(ArchiveBlockEntry) * seg->h.block_count);
+    }
+    rb_free(MEM_ARCHIVE, store->archive_segs, sizeof(ArchiveSegment) * store->num_archive_segs);
+    store->archive_segs = NULL;
+    store->num_archive_segs = 0;
+}
+
+int archive_max_id() {
+    int m = 0;
+    for (int i = 0; i < store->num_archive_segs; ++i)
+        if (store->archive_segs[i].h.max_id > m) m = store->archive_segs[i].h.max_id;
+    return m;
+}
+
+/* Load a segment's id index (and block table) on first use. Caller holds archive_lock. */
+int load_segment_index(ArchiveSegment *seg, FILE *f) {
+    if (seg->index) return 0;
+    int nb = archive_is_compressed(seg->h.version) ? seg->h.block_count : 0;
+    size_t ilen = (size_t)seg->h.count * ARCHIVE_INDEX_ENTRY_SIZE, blen = (size_t)nb * ARCHIVE_BLOCK_ENTRY_SIZE;
+    unsigned char *raw = (unsigned char*)malloc(ilen > blen ? ilen : blen ? blen : 1);
+    ArchiveIndexEntry *index = (ArchiveIndexEntry*)rb_malloc(MEM_ARCHIVE, sizeof(ArchiveIndexEntry) * seg->h.count);
+    ArchiveBlockEntry *blocks = NULL;
+    int ok = rb_fseek(f, seg->h.index_off, SEEK_SET) == 0 && fread(raw, 1, ilen, f) == ilen;
+    for (int i = 0; ok && i < seg->h.count; ++i) {
+        index[i].booking_id = get_i32(raw + ARCHIVE_INDEX_ENTRY_SIZE * i);
+        index[i].offset = le32_get(raw + ARCHIVE_INDEX_ENTRY_SIZE * i + 4);
+    }
+    if (ok && archive_is_compressed(seg->h.version)) {
+        blocks = (ArchiveBlockEntry*)rb_malloc(MEM_ARCHIVE, sizeof(ArchiveBlockEntry) * nb);
+        ok = rb_fseek(f, seg->h.blocks_off, SEEK_SET) == 0 && fread(raw, 1, blen, f) == blen;
+        for (int b = 0; ok && b < nb; ++b) {
+            const unsigned char *e = raw + ARCHIVE_BLOCK_ENTRY_SIZE * b;
+            blocks[b].raw_start = le32_get(e);
+            blocks[b].raw_len = le32_get(e + 4);
+            blocks[b].file_off = (long long)le64_get(e + 8);
+        }
+    }
+    free(raw);
+    if (!ok) {
+        rb_free(MEM_ARCHIVE, index, sizeof(ArchiveIndexEntry) * seg->h.count);
+        if (blocks) rb_free(MEM_ARCHIVE, blocks, sizeof(ArchiveBlockEntry) * seg->h.block_count);
+        return -1;
+    }
+    seg->index = index;
+    seg->blocks = blocks;
+    return 0;
+}
+
+/* Read the packed record at offset `off` of the segment's record stream */
+int read_segment_record(ArchiveSegment *seg, FILE *f, unsigned int off, Booking *out) {
+    if (!archive_is_compressed(seg->h.version)) {
+        unsigned char rec[MAX_PACKED];
+        long long pos = seg->h.data_off + off;
+        long long avail = seg->h.data_off + seg->h.data_len - pos;
+        if (avail > MAX_PACKED) avail = MAX_PACKED;
+        if (avail <= 0 || rb_fseek(f, pos, SEEK_SET) != 0) return 0;
+        size_t got = fread(rec, 1, (size_t)avail, f);
+        return unpack_booking(rec, got, out) > 0;
+    }
+    // find the block holding this offset
+    int lo = 0, hi = seg->h.block_count - 1, b = -1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (seg->blocks[mid].raw_start <= off) { b = mid; lo = mid + 1; }
+        else hi = mid - 1;
+    }
+    if (b < 0) return 0;
+    const ArchiveBlockEntry *be = &seg->blocks[b];
+    BlockHeader bh;
+    unsigned char hdr[BLOCK_HEADER_SIZE];
+    if (rb_fseek(f, be->file_off, SEEK_SET) != 0 || fread(hdr, sizeof(hdr), 1, f) != 1)
+        return 0;
+    get_block_header(hdr, &bh);
+    if (bh.raw_len != be->raw_len || bh.comp_len > bh.raw_len || off - be->raw_start >= bh.raw_len)
+        return 0;
+    unsigned char *payload = (unsigned char*)malloc(bh.comp_len + bh.raw_len);
+    unsigned char *raw = payload + bh.comp_len;
+    int found = fread(payload, 1, bh.comp_len, f) == bh.comp_len &&
+                read_block_payload(&bh, payload, raw) == 0 &&
+                unpack_booking(raw + (off - be->raw_start), bh.raw_len - (off - be->raw_start), out) > 0;
+    free(payload);
+    return found;
+}
+
+/* Look up an archived booking by id. Returns 1 and fills *out if found. */
+int archive_lookup(int id, Booking *out) {
+    int found = 0;
+    pthread_mutex_lock(&store->archive_lock);
+    for (int i = 0; i < store->num_archive_segs && !found; ++i) {
+        ArchiveSegment *seg = &store->archive_segs[i];
+        if (id < seg->h.min_id || id > seg->h.max_id) continue;
+        FILE *f = fopen(seg->path, "rb");
+        if (!f) continue;
+        if (load_segment_index(seg, f) != 0) {
+            fclose(f);
+            continue;
+        }
+        int lo = 0, hi = seg->h.count - 1;
+        while (lo <= hi) {
+            int mid = lo + (hi - lo) / 2;
+            int mid_id = seg->index[mid].booking_id;
+            if (mid_id == id) {
+                found = read_segment_record(seg, f, seg->index[mid].offset, out);
+                break;
+            }
+            if (mid_id < id) lo = mid + 1;
+            else hi = mid - 1;
+        }
+        fclose(f);
+    }
+    pthread_mutex_unlock(&store->archive_lock);
+    return found;
+}
+
+/* Load the hot store and the archive catalog; ids continue after the highest archived id */
+void load_store(int background) {
+    JournalEntry *je;
+    int damaged;
+    int nj = read_journals(journal_prefix, &je, &damaged);
+    mem_account(MEM_JOURNAL, (long long)sizeof(JournalEntry) * nj);
+    store->journal_max_seq = nj ? je[nj-1].seq : 0;
+    if (damaged) printf("Warning: %d journal file%s damaged; run 'fsck' for details.\n", damaged, damaged == 1 ? " is" : "s are");
+    load_bookings(background);
+    replay_journal(je, nj);
+    // new entries must not be appended after old-size ones: once everything journaled
+    // is in the snapshot, start the journals afresh
+    if (store->journal_legacy_seen && persist_enabled && owns_store() && store->snapshot_seq >= store->journal_max_seq)
+        journal_truncate_all();
+    store->journal_legacy_seen = 0;
+    free(je);
+    mem_account(MEM_JOURNAL, -(long long)sizeof(JournalEntry) * nj);
+    load_archive_catalog();
+    int m = archive_max_id();
+    if (m >= store->next_booking_id) store->next_booking_id = m + 1;
+    load_id_lease();
+    load_accounts();
+}
+
+int cmp_booking_ptr_id(const void *a, const void *b) {
+    const Booking *x = *(const Booking* const*)a, *y = *(const Booking* const*)b;
+    return (x->booking_id > y->booking_id) - (x->booking_id < y->booking_id);
+}
+
+/* Write bookings (sorted by id) to a new segment. Returns bytes written or -1. */
+long long write_archive_segment(const char *path, Booking **bk, int count, int compress) {
+    ArchiveHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ARCHIVE_MAGIC, sizeof(h.magic));
+    h.version = compress ? ARCHIVE_VERSION_LZ : ARCHIVE_VERSION;
+    h.count = count;
+    h.min_id = bk[0]->booking_id;
+    h.max_id = bk[count-1]->booking_id;
+    h.oldest_date = h.newest_date = bk[0]->journey_date;
+    h.index_off = ARCHIVE_HEADER_SIZE;
+
+    ArchiveIndexEntry *index = (ArchiveIndexEntry*)malloc(sizeof(ArchiveIndexEntry) * count);
+    unsigned char *data = (unsigned char*)malloc((size_t)MAX_PACKED * count);
+    ArchiveBlockEntry *blocks = (ArchiveBlockEntry*)malloc(sizeof(ArchiveBlockEntry) * (count + 1));
+    int nblocks = 0;
+    size_t len = 0;
+    for (int i = 0; i < count; ++i) {
+        // start a new block when this record would overflow the current one
+        if (nblocks == 0 || len - blocks[nblocks-1].raw_start + MAX_PACKED > ARCHIVE_BLOCK_BYTES) {
+            blocks[nblocks].raw_start = (unsigned int)len;
+            nblocks++;
+        }
+        index[i].booking_id = bk[i]->booking_id;
+        index[i].offset = (unsigned int)len;
+        len += pack_booking(bk[i], data + len);
+        if (bk[i]->journey_date < h.oldest_date) h.oldest_date = bk[i]->journey_date;
+        if (bk[i]->journey_date > h.newest_date) h.newest_date = bk[i]->journey_date;
+    }
+    for (int b = 0; b < nblocks; ++b)
+        blocks[b].raw_len = (b + 1 < nblocks ? blocks[b+1].raw_start : (unsigned int)len) - blocks[b].raw_start;
+
+    if (compress) {
+        h.block_count = nblocks;
+        h.blocks_off = h.index_off + (long long)ARCHIVE_INDEX_ENTRY_SIZE * count;
+        h.data_off = h.blocks_off + (long long)ARCHIVE_BLOCK_ENTRY_SIZE * nblocks;
+    } else {
+        h.data_off = h.index_off + (long long)ARCHIVE_INDEX_ENTRY_SIZE * count;
+        h.data_len = (long long)len;
+    }
+    unsigned char hdr[ARCHIVE_HEADER_SIZE];
+    unsigned char *tables = (unsigned char*)malloc((size_t)ARCHIVE_INDEX_ENTRY_SIZE * count +
+                                                   (size_t)ARCHIVE_BLOCK_ENTRY_SIZE * nblocks);
+    size_t tables_len = (size_t)ARCHIVE_INDEX_ENTRY_SIZE * count;
+    for (int i = 0; i < count; ++i) {
+        put_i32(tables + ARCHIVE_INDEX_ENTRY_SIZE * i, index[i].booking_id);
+        le32_put(tables + ARCHIVE_INDEX_ENTRY_SIZE * i + 4, index[i].offset);
+    }
+
+    char tmp[80];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    int ok = f != NULL;
+    if (ok && compress) {
+        // blocks first (their file offsets go into the table), then header, index and table
+        unsigned char *scratch = (unsigned char*)malloc(ARCHIVE_BLOCK_BYTES);
+        long long pos = h.data_off;
+        int rec = 0;
+        ok = rb_fseek(f, pos, SEEK_SET) == 0;
+        for (int b = 0; ok && b < nblocks; ++b) {
+            int first = rec;
+            while (rec < count && index[rec].offset < blocks[b].raw_start + blocks[b].raw_len) rec++;
+            blocks[b].file_off = pos;
+            long long w = write_block(f, data + blocks[b].raw_start, (int)blocks[b].raw_len, rec - first, scratch);
+            ok = w > 0;
+            pos += w;
+        }
+        free(scratch);
+        h.data_len = pos - h.data_off;
+        for (int b = 0; b < nblocks; ++b) {
+            unsigned char *e = tables + tables_len + ARCHIVE_BLOCK_ENTRY_SIZE * b;
+            le32_put(e, blocks[b].raw_start);
+            le32_put(e + 4, blocks[b].raw_len);
+            le64_put(e + 8, (unsigned long long)blocks[b].file_off);
+        }
+        tables_len += (size_t)ARCHIVE_BLOCK_ENTRY_SIZE * nblocks;
+        put_archive_header(hdr, &h);
+        ok = ok && rb_fseek(f, 0, SEEK_SET) == 0 &&
+             fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+             fwrite(tables, 1, tables_len, f) == tables_len;
+        ok = (fclose(f) == 0) && ok;
+    } else if (ok) {
+        put_archive_header(hdr, &h);
+        ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+             fwrite(tables, 1, tables_len, f) == tables_len &&
+             fwrite(data, 1, len, f) == len;
+        ok = (fclose(f) == 0) && ok;
+    }
+    free(tables);
+    free(index);
+    free(data);
+    free(blocks);
+    if (!ok || replace_file(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return h.data_off + h.data_len;
+}
+
+/* Move bookings whose journey is more than `days` days old into a new segment.
+   The segment is published before bookings.dat is rewritten, so a crash in between
+   leaves the bookings in both places, never in neither. */
+int archive_bookings(int days) {
+    if (claim_store() != 0) {
+        printf("archive: another process is serving this store; stop it first (%s%s is locked)\n",
+               store->dir, OWNER_LOCK_FILE);
+        return 1;
+    }
+    load_store(0);
+    long cutoff = days_from_date(today_date()) - days;
+    int count = 0, total = 0;
+    for (Node *c = store->head; c; c = c->next) {
+        total++;
+        if (c->b.journey_date != 0 && days_from_date(c->b.journey_date) < cutoff) count++;
+    }
+    if (count == 0) {
+        printf("archive: nothing older than %d days (%d bookings in hot store)\n", days, total);
+        return 0;
+    }
+
+    Booking **sel = (Booking**)malloc(sizeof(Booking*) * count);
+    int k = 0;
+    for (Node *c = store->head; c; c = c->next)
+        if (c->b.journey_date != 0 && days_from_date(c->b.journey_date) < cutoff) sel[k++] = &c->b;
+    qsort(sel, (size_t)count, sizeof(Booking*), cmp_booking_ptr_id);
+
+    char path[MAX_STORE_PATH];
+    archive_segment_path(store->num_archive_segs + 1, path, sizeof(path));
+    for (int seq = store->num_archive_segs + 1; file_size(path) >= 0; ++seq)
+        archive_segment_path(seq, path, sizeof(path));
+    long long bytes = write_archive_segment(path, sel, count, snapshot_compress);
+    free(sel);
+    if (bytes < 0) {
+        printf("archive: could not write %s\n", path);
+        return 1;
+    }
+
+    Node **pp = &store->head;
+    while (*pp) {
+        Node *c = *pp;
+        if (c->b.journey_date != 0 && days_from_date(c->b.journey_date) < cutoff) {
+            *pp = c->next;
+            index_remove(c);
+            rb_free(MEM_BOOKINGS, c, sizeof(Node));
+        } else {
+            pp = &c->next;
+        }
+    }
+    save_bookings();
+    printf("archive: moved %d bookings to %s (%lld bytes, %.1f bytes/booking vs %d in memory), %d remain hot\n",
+           count, path, bytes, (double)bytes / count, (int)sizeof(Booking), total - count);
+    return 0;
+}
+
+/* Create a text ticket file (always created) */
+void write_ticket_text(const Booking *bk) {
+    char fname[MAX_STORE_PATH + 32];
+    snprintf(fname, sizeof(fname), "%sbooking_%d.txt", store->dir, bk->booking_id);
+    FILE *f = fopen(fname, "w");
+    if (!f) return;
+    fprintf(f, "Booking ID: %d\n", bk->booking_id);
+    fprintf(f, "Name: %s\n", bk->passenger_name);
+    fprintf(f, "Age: %d\n", bk->age);
+    fprintf(f, "Gender: %s\n", bk->gender);
+    fprintf(f, "Train ID: %d\n", bk->train_id);
+    fprintf(f, "Class: %s\n", bk->travel_class);
+    char date[16];
+    format_date(bk->journey_date, date, sizeof(date));
+    fprintf(f, "Journey Date: %s\n", date);
+    fprintf(f, "Generated: %s", ctime(&(time_t){time(NULL)}));
+    fclose(f);
+    log_event(EV_TICKET, bk->booking_id, 0, 0, fname);
+}
+
+#ifdef HAVE_QRENCODE
+/* Generate a PBM QR image using libqrencode.
+   Output file: booking_<id>_qr.pbm (ASCII PBM format P1)
+*/
+void generate_qr_pbm_lib(const Booking *bk) {
+    char data[512];
+    snprintf(data, sizeof(data),
+             "BookingID:%d;Name:%s;Age:%d;Train:%d;Class:%s",
+             bk->booking_id, bk->passenger_name, bk->age, bk->train_id, bk->travel_class);
+    QRcode *q = QRcode_encodeString8bit(data, 0, QR_ECLEVEL_L);
+    if (!q) {
+        fprintf(stderr, "QR generation failed.\n");
+        return;
+    }
+
+    int size = q->width;
+    char fname[MAX_STORE_PATH + 32];
+    snprintf(fname, sizeof(fname), "%sbooking_%d_qr.pbm", store->dir, bk->booking_id);
+    FILE *f = fopen(fname, "w");
+    if (!f) { QRcode_free(q); return; }
+
+    // Write ASCII PBM (P1)
+    fprintf(f, "P1\n%d %d\n", size, size);
+    unsigned char *d = q->data;
+    for (int y=0;y<size;y++) {
+        for (int x=0;x<size;x++) {
+            int isblack = d[y*size + x] & 1; // 1 = black
+            fprintf(f, "%d ", isblack ? 1 : 0);
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    QRcode_free(q);
+    log_event(EV_TICKET, bk->booking_id, 0, 0, fname);
+    printf("QR code (PBM) saved to %s\n", fname);
+}
+#endif
+
+/* Fallback ASCII "QR-like" generator if libqrencode not available */
+void generate_qr_fallback(const Booking *bk) {
+    // create a simple deterministic ascii block based on booking id and name hash
+    unsigned int h = 5381;
+    const char *s = bk->passenger_name;
+    while (*s) h = ((h << 5) + h) + (unsigned char)(*s++);
+    h ^= (unsigned int)bk->booking_id;
+    int dim = 21; // small square
+    char fname[MAX_STORE_PATH + 32];
+    snprintf(fname, sizeof(fname), "%sbooking_%d_qr.txt", store->dir, bk->booking_id);
+    FILE *f = fopen(fname, "w");
+    if (!f) return;
+    fprintf(f, "ASCII QR placeholder for Booking %d\n\n", bk->booking_id);
+    for (int y=0;y<dim;y++) {
+        for (int x=0;x<dim;x++) {
+            unsigned int val = (h + x*131 + y*137) & 0xFF;
+            if (val % 3 == 0) fputc('#', f);
+            else fputc(' ', f);
+        }
+        fputc('\n', f);
+    }
+    fclose(f);
+    log_event(EV_TICKET, bk->booking_id, 0, 0, fname);
+    printf("ASCII QR placeholder saved to %s (real QR disabled)\n", fname);
+}
+
+/* Generate QR (tries libqrencode if available) */
+void generate_qr(const Booking *bk) {
+    // always write text ticket too
+    int span = trace_begin("ticket_text");
+    write_ticket_text(bk);
+    trace_end(span);
+    span = trace_begin("qr");
+#ifdef HAVE_QRENCODE
+    generate_qr_pbm_lib(bk);
+#else
+    generate_qr_fallback(bk);
+#endif
+    trace_end(span);
+}
+
+/* ---------------- Stations ----------------
+   Stations exist only as the from/to strings of trains[]. The station dictionary
+   collects them, deduplicated on the normalized name (see normalize_key), with a
+   traffic count: seats booked on the trains that call there. Completion runs on a
+   radix tree over the normalized names. Each node holds an edge label (the run of
+   characters its whole subtree shares, pointing into one string pool), its children
+   stored contiguously in sorted order, and the best traffic in its subtree. A prefix
+   query walks down to the prefix, then expands subtrees best-first on that bound, so
+   the top k come out without visiting the rest of the subtree. When the prefix has
+   fewer than k completions and is at least 3 characters long, names within one edit
+   of it (insertion, deletion, substitution or a swap of adjacent letters) fill the
+   remaining slots, ranked the same way after the exact ones. After the one edit is
+   spent the walk can only follow the query exactly, so each candidate edit costs a
+   step or two; children's first characters sit together in first_char for memchr.
+*/
+#define MAX_STATION_NAME 50
+#define STATION_HEAP 2048       /* candidates kept per query; plenty for k <= 32 */
+#define STATION_FUZZY_MIN 3     /* shortest prefix that gets typo-tolerant matches */
+
+typedef struct {
+    char name[MAX_STATION_NAME];
+    long long traffic;
+} Station;
+
+typedef struct {
+    unsigned int label;         /* offset of the edge label in labels */
+    unsigned short label_len;
+    unsigned short nchild;      /* first_char[first_child ..] holds their first characters */
+    unsigned int first_child;   /* children are nodes[first_child .. first_child + nchild) */
+    int station;                /* station whose name ends here, -1 if none */
+    long long best;             /* highest traffic in the subtree */
+} StationNode;
+
+typedef struct StationIndex {
+    Station *stations;          /* sorted by normalized name */
+    int count;
+    StationNode *nodes;         /* nodes[0] is the root */
+    char *first_char;           /* first character of each node's label */
+    int num_nodes, node_cap;
+    char *labels;               /* normalized names, NUL-separated */
+    unsigned int *key_off;      /* station -> its normalized name in labels */
+    size_t labels_len;
+} StationIndex;
+
+typedef struct {
+    char key[MAX_NAME];
+    const char *name;
+    long long traffic;
+} StationKey;
+
+int cmp_station_key(const void *a, const void *b) {
+    return strcmp(((const StationKey*)a)->key, ((const StationKey*)b)->key);
+}
+
+void free_station_index(StationIndex *ix) {
+    rb_free(MEM_STATIONS, ix->stations, sizeof(Station) * ix->count);
+    rb_free(MEM_STATIONS, ix->nodes, sizeof(StationNode) * ix->node_cap);
+    rb_free(MEM_STATIONS, ix->first_char, (size_t)ix->node_cap);
+    rb_free(MEM_STATIONS, ix->labels, ix->labels_len);
+    rb_free(MEM_STATIONS, ix->key_off, sizeof(unsigned int) * ix->count);
+    memset(ix, 0, sizeof(*ix));
+}
+
+/* Fill node (whose name is the first `depth` chars of stations lo..hi-1) and its subtree */
+void build_station_node(StationIndex *ix, int node, int lo, int hi, int depth) {
+    StationNode *nd = &ix->nodes[node];
+    nd->station = -1;
+    nd->best = 0;
+    const char *first = ix->labels + ix->key_off[lo];
+    if (first[depth] == 0) {    // sorted order puts the name that ends here first
+        nd->station = lo;
+        nd->best = ix->stations[lo].traffic;
+        lo++;
+    }
+    int groups = 0;
+    for (int i = lo; i < hi; ++i)
+        if (i == lo || ix->labels[ix->key_off[i] + depth] != ix->labels[ix->key_off[i-1] + depth]) groups++;
+    int child = ix->num_nodes;
+    ix->num_nodes += groups;
+    nd->first_child = (unsigned int)child;
+    nd->nchild = (unsigned short)groups;
+    for (int a = lo; a < hi; ++child) {
+        char c = ix->labels[ix->key_off[a] + depth];
+        int b = a + 1;
+        while (b < hi && ix->labels[ix->key_off[b] + depth] == c) b++;
+        // the group's common prefix is the common prefix of its first and last name
+        const char *x = ix->labels + ix->key_off[a], *y = ix->labels + ix->key_off[b-1];
+        int end = depth + 1;
+        while (x[end] && x[end] == y[end]) end++;
+        StationNode *cn = &ix->nodes[child];
+        cn->label = ix->key_off[a] + (unsigned int)depth;
+        cn->label_len = (unsigned short)(end - depth);
+        ix->first_char[child] = c;
+        build_station_node(ix, child, a, b, end);
+        nd = &ix->nodes[node];
+        if (cn->best > nd->best) nd->best = cn->best;
+        a = b;
+    }
+}
+
+/* Build ix from n names with their traffic. Names that normalize the same are merged. */
+int build_station_index(StationIndex *ix, const char *const *names, const long long *traffic, int n) {
+    memset(ix, 0, sizeof(*ix));
+    StationKey *keys = (StationKey*)malloc(sizeof(StationKey) * (n > 0 ? n : 1));
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (normalize_key(names[i], keys[m].key) == 0) continue;
+        keys[m].name = names[i];
+        keys[m].traffic = traffic ? traffic[i] : 0;
+        m++;
+    }
+    qsort(keys, (size_t)m, sizeof(StationKey), cmp_station_key);
+    int u = 0;
+    for (int i = 0; i < m; ++i) {
+        if (u > 0 && strcmp(keys[u-1].key, keys[i].key) == 0) keys[u-1].traffic += keys[i].traffic;
+        else keys[u++] = keys[i];
+    }
+    ix->count = u;
+    ix->stations = (Station*)rb_calloc(MEM_STATIONS, (size_t)(u > 0 ? u : 1), sizeof(Station));
+    ix->key_off = (unsigned int*)rb_malloc(MEM_STATIONS, sizeof(unsigned int) * (u > 0 ? u : 1));
+    ix->labels_len = 1;
+    for (int i = 0; i < u; ++i) ix->labels_len += strlen(keys[i].key) + 1;
+    ix->labels = (char*)rb_malloc(MEM_STATIONS, ix->labels_len);
+    size_t off = 0;
+    for (int i = 0; i < u; ++i) {
+        snprintf(ix->stations[i].name, MAX_STATION_NAME, "%s", keys[i].name);
+        ix->stations[i].traffic = keys[i].traffic;
+        ix->key_off[i] = (unsigned int)off;
+        size_t len = strlen(keys[i].key);
+        memcpy(ix->labels + off, keys[i].key, len + 1);
+        off += len + 1;
+    }
+    free(keys);
+    // a radix tree over u names has at most 2u nodes
+    ix->node_cap = 2 * u + 1;
+    ix->nodes = (StationNode*)rb_calloc(MEM_STATIONS, (size_t)ix->node_cap, sizeof(StationNode));
+    ix->first_char = (char*)rb_calloc(MEM_STATIONS, (size_t)ix->node_cap, 1);
+    ix->num_nodes = 1;
+    if (u > 0) build_station_node(ix, 0, 0, u, 0);
+    else ix->nodes[0].station = -1;
+    return u;
+}
+
+/* Rebuild the catalog dictionary from trains[]. Caller holds store->lock (train_booked). */
+void refresh_station_index() {
+    const char *names[2 * MAX_TRAINS];
+    long long traffic[2 * MAX_TRAINS];
+    for (int i = 0; i < MAX_TRAINS; ++i) {
+        names[2*i] = store->trains[i].from;
+        names[2*i+1] = store->trains[i].to;
+        traffic[2*i] = traffic[2*i+1] = store->train_booked[i];
+    }
+    free_station_index(store->stations);
+    build_station_index(store->stations, names, traffic, 2 * MAX_TRAINS);
+}
+
+/* Max-heap of candidates: a subtree (node >= 0, scored by its best traffic) or a
+   station ready to be returned (node = -1 - station, scored by its own traffic) */
+typedef struct {
+    long long score;
+    int node;
+} StationCand;
+
+int station_cand_before(const StationCand *a, const StationCand *b) {
+    if (a->score != b->score) return a->score > b->score;
+    return a->node < b->node;   // ties: shallower subtrees, then names in order
+}
+
+void station_heap_push(StationCand *h, int *n, long long score, int node) {
+    if (*n == STATION_HEAP) return;
+    int i = (*n)++;
+    StationCand c = {score, node};
+    while (i > 0 && station_cand_before(&c, &h[(i - 1) / 2])) {
+        h[i] = h[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h[i] = c;
+}
+
+StationCand station_heap_pop(StationCand *h, int *n) {
+    StationCand top = h[0], last = h[--(*n)];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= *n) break;
+        if (c + 1 < *n && station_cand_before(&h[c + 1], &h[c])) c++;
+        if (!station_cand_before(&h[c], &last)) break;
+        h[i] = h[c];
+        i = c;
+    }
+    if (*n > 0) h[i] = last;
+    return top;
+}
+
+/* Append to out[*got..k) the best stations under the subtrees in the heap, skipping
+   any already in out (typo matches overlap each other and the exact ones) */
+void station_take_best(const StationIndex *ix, StationCand *heap, int *hn, int k, int *out, int *got) {
+    while (*hn > 0 && *got < k) {
+        StationCand c = station_heap_pop(heap, hn);
+        if (c.node < 0) {
+            int st = -1 - c.node, dup = 0;
+            for (int i = 0; i < *got && !dup; ++i) dup = out[i] == st;
+            if (!dup) out[(*got)++] = st;
+            continue;
+        }
+        const StationNode *nd = &ix->nodes[c.node];
+        if (nd->station >= 0) station_heap_push(heap, hn, ix->stations[nd->station].traffic, -1 - nd->station);
+        for (unsigned int i = 0; i < nd->nchild; ++i)
+            station_heap_push(heap, hn, ix->nodes[nd->first_child + i].best, (int)(nd->first_child + i));
+    }
+}
+
+/* Node whose subtree holds every name starting with q, or -1 */
+int station_prefix_node(const StationIndex *ix, const char *q, int m) {
+    int node = 0, i = 0;
+    while (i < m) {
+        const StationNode *nd = &ix->nodes[node];
+        int next = -1;
+        for (unsigned int c = 0; c < nd->nchild; ++c) {
+            const StationNode *cn = &ix->nodes[nd->first_child + c];
+            char lc = ix->labels[cn->label];
+            if (lc == q[i]) { next = (int)(nd->first_child + c); break; }
+            if (lc > q[i]) break;   // children are in sorted order
+        }
+        if (next < 0) return -1;
+        const StationNode *cn = &ix->nodes[next];
+        for (int j = 0; j < cn->label_len && i < m; ++j, ++i)
+            if (ix->labels[cn->label + j] != q[i]) return -1;
+        node = next;
+    }
+    return node;
+}
+
+/* Typo-tolerant walk: the cursor is at offset j of node's label, i characters of the
+   query are consumed, e edits are spent. Every place the whole query is consumed
+   with at most one edit starts a subtree of matches. */
+typedef struct {
+    const StationIndex *ix;
+    const char *q;
+    int m;
+    StationCand *heap;
+    int *hn;
+} FuzzyWalk;
+
+/* Move the cursor over character c if the trie has it next. Returns 0 if not. */
+int station_step(const StationIndex *ix, int *node, int *j, char c) {
+    const StationNode *nd = &ix->nodes[*node];
+    if (*j < nd->label_len) {
+        if (ix->labels[nd->label + *j] != c) return 0;
+        ++*j;
+        return 1;
+    }
+    const char *hit = memchr(ix->first_char + nd->first_child, c, nd->nchild);
+    if (!hit) return 0;
+    *node = (int)(hit - ix->first_char);
+    *j = 1;
+    return 1;
+}
+
+void station_fuzzy_walk(FuzzyWalk *w, int node, int j, int i, int e) {
+    const StationIndex *ix = w->ix;
+    if (i == w->m) {
+        station_heap_push(w->heap, w->hn, ix->nodes[node].best, node);
+        return;
+    }
+    int n2 = node, j2 = j;
+    if (station_step(ix, &n2, &j2, w->q[i])) station_fuzzy_walk(w, n2, j2, i + 1, e);
+    if (e) return;
+    station_fuzzy_walk(w, node, j, i + 1, 1);                       // q[i] was typed by mistake
+    const StationNode *nd = &ix->nodes[node];
+    int first = j < nd->label_len ? node : (int)nd->first_child;
+    int count = j < nd->label_len ? 1 : nd->nchild;
+    for (int c = first; c < first + count; ++c) {
+        char ch = c == node ? ix->labels[nd->label + j] : ix->first_char[c];
+        n2 = c;
+        j2 = c == node ? j + 1 : 1;
+        if (ch != w->q[i]) station_fuzzy_walk(w, n2, j2, i + 1, 1);  // wrong character
+        station_fuzzy_walk(w, n2, j2, i, 1);                         // character left out
+        int n3 = n2, j3 = j2;
+        if (i + 1 < w->m && ch == w->q[i+1] && ch != w->q[i] && station_step(ix, &n3, &j3, w->q[i]))
+            station_fuzzy_walk(w, n3, j3, i + 2, 1);                 // neighbours swapped
+    }
+}
+
+/* Up to k completions of typed, best traffic first. Returns how many were written to
+   out (station indexes into ix->stations); *exact gets how many of them start with
+   the typed text, the rest are typo-tolerant matches. */
+int complete_station(const StationIndex *ix, const char *typed, int k, int *out, int *exact) {
+    char q[MAX_NAME];
+    int m = (int)normalize_key(typed, q), got = 0, hn = 0;
+    StationCand heap[STATION_HEAP];
+    *exact = 0;
+    if (!ix->count || k <= 0) return 0;
+    int node = station_prefix_node(ix, q, m);
+    if (node >= 0) {
+        station_heap_push(heap, &hn, ix->nodes[node].best, node);
+        station_take_best(ix, heap, &hn, k, out, &got);
+    }
+    *exact = got;
+    if (got < k && m >= STATION_FUZZY_MIN && m <= MAX_NAME) {
+        FuzzyWalk w = {ix, q, m, heap, &hn};
+        hn = 0;
+        station_fuzzy_walk(&w, 0, 0, 0, 0);
+        station_take_best(ix, heap, &hn, k, out, &got);
+    }
+    return got;
+}
+
+/* ---------------- Traffic capture ----------------
+   With RB_CAPTURE=<file> the menu records every command that reaches the store
+   (list, book, search, cancel) with its timing and a digest of its result, so that
+   'railway_booking replay <file>' can re-drive the same traffic against another
+   build and check it still gets the same answers. Input that is rejected before
+   the store is asked (bad dates, unknown trains) is not recorded.
+
+   file: char magic[8] "RBCAPT1", u32 version, u32 reserved, u64 store seq when
+   the capture started, u64 wall-clock start in ns. Then one record per command:
+      varint  us since the previous command started
+      u8      command (CMD_*)
+      u8      result: BOOK_* for book, 0/1/2 (missing/hot/archived) for search,
+              0/1 for cancel, 0 for list
+      varint  latency in ns
+      u32     result digest (command_digest)
+      book: pack_booking() of the request, booking_id set when it was booked
+      search, cancel: varint booking id
+   Varints are little-endian base 128. Integers are little-endian.
+*/
+#define CAPTURE_MAGIC "RBCAPT1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 32
+#define MAX_CAPTURE_RECORD (10 + 2 + 10 + 4 + MAX_PACKED)
+
+enum { CMD_LIST = 1, CMD_BOOK, CMD_SEARCH, CMD_CANCEL, NUM_CMDS };
+const char *command_names[NUM_CMDS] = { "", "list", "book", "search", "cancel" };
+
+FILE *capture_fp = NULL;
+pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long capture_last_ns = 0;
+
+size_t put_varint(unsigned char *p, unsigned long long v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (unsigned char)(v | 0x80); v >>= 7; }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* Returns bytes consumed or -1 if the varint runs past avail */
+int get_varint(const unsigned char *p, size_t avail, unsigned long long *v) {
+    *v = 0;
+    for (size_t i = 0; i < avail && i < 10; ++i) {
+        *v |= (unsigned long long)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) return (int)i + 1;
+    }
+    return -1;
+}
+
+/* Store seq the next commit builds on: identifies the state a capture starts from */
+unsigned long long store_seq() {
+    return store->commit_seq > store->snapshot_seq ? store->commit_seq : store->snapshot_seq;
+}
+
+/* What a command answered, independent of booking ids (replays assign new ones):
+   the result code, plus seat availability for list or the booking found by search */
+unsigned int command_digest(int cmd, int result, const Booking *b, const int *avail) {
+    unsigned char buf[2 + DISK_RECORD_SIZE];
+    size_t n = 2;
+    buf[0] = (unsigned char)cmd;
+    buf[1] = (unsigned char)result;
+    if (cmd == CMD_LIST) {
+        for (int i = 0; i < MAX_TRAINS; ++i, n += 4) le32_put(buf + n, (unsigned int)avail[i]);
+    } else if (cmd == CMD_SEARCH && result) {
+        Booking c = *b;
+        c.booking_id = 0;
+        c.owner_id = 0;         // captures do not carry owners
+        encode_disk_record(&c, buf + n);
+        n += DISK_CHECKED_LEN;
+    }
+    return checksum32(buf, n);
+}
+
+int start_capture(const char *path) {
+    capture_fp = fopen(path, "wb");
+    if (!capture_fp) return -1;
+    unsigned char h[CAPTURE_HEADER_SIZE];
+    memset(h, 0, sizeof(h));
+    memcpy(h, CAPTURE_MAGIC, 8);
+    le32_put(h + 8, CAPTURE_VERSION);
+    le64_put(h + 16, store_seq());
+    capture_last_ns = wall_ns();
+    le64_put(h + 24, capture_last_ns);
+    fwrite(h, 1, sizeof(h), capture_fp);
+    return 0;
+}
+
+void stop_capture() {
+    pthread_mutex_lock(&capture_lock);
+    if (capture_fp) fclose(capture_fp);
+    capture_fp = NULL;
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/* Record a command that started at start_ns (wall_ns). b is the booking for book,
+   id the booking id for search and cancel. */
+void capture_command(int cmd, unsigned long long start_ns, int result, unsigned int digest,
+                     const Booking *b, int id) {
+    unsigned long long end_ns = wall_ns();
+    unsigned char rec[MAX_CAPTURE_RECORD];
+    pthread_mutex_lock(&capture_lock);
+    if (!capture_fp) {
+        pthread_mutex_unlock(&capture_lock);
+        return;
+    }
+    size_t n = put_varint(rec, start_ns > capture_last_ns ? (start_ns - capture_last_ns) / 1000 : 0);
+    capture_last_ns = start_ns > capture_last_ns ? start_ns : capture_last_ns;
+    rec[n++] = (unsigned char)cmd;
+    rec[n++] = (unsigned char)result;
+    n += put_varint(rec + n, end_ns - start_ns);
+    le32_put(rec + n, digest); n += 4;
+    if (cmd == CMD_BOOK) n += pack_booking(b, rec + n);
+    else if (cmd != CMD_LIST) n += put_varint(rec + n, (unsigned int)id);
+    // flushed per command: the menu runs at human pace and a crash should keep the capture
+    fwrite(rec, 1, n, capture_fp);
+    fflush(capture_fp);
+    pthread_mutex_unlock(&capture_lock);
+}
+
+/* Seats left on every train, in trains[] order */
+void train_availability(int *avail) {
+    pthread_mutex_lock(&store->lock);
+    memcpy(avail, cached_response(0)->avail, sizeof(int) * MAX_TRAINS);
+    pthread_mutex_unlock(&store->lock);
+}
+
+/* Print trains */
+void list_trains() {
+    printf("\nAvailable Trains:\n");
+    printf("ID   Name               From -> To           Seats Avail   Fare\n");
+    printf("-------------------------------------------------------------\n");
+    unsigned long long start = wall_ns();
+    int avail[MAX_TRAINS];
+    char text[LISTING_TEXT_SIZE];
+    pthread_mutex_lock(&store->lock);
+    const CachedResponse *e = cached_response(0);
+    memcpy(avail, e->avail, sizeof(avail));
+    memcpy(text, e->text, sizeof(text));
+    pthread_mutex_unlock(&store->lock);
+    if (capture_fp) capture_command(CMD_LIST, start, 0, command_digest(CMD_LIST, 0, NULL, avail), NULL, 0);
+    fputs(text, stdout);
+}
+
+/* Session of whoever is at the menu (0 = not logged in) */
+unsigned long long menu_session = 0;
+
+/* Book ticket with duplicate check and QR generation */
+void book_ticket() {
+    Booking bk;
+    char temp[256];
+    memset(&bk, 0, sizeof(bk));
+    bk.owner_id = session_user(menu_session);
+
+    printf("\n--- Book Ticket ---\n");
+    printf("Enter passenger name: ");
+    fgets(temp, sizeof(temp), stdin); chomp(temp);
+    while (strlen(temp) == 0) {
+        printf("Name cannot be empty. Enter passenger name: ");
+        fgets(temp, sizeof(temp), stdin); chomp(temp);
+    }
+    strncpy(bk.passenger_name, temp, MAX_NAME);
+
+    printf("Enter age: ");
+    if (scanf("%d", &bk.age) != 1) {
+        printf("Invalid input. Booking canceled.\n");
+        while (getchar() != '\n');
+        return;
+    }
+    while (getchar() != '\n'); // clear the rest
+
+    printf("Enter gender (Male/Female/Other): ");
+    fgets(temp, sizeof(temp), stdin); chomp(temp);
+    int g = gender_id(temp);
+    if (g < 0) {
+        printf("Unknown gender. Booking canceled.\n");
+        return;
+    }
+    strcpy(bk.gender, gender_names[g]);
+
+    printf("Enter journey date (YYYY-MM-DD): ");
+    fgets(temp, sizeof(temp), stdin); chomp(temp);
+    if (!parse_date(temp, &bk.journey_date)) {
+        printf("Invalid date. Booking canceled.\n");
+        return;
+    }
+    if (bk.journey_date < today_date()) {
+        printf("Journey date is in the past. Booking canceled.\n");
+        return;
+    }
+
+    list_trains();
+    printf("Enter train ID to book: ");
+    if (scanf("%d", &bk.train_id) != 1) {
+        printf("Invalid train ID. Booking canceled.\n");
+        while (getchar() != '\n');
+        return;
+    }
+    while (getchar() != '\n');
+
+    // validate train id
+    const Train *chosenTrain = find_train(bk.train_id);
+    if (!chosenTrain) {
+        printf("Train ID not found. Booking canceled.\n");
+        return;
+    }
+
+    // check availability (final check happens again when the seat is held)
+    pthread_mutex_lock(&store->lock);
+    int left = seats_left(bk.train_id);
+    pthread_mutex_unlock(&store->lock);
+    if (left <= 0) {
+        printf("Sorry, no seats available on %s.\n", chosenTrain->name);
+        return;
+    }
+
+    printf("Enter travel class (SL/2S/3E/3A/2A/1A/CC/EC/FC): ");
+    fgets(temp, sizeof(temp), stdin); chomp(temp);
+    int c = class_id(temp);
+    if (c < 0) {
+        printf("Unknown travel class. Booking canceled.\n");
+        return;
+    }
+    strcpy(bk.travel_class, class_codes[c]);
+
+    pthread_mutex_lock(&store->lock);
+    int fare = current_fare(chosenTrain);
+    pthread_mutex_unlock(&store->lock);
+    char payref[64];
+    TraceRequest tr, *trace;
+    unsigned long long start;
+    int result;
+    for (;;) {
+        printf("Fare: Rs %d. Processing payment via %s...\n", fare, gateway->name);
+        trace = trace_request_begin(&tr, "book_ticket");
+        start = wall_ns();
+        result = place_booking(&bk, &fare, payref, sizeof(payref));
+        if (result != BOOK_FARE_CHANGED) break;
+        // nothing was held or charged: ask before paying a different fare
+        trace_request_end(trace, 0, result);
+        printf("The fare on %s has changed to Rs %d. Book at this fare? (y/n): ", chosenTrain->name, fare);
+        if (!fgets(temp, sizeof(temp), stdin) || tolower((unsigned char)temp[0]) != 'y') {
+            printf("Booking canceled.\n");
+            return;
+        }
+    }
+    if (capture_fp) capture_command(CMD_BOOK, start, result, command_digest(CMD_BOOK, result, &bk, NULL), &bk, 0);
+    if (result != BOOK_OK) trace_request_end(trace, 0, result);
+    switch (result) {
+        case BOOK_OK:
+            break;
+        case BOOK_NO_SEATS:
+            printf("Sorry, no seats available on %s.\n", chosenTrain->name);
+            return;
+        case BOOK_DUPLICATE:
+            printf("\nDuplicate booking detected! A booking with the same details already exists.\n");
+            printf("To prevent fraud, the system will not create a duplicate booking.\n");
+            return;
+        case BOOK_BUSY:
+            printf("Too many bookings in progress. Please try again.\n");
+            return;
+        case BOOK_PAYMENT_FAILED:
+            printf("Payment failed. Your seat hold has been released.\n");
+            return;
+        case BOOK_HOLD_EXPIRED:
+            printf("Payment took too long and the seat hold expired. The amount has been refunded.\n");
+            return;
+        case BOOK_QUOTA:
+            printf("This operator is not taking more bookings right now. Please try again shortly.\n");
+            return;
+        case BOOK_VELOCITY:
+            printf("\nToo many recent bookings for this passenger on %s.\n", chosenTrain->name);
+            printf("To prevent ticket touting, please try again later.\n");
+            return;
+        case BOOK_SAME_DAY: {
+            char date[16];
+            format_date(bk.journey_date, date, sizeof(date));
+            printf("\n%s already has a journey on %s%s.\n", bk.passenger_name, date,
+                   dup_same_day == 1 ? " on this route" : "");
+            printf("To prevent seat hoarding, a passenger can hold only one such journey per day.\n");
+            return;
+        }
+        default:
+            printf("Booking failed.\n");
+            return;
+    }
+
+    printf("\nBooking successful! Booking ID: %d\n", bk.booking_id);
+    printf("Passenger: %s | Train: %s (%s -> %s) | Class: %s\n",
+           bk.passenger_name, chosenTrain->name, chosenTrain->from, chosenTrain->to, bk.travel_class);
+    printf("Payment reference: %s\n", payref);
+
+    // generate QR and ticket file
+    generate_qr(&bk);
+    trace_request_end(trace, bk.booking_id, BOOK_OK);
+}
+
+/* View all bookings */
+void view_bookings() {
+    pthread_mutex_lock(&store->lock);
+    await_load_locked();
+    if (!store->head) {
+        pthread_mutex_unlock(&store->lock);
+        printf("\nNo bookings found.\n");
+        return;
+    }
+    printf("\n--- All Bookings ---\n");
+    printf("ID  Name                          Age Gender  Train           Class      Date\n");
+    printf("--------------------------------------------------------------------------------\n");
+    Node *cur = store->head;
+    while (cur) {
+        // find train name
+        char trainname[80] = "Unknown";
+        for (int i = 0; i < MAX_TRAINS; ++i) {
+            if (store->trains[i].id == cur->b.train_id) {
+                strncpy(trainname, store->trains[i].name, sizeof(trainname));
+                break;
+            }
+        }
+        char date[16];
+        format_date(cur->b.journey_date, date, sizeof(date));
+        printf("%-4d %-28s %-3d  %-6s  %-15s %-10s %s\n",
+               cur->b.booking_id,
+               cur->b.passenger_name,
+               cur->b.age,
+               cur->b.gender,
+               trainname,
+               cur->b.travel_class,
+               date);
+        cur = cur->next;
+    }
+    pthread_mutex_unlock(&store->lock);
+}
+
+/* Log in (creating the account on request) or, if logged in, log out */
+void log_in_out() {
+    int user = session_user(menu_session);
+    if (user) {
+        end_session(menu_session);
+        menu_session = 0;
+        printf("Logged out.\n");
+        return;
+    }
+    char temp[64];
+    printf("Enter user name: ");
+    if (!fgets(temp, sizeof(temp), stdin)) return;
+    chomp(temp);
+    pthread_mutex_lock(&store->lock);
+    user = find_account(temp);
+    pthread_mutex_unlock(&store->lock);
+    if (!user) {
+        printf("No account '%s'. Create it? (y/n): ", temp);
+        char yn[16];
+        if (!fgets(yn, sizeof(yn), stdin) || tolower((unsigned char)yn[0]) != 'y') return;
+        pthread_mutex_lock(&store->lock);
+        user = create_account(temp);
+        pthread_mutex_unlock(&store->lock);
+        if (!user) {
+            printf("Could not create account '%s' (names are 1-%d characters).\n", temp, MAX_USER_NAME - 1);
+            return;
+        }
+    }
+    pthread_mutex_lock(&store->lock);
+    printf("Logged in as %s. Bookings you make are saved to your account.\n", store->accounts[user - 1].name);
+    pthread_mutex_unlock(&store->lock);
+    menu_session = start_session(user);
+}
+
+/* Bookings of the logged-in account, from its owner list */
+void my_bookings() {
+    int user = session_user(menu_session);
+    if (!user) {
+        printf("Please log in first (option 8).\n");
+        return;
+    }
+    pthread_mutex_lock(&store->lock);
+    await_load_locked();
+    const OwnerList *l = user < store->owner_lists_cap ? &store->owner_lists[user] : NULL;
+    int n = l ? l->n : 0;
+    if (n == 0) {
+        pthread_mutex_unlock(&store->lock);
+        printf("\nYou have no bookings.\n");
+        return;
+    }
+    int *ids = (int*)malloc(sizeof(int) * n);
+    memcpy(ids, l->ids, sizeof(int) * n);
+    qsort(ids, (size_t)n, sizeof(int), cmp_int);
+    printf("\n--- My Bookings (%s) ---\n", store->accounts[user - 1].name);
+    printf("ID  Name                          Age Gender  Train           Class      Date\n");
+    printf("--------------------------------------------------------------------------------\n");
+    for (int i = 0; i < n; ++i) {
+        Node *c = index_lookup(ids[i]);
+        if (!c) continue;
+        const Train *t = find_train(c->b.train_id);
+        char date[16];
+        format_date(c->b.journey_date, date, sizeof(date));
+        printf("%-4d %-28s %-3d  %-6s  %-15s %-10s %s\n", c->b.booking_id, c->b.passenger_name, c->b.age,
+               c->b.gender, t ? t->name : "Unknown", c->b.travel_class, date);
+    }
+    pthread_mutex_unlock(&store->lock);
+    free(ids);
+}
+
+/* Who has been booking (or being turned away) the most since the operator was loaded */
+void booking_stats() {
+    printf("\n--- Booking Stats ---\n");
+    print_hitters(10);
+}
+
+/* Copy the hot booking with the given id into *out. Returns 1 if found. */
+int find_booking(int id, Booking *out) {
+    pthread_mutex_lock(&store->lock);
+    Node *n = lookup_booking_locked(id);
+    if (n) *out = n->b;
+    pthread_mutex_unlock(&store->lock);
+    return n != NULL;
+}
+
+/* Batched find_booking() for callers that need many bookings at once.
+   Copies the hot booking ids[i] to out[i] and sets found[i]; returns the number found.
+   Each lookup is three dependent loads (id slot, by_ordinal entry, node), so the
+   batch runs them as a pipeline: while booking i is copied, the node for i+D, the
+   ordinal entry for i+2D and the id slot for i+3D are being prefetched, and the
+   cache misses of different ids overlap instead of being paid one after another. */
+#define MULTIGET_DISTANCE 8
+#define MULTIGET_RING 32            /* power of two > 3 * MULTIGET_DISTANCE */
+
+int find_bookings(const int *ids, int n, Booking *out, unsigned char *found) {
+    int hits = 0;
+    pthread_mutex_lock(&store->lock);
+    if (store->bg_loading || !store->id_cap) {
+        // still loading: go through the path that waits for missing chunks
+        for (int i = 0; i < n; ++i) {
+            Node *nd = lookup_booking_locked(ids[i]);
+            found[i] = nd != NULL;
+            if (nd) out[i] = nd->b, hits++;
+        }
+        pthread_mutex_unlock(&store->lock);
+        return hits;
+    }
+    const int D = MULTIGET_DISTANCE;
+    unsigned int mask = store->id_cap - 1;
+    unsigned int pos[MULTIGET_RING];
+    Node *nodes[MULTIGET_RING];
+    for (int k = 0; k < n + 3 * D; ++k) {
+        int i = k;
+        if (i < n) {                                    // stage 1: hash, prefetch the id slot
+            unsigned int h = hash_id((unsigned int)ids[i]) & mask;
+            pos[i % MULTIGET_RING] = h;
+            rb_prefetch(&store->id_slots[h]);
+        }
+        i = k - D;
+        if (i >= 0 && i < n) {                          // stage 2: probe, prefetch by_ordinal
+            unsigned int j = pos[i % MULTIGET_RING], id = (unsigned int)ids[i];
+            while (store->id_slots[j].id && store->id_slots[j].id != id) j = (j + 1) & mask;
+            unsigned int ord = store->id_slots[j].id ? store->id_slots[j].ordinal : ~0u;
+            pos[i % MULTIGET_RING] = ord;
+            if (ord != ~0u) rb_prefetch(&store->by_ordinal[ord]);
+        }
+        i = k - 2 * D;
+        if (i >= 0 && i < n) {                          // stage 3: fetch node pointer, prefetch node
+            unsigned int ord = pos[i % MULTIGET_RING];
+            Node *nd = ord != ~0u ? store->by_ordinal[ord] : NULL;
+            nodes[i % MULTIGET_RING] = nd;
+            if (nd) rb_prefetch(nd);
+        }
+        i = k - 3 * D;
+        if (i >= 0) {                                   // stage 4: copy out
+            Node *nd = nodes[i % MULTIGET_RING];
+            found[i] = nd != NULL;
+            if (nd) out[i] = nd->b, hits++;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return hits;
+}
+
+/* Find a booking in the hot store or the archive.
+   Returns 1 (hot) or 2 (archived) with the booking in *out, 0 if there is none. */
+int search_by_id(int id, Booking *out) {
+    if (find_booking(id, out)) return 1;
+    return archive_lookup(id, out) ? 2 : 0;
+}
+
+/* Search booking by ID */
+void search_booking() {
+    printf("\nEnter Booking ID to search: ");
+    int id;
+    if (scanf("%d", &id) != 1) {
+        printf("Invalid input.\n");
+        while (getchar() != '\n');
+        return;
+    }
+    while (getchar() != '\n');
+
+    Booking b;
+    unsigned long long start = wall_ns();
+    int where = search_by_id(id, &b);
+    if (capture_fp) capture_command(CMD_SEARCH, start, where, command_digest(CMD_SEARCH, where, &b, NULL), NULL, id);
+    if (!where) {
+        printf("Booking with ID %d not found.\n", id);
+        return;
+    }
+    int archived = where == 2;
+    // print details
+    Train chosenTrain = {0};
+    const Train *t = find_train(b.train_id);
+    if (t) chosenTrain = *t;
+    char date[16];
+    format_date(b.journey_date, date, sizeof(date));
+    printf("\nBooking found%s:\n", archived ? " (archived)" : "");
+    printf("Booking ID: %d\n", b.booking_id);
+    printf("Name: %s\n", b.passenger_name);
+    printf("Age: %d\n", b.age);
+    printf("Gender: %s\n", b.gender);
+    printf("Train: %s (%s -> %s)\n", chosenTrain.name, chosenTrain.from, chosenTrain.to);
+    printf("Class: %s\n", b.travel_class);
+    printf("Journey Date: %s\n", date);
+}
+
+/* Remove a hot booking. Returns 1 if it existed. */
+int cancel_by_id(int id) {
+    int span = trace_begin("lookup");
+    pthread_mutex_lock(&store->lock);
+    Node *cur = lookup_booking_locked(id) ? store->head : NULL, *prev = NULL;
+    trace_end(span);
+    span = trace_begin("unlink");
+    while (cur) {
+        if (cur->b.booking_id == id) {
+            // remove node
+            if (prev) prev->next = cur->next;
+            else store->head = cur->next;
+            index_remove(cur);
+            occupancy_changed(train_slot(cur->b.train_id), -1);
+            trace_end(span);
+            span = trace_begin("persist");
+            unsigned char entry[JOURNAL_ENTRY_SIZE];
+            int logged = persist_enabled && commit_locked(JOURNAL_CANCEL, &cur->b, entry);
+            rb_free(MEM_BOOKINGS, cur, sizeof(Node));
+            pthread_mutex_unlock(&store->lock);
+            if (logged) journal_append(entry);
+            trace_end(span);
+            log_event(EV_CANCEL, id, 0, 0, NULL);
+            return 1;
+        }
+        prev = cur;
+        cur = cur->next;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return 0;
+}
+
+/* Cancel booking by ID */
+void cancel_booking() {
+    printf("\nEnter Booking ID to cancel: ");
+    int id;
+    if (scanf("%d", &id) != 1) {
+        printf("Invalid input.\n");
+        while (getchar() != '\n');
         return;
     }
-    while (getchar() != '\n');
+    while (getchar() != '\n');
+
+    TraceRequest tr;
+    TraceRequest *trace = trace_request_begin(&tr, "cancel_booking");
+    unsigned long long start = wall_ns();
+    int canceled = cancel_by_id(id);
+    trace_request_end(trace, id, canceled);
+    if (capture_fp) capture_command(CMD_CANCEL, start, canceled, command_digest(CMD_CANCEL, canceled, NULL, NULL), NULL, id);
+    if (canceled) printf("Booking %d canceled successfully.\n", id);
+    else printf("Booking ID %d not found.\n", id);
+}
+
+/* Free linked list on exit */
+void free_all() {
+    finish_background_load();
+    Node *cur = store->head;
+    while (cur) {
+        Node *tmp = cur;
+        cur = cur->next;
+        rb_free(MEM_BOOKINGS, tmp, sizeof(Node));
+    }
+    store->head = NULL;
+    reset_indexes();
+}
+
+/* Path of a tenant's directory ("" is the starting directory). Returns 0 if it exists. */
+int tenant_dir(const char *name, char *dir, size_t n) {
+    if (*name && !valid_tenant_name(name)) {
+        printf("Invalid operator name '%s'.\n", name);
+        return -1;
+    }
+    if (*name) snprintf(dir, n, "%s/%s/", TENANTS_DIR, name);
+    else snprintf(dir, n, "%s", "");
+    struct stat st;
+    if (*name && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        printf("No operator '%s' (expected directory %s/%s).\n", name, TENANTS_DIR, name);
+        return -1;
+    }
+    return 0;
+}
+
+/* Every store this process has set up, by slot */
+Store *stores[MAX_TENANTS];
+int num_stores = 0;
+pthread_mutex_t stores_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* An empty store with the default catalog and no quotas, files under dir. Returns
+   NULL when MAX_TENANTS stores exist. */
+Store *new_store(const char *name, const char *dir) {
+    pthread_mutex_lock(&stores_lock);
+    if (num_stores == MAX_TENANTS) {
+        pthread_mutex_unlock(&stores_lock);
+        printf("Error: at most %d operators can be served at once.\n", MAX_TENANTS);
+        return NULL;
+    }
+    Store *s = (Store*)calloc(1, sizeof(Store));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    snprintf(s->dir, sizeof(s->dir), "%s", dir);
+    memcpy(s->trains, default_trains, sizeof(s->trains));
+    s->next_booking_id = 1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->id_lease_lock, NULL);
+    pthread_mutex_init(&s->session_lock, NULL);
+    pthread_mutex_init(&s->archive_lock, NULL);
+    pthread_cond_init(&s->load_cond, NULL);
+    s->owner_fd = -1;
+    s->bg_want = -1;
+    s->journals = (Journal*)calloc(MAX_JOURNALS, sizeof(Journal));
+    s->sessions = (Session*)calloc(SESSION_SLOTS, sizeof(Session));
+    s->holds = (Hold*)calloc(MAX_HOLDS, sizeof(Hold));
+    s->next_hold_token = 1;
+    s->response_cache = (CachedResponse*)calloc(1 + MAX_TRAINS, sizeof(CachedResponse));
+    s->stations = (StationIndex*)calloc(1, sizeof(StationIndex));
+    s->queue_cap = SERVE_QUEUE;
+    s->slot = num_stores;
+    stores[num_stores++] = s;
+    pthread_mutex_unlock(&stores_lock);
+    return s;
+}
+
+/* The named tenant's store, set up with its catalog and quotas on first use but not
+   loaded (see open_tenant). Returns NULL, with a message, if there is no such tenant. */
+Store *tenant_store(const char *name) {
+    pthread_mutex_lock(&stores_lock);
+    for (int i = 0; i < num_stores; ++i) {
+        if (strcmp(stores[i]->name, name) != 0) continue;
+        pthread_mutex_unlock(&stores_lock);
+        return stores[i];
+    }
+    pthread_mutex_unlock(&stores_lock);
+    char dir[MAX_STORE_PATH];
+    if (tenant_dir(name, dir, sizeof(dir)) != 0) return NULL;
+    Store *s = new_store(name, dir);
+    if (!s) return NULL;
+    Store *prev = store;
+    store = s;
+    char path[MAX_STORE_PATH];
+    store_path(CATALOG_FILE, path, sizeof(path));
+    load_catalog(path);     // keeps the default catalog if there is none
+    load_tenant_conf();
+    store = prev;
+    return s;
+}
+
+/* Make the named tenant's store the calling thread's, claiming and loading it the
+   first time. Returns 0 on success; on failure the current store stays current.
+   Stores are opened from one thread at a time (the menu or the `serve` reader). */
+int open_tenant(const char *name) {
+    Store *prev = store;
+    store = tenant_store(name);
+    if (store && !store->serving) {
+        if (claim_store() != 0) {
+            printf("Error: another process is serving this store (%s%s is locked).\n", store->dir, OWNER_LOCK_FILE);
+            store = NULL;
+        } else {
+            load_store(1);
+            if (journal_enabled && journal_open_all() != 0)
+                printf("Warning: cannot open journal files in '%s'; saving its bookings.dat on every change.\n",
+                       store->dir[0] ? store->dir : ".");
+            store->serving = 1;
+        }
+    }
+    if (!store) {
+        store = prev;
+        return -1;
+    }
+    return 0;
+}
+
+/* Save every store this process serves and free its bookings (before exit) */
+void close_stores() {
+    Store *prev = store;
+    for (int i = 0; i < num_stores; ++i) {
+        store = stores[i];
+        if (!store->serving) continue;
+        pthread_mutex_lock(&store->lock);
+        if (persist_enabled) save_bookings();
+        pthread_mutex_unlock(&store->lock);
+        free_all();
+        store->serving = 0;
+    }
+    store = prev;
+}
+
+/* Menu: serve another operator. Stores already open stay loaded, so switching back
+   and forth is cheap and nothing in flight is disturbed. */
+void change_operator() {
+    char temp[64];
+    printf("Current operator: %s\n", store->name[0] ? store->name : "(default)");
+    printf("Enter operator name (empty for the default store): ");
+    if (!fgets(temp, sizeof(temp), stdin)) return;
+    chomp(temp);
+    Store *prev = store;
+    if (open_tenant(temp) != 0) return;
+    if (store != prev) {
+        menu_session = 0;       // accounts belong to the store
+        if (capture_fp) {
+            printf("Capture stopped: it covers one operator's store.\n");
+            stop_capture();
+        }
+    }
+    printf("Now serving %s", temp[0] ? temp : "the default store");
+    if (store->quota_bytes) printf(", memory quota %lld MiB", store->quota_bytes / (1024 * 1024));
+    if (store->ops_per_sec) printf(", %d bookings/s", store->ops_per_sec);
+    printf(".\n");
+}
+
+/* railway_booking lookup [id...]
+   Print many bookings at once for verifiers and reports: ids come from the command
+   line, or whitespace-separated from stdin. One tab-separated line per id. */
+int lookup_bookings(int argc, char **argv) {
+    // read-only: the serving process owns the files, and stdout stays one line per id
+    persist_enabled = 0;
+    journal_enabled = 0;
+    load_store(1);
+    int cap = 1024, n = 0;
+    int *ids = (int*)malloc(sizeof(int) * cap);
+    for (int i = 0; ; ++i) {
+        int id;
+        if (argc > 0) {
+            if (i >= argc) break;
+            id = atoi(argv[i]);
+        } else if (scanf("%d", &id) != 1) {
+            break;
+        }
+        if (n == cap) ids = (int*)realloc(ids, sizeof(int) * (cap *= 2));
+        ids[n++] = id;
+    }
+    Booking *out = (Booking*)malloc(sizeof(Booking) * (n > 0 ? n : 1));
+    unsigned char *found = (unsigned char*)malloc((size_t)(n > 0 ? n : 1));
+    find_bookings(ids, n, out, found);
+    int missing = 0;
+    for (int i = 0; i < n; ++i) {
+        int archived = !found[i] && archive_lookup(ids[i], &out[i]);
+        if (!found[i] && !archived) {
+            printf("%d\tnot found\n", ids[i]);
+            missing++;
+            continue;
+        }
+        const Booking *b = &out[i];
+        char date[16];
+        format_date(b->journey_date, date, sizeof(date));
+        printf("%d\t%s\t%d\t%s\t%d\t%s\t%s%s\n", b->booking_id, b->passenger_name, b->age, b->gender,
+               b->train_id, b->travel_class, date, archived ? "\tarchived" : "");
+    }
+    free(found);
+    free(out);
+    free(ids);
+    free_all();
+    return missing ? 1 : 0;
+}
+
+/* Live and peak bytes per subsystem, per booking when there are bookings */
+void print_memory_report(long long bookings) {
+    printf("  %-15s %12s %12s %10s\n", "subsystem", "live bytes", "peak bytes", "allocs");
+    for (int i = 0; i < NUM_MEM_TAGS; ++i) {
+        long long live = atomic_load(&mem_tags[i].live), peak = atomic_load(&mem_tags[i].peak);
+        long long allocs = atomic_load(&mem_tags[i].allocs);
+        if (!peak && !allocs) continue;
+        printf("  %-15s %12lld %12lld %10lld\n", mem_tag_names[i], live, peak, allocs);
+    }
+    long long live = atomic_load(&mem_total.live), peak = atomic_load(&mem_total.peak);
+    printf("  %-15s %12lld %12lld %10lld\n", "total", live, peak, atomic_load(&mem_total.allocs));
+    long long rss = process_rss();
+    if (bookings > 0)
+        printf("  per booking: %.1f bytes live, %.1f at peak", (double)live / bookings, (double)peak / bookings);
+    if (rss >= 0) printf("%s process RSS %lld bytes", bookings > 0 ? ";" : " ", rss);
+    if (rss >= 0 && bookings > 0) printf(" (%.1f per booking)", (double)rss / bookings);
+    printf("\n");
+}
+
+/* railway_booking stats: load the store and report what it occupies */
+int memory_stats() {
+    persist_enabled = 0;        // read-only: the serving process owns the files
+    journal_enabled = 0;
+    load_store(0);
+    long long n = 0;
+    for (Node *c = store->head; c; c = c->next) n++;
+    char path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, path, sizeof(path));
+    printf("memory: %lld bookings in %s, %d archive segment%s\n", n, path, store->num_archive_segs,
+           store->num_archive_segs == 1 ? "" : "s");
+    print_memory_report(n);
+    free_all();
+    return 0;
+}
+
+/* railway_booking stations [prefix] [k]
+   Complete a station name as the booking UI would, with the trains calling there */
+int station_lookup(int argc, char **argv) {
+    persist_enabled = 0;        // read-only: the serving process owns the files
+    journal_enabled = 0;
+    load_store(1);      // seat counts come from the index, so there is no need to wait for the load
+    pthread_mutex_lock(&store->lock);
+    refresh_station_index();
+    pthread_mutex_unlock(&store->lock);
+    const char *prefix = argc > 0 ? argv[0] : "";
+    int sid = station_id(prefix);
+    if (sid >= 0) prefix = station_codes[sid].name;     // "NDLS" completes as "Delhi"
+    int k = argc > 1 ? atoi(argv[1]) : 5;
+    if (k < 1) k = 1;
+    if (k > 32) k = 32;
+    int out[32], exact;
+    int n = complete_station(store->stations, prefix, k, out, &exact);
+    if (n == 0) printf("No station matches '%s'.\n", prefix);
+    for (int i = 0; i < n; ++i) {
+        const Station *st = &store->stations->stations[out[i]];
+        printf("%-20s %6lld booked %s", st->name, st->traffic, i < exact ? "              " : " (did you mean)");
+        for (int t = 0; t < MAX_TRAINS; ++t)
+            if (same_station(store->trains[t].from, st->name) || same_station(store->trains[t].to, st->name))
+                printf("  %d %s", store->trains[t].id, store->trains[t].name);
+        printf("\n");
+    }
+    free_station_index(store->stations);
+    free_all();
+    return n ? 0 : 1;
+}
+
+/* ---------------- Traffic replay ----------------
+   railway_booking replay <capture> [fast] [fresh]
+   Re-drives a capture (see Traffic capture) at its recorded pacing, or as fast as
+   possible with 'fast'. The store is the operator's (RB_TENANT), or an empty one
+   with 'fresh'; nothing is written back either way. Booking ids assigned during
+   the capture are mapped to the ids this run assigns, so later searches and
+   cancellations hit the same bookings. Reports throughput, latency percentiles next
+   to the captured ones, which commands answered differently, and the heaviest
+   bookers of the run (see Heavy hitters).
+*/
+typedef struct {
+    int *from, *to;
+    int n, cap;
+} IdMap;
+
+/* Position of id in the map (sorted by from), or where it would be inserted */
+int id_map_pos(const IdMap *m, int id) {
+    int lo = 0, hi = m->n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m->from[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void id_map_put(IdMap *m, int from, int to) {
+    int p = id_map_pos(m, from);
+    if (p < m->n && m->from[p] == from) { m->to[p] = to; return; }
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 256;
+        m->from = (int*)realloc(m->from, sizeof(int) * m->cap);
+        m->to = (int*)realloc(m->to, sizeof(int) * m->cap);
+    }
+    // captured ids mostly arrive in increasing order, so this is usually an append
+    memmove(m->from + p + 1, m->from + p, sizeof(int) * (m->n - p));
+    memmove(m->to + p + 1, m->to + p, sizeof(int) * (m->n - p));
+    m->from[p] = from;
+    m->to[p] = to;
+    m->n++;
+}
+
+int id_map_get(const IdMap *m, int id) {
+    int p = id_map_pos(m, id);
+    return p < m->n && m->from[p] == id ? m->to[p] : id;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/* pct-th percentile of n sorted values */
+long long percentile(const long long *v, int n, int pct) {
+    if (n == 0) return 0;
+    int i = (int)((long long)n * pct / 100);
+    return v[i < n ? i : n - 1];
+}
+
+typedef struct {
+    long long *lat;             /* replay latency, ns */
+    long long *captured;        /* captured latency, ns */
+    int n, cap;
+} CmdStats;
+
+int replay_capture(int argc, char **argv) {
+    if (argc < 1) {
+        printf("usage: replay <capture> [fast] [fresh]\n");
+        return 2;
+    }
+    const char *path = argv[0];
+    int fast = 0, fresh = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "fast") == 0) fast = 1;
+        else if (strcmp(argv[i], "fresh") == 0) fresh = 1;
+        else {
+            printf("Unknown replay option '%s' (expected fast or fresh).\n", argv[i]);
+            return 2;
+        }
+    }
+    long long size = file_size(path);
+    FILE *fp = fopen(path, "rb");
+    if (!fp || size < CAPTURE_HEADER_SIZE) {
+        printf("Cannot read capture %s.\n", path);
+        if (fp) fclose(fp);
+        return 2;
+    }
+    unsigned char *data = (unsigned char*)malloc((size_t)size);
+    size_t got = fread(data, 1, (size_t)size, fp);
+    fclose(fp);
+    if ((long long)got != size || memcmp(data, CAPTURE_MAGIC, 8) != 0 || le32_get(data + 8) != CAPTURE_VERSION) {
+        printf("%s is not a version %d capture.\n", path, CAPTURE_VERSION);
+        free(data);
+        return 2;
+    }
+    unsigned long long captured_seq = le64_get(data + 16);
+
+    // replay in memory only: no journal, no snapshot, no id lease
+    persist_enabled = 0;
+    journal_enabled = 0;
+    if (!fresh) load_store(0);
+    if (store_seq() != captured_seq)
+        printf("Note: capture started from store seq %llu, replaying against %llu; answers may differ.\n",
+               captured_seq, store_seq());
+
+    IdMap ids = {0};
+    CmdStats stats[NUM_CMDS];
+    memset(stats, 0, sizeof(stats));
+    long long commands = 0, differ = 0;
+    char first_diff[160] = "";
+    unsigned long long recorded_us = 0;
+    unsigned long long t0 = wall_ns();
+    size_t off = CAPTURE_HEADER_SIZE;
+    while (off < (size_t)size) {
+        const unsigned char *p = data + off;
+        size_t avail = (size_t)size - off, n = 0;
+        unsigned long long delta, lat_ns, id64 = 0;
+        int k;
+        Booking b;
+        memset(&b, 0, sizeof(b));
+        if ((k = get_varint(p, avail, &delta)) < 0 || avail - (size_t)k < 2) break;
+        n = (size_t)k;
+        int cmd = p[n], want = p[n + 1];
+        n += 2;
+        if (cmd < CMD_LIST || cmd >= NUM_CMDS || (k = get_varint(p + n, avail - n, &lat_ns)) < 0) break;
+        n += (size_t)k;
+        if (avail - n < 4) break;
+        unsigned int want_digest = le32_get(p + n);
+        n += 4;
+        if (cmd == CMD_BOOK) k = unpack_booking(p + n, avail - n, &b);
+        else if (cmd != CMD_LIST) k = get_varint(p + n, avail - n, &id64);
+        else k = 0;
+        if (k < 0) break;
+        off += n + (size_t)k;
+
+        recorded_us += delta;
+        if (!fast) {
+            long long wait_ns = (long long)(t0 + recorded_us * 1000) - (long long)wall_ns();
+            if (wait_ns > 0) sleep_ms((int)(wait_ns / 1000000));
+        }
+        unsigned long long start = wall_ns();
+        int result = 0, avail_seats[MAX_TRAINS];
+        Booking found;
+        unsigned int digest;
+        if (cmd == CMD_LIST) {
+            train_availability(avail_seats);
+            digest = command_digest(cmd, 0, NULL, avail_seats);
+        } else if (cmd == CMD_BOOK) {
+            int captured_id = b.booking_id;
+            b.booking_id = 0;
+            result = place_booking(&b, NULL, NULL, 0);
+            if (result == BOOK_OK && captured_id) id_map_put(&ids, captured_id, b.booking_id);
+            digest = command_digest(cmd, result, &b, NULL);
+        } else if (cmd == CMD_SEARCH) {
+            result = search_by_id(id_map_get(&ids, (int)id64), &found);
+            digest = command_digest(cmd, result, &found, NULL);
+        } else {
+            result = cancel_by_id(id_map_get(&ids, (int)id64));
+            digest = command_digest(cmd, result, NULL, NULL);
+        }
+        long long lat = (long long)(wall_ns() - start);
+
+        CmdStats *s = &stats[cmd];
+        if (s->n == s->cap) {
+            s->cap = s->cap ? s->cap * 2 : 1024;
+            s->lat = (long long*)realloc(s->lat, sizeof(long long) * s->cap);
+            s->captured = (long long*)realloc(s->captured, sizeof(long long) * s->cap);
+        }
+        s->lat[s->n] = lat;
+        s->captured[s->n++] = (long long)lat_ns;
+        if (digest != want_digest && !differ++) {
+            int off_text = snprintf(first_diff, sizeof(first_diff), "command %lld (%s", commands + 1, command_names[cmd]);
+            if (cmd == CMD_SEARCH || cmd == CMD_CANCEL)
+                off_text += snprintf(first_diff + off_text, sizeof(first_diff) - off_text, " %llu", id64);
+            snprintf(first_diff + off_text, sizeof(first_diff) - off_text, "): result %d, captured %d%s", result, want,
+                     result == want ? ", contents differ" : "");
+        }
+        commands++;
+    }
+    double wall_s = (double)(wall_ns() - t0) / 1e9;
+    if (off < (size_t)size) printf("Warning: capture is truncated or damaged after %lld commands.\n", commands);
+
+    printf("replay: %lld commands from %s (%.1f s recorded), %s, %s store\n", commands, path,
+           recorded_us / 1e6, fast ? "as fast as possible" : "recorded pacing", fresh ? "fresh" : "current");
+    printf("  throughput %.1f commands/s over %.2f s\n", wall_s > 0 ? commands / wall_s : 0.0, wall_s);
+    printf("  %-8s %8s %9s %9s %9s %9s   captured p50/p99 us\n", "command", "count", "p50 us", "p90 us", "p99 us", "max us");
+    for (int c = CMD_LIST; c < NUM_CMDS; ++c) {
+        CmdStats *s = &stats[c];
+        if (!s->n) continue;
+        qsort(s->lat, s->n, sizeof(long long), cmp_ll);
+        qsort(s->captured, s->n, sizeof(long long), cmp_ll);
+        printf("  %-8s %8d %9.1f %9.1f %9.1f %9.1f   %.1f / %.1f\n", command_names[c], s->n,
+               percentile(s->lat, s->n, 50) / 1e3, percentile(s->lat, s->n, 90) / 1e3,
+               percentile(s->lat, s->n, 99) / 1e3, s->lat[s->n - 1] / 1e3,
+               percentile(s->captured, s->n, 50) / 1e3, percentile(s->captured, s->n, 99) / 1e3);
+        free(s->lat);
+        free(s->captured);
+    }
+    if (differ) printf("  digests: %lld of %lld commands answered differently; first at %s\n", differ, commands, first_diff);
+    else printf("  digests: all %lld commands answered as captured\n", commands);
+    if (atomic_load(&store->hitters)) print_hitters(5);
+    free(ids.from);
+    free(ids.to);
+    free(data);
+    free_all();
+    return differ ? 1 : 0;
+}
+
+/* ---------------- Consistency checker ----------------
+   railway_booking fsck [file]
+   Scans the booking file with several threads, each owning a contiguous range of
+   records (or of blocks, for compressed snapshots), and reports the byte offset of
+   every bad record. Checks:
+    - framing: file length is a whole number of records (a truncated tail is reported)
+      and matches the record count in the snapshot header
+    - record checksums (format version 3 and later)
+    - compressed snapshots: block framing, decompression and block checksums
+    - field values: id > 0, age 0..150, strings NUL-terminated, known train id
+    - duplicate booking ids across the whole file
+    - per-train booking counts against total_seats
+    - when checking bookings.dat: the journals next to it (entry checksums, repeated
+      sequence numbers); a torn last entry is an unconfirmed commit and only noted
+   Records of the legacy formats (0-2) carry no checksums, so only framing is verified for them.
+*/
+#define FSCK_BLOCK_RECORDS 4096
+#define FSCK_MAX_REPORTS 100
+
+typedef struct {
+    int booking_id;
+    int rec;                        /* record within a compressed block, -1 if uncompressed */
+    long long offset;
+} IdOffset;
+
+typedef struct {
+    const char *path;
+    const SnapshotInfo *si;
+    const SnapBlock *blocks;        /* compressed snapshots only */
+    long long first, count;         /* record (or block) range owned by this thread */
+    IdOffset *ids;                  /* one entry per record read */
+    long long nids;
+    int per_train[MAX_TRAINS];
+    long long bad;
+    long long reported;
+    char (*reports)[160];           /* first FSCK_MAX_REPORTS problems */
+    int io_error;
+} FsckWorker;
+
+int nul_terminated(const char *s, size_t cap) {
+    return memchr(s, '\0', cap) != NULL;
+}
+
+void format_location(char *buf, size_t n, long long off, int rec) {
+    if (rec < 0) snprintf(buf, n, "offset %lld", off);
+    else snprintf(buf, n, "block at offset %lld, record %d", off, rec);
+}
+
+void fsck_report(FsckWorker *w, long long off, int rec, const char *what) {
+    w->bad++;
+    if (w->reported < FSCK_MAX_REPORTS) {
+        char loc[64];
+        format_location(loc, sizeof(loc), off, rec);
+        snprintf(w->reports[w->reported++], 160, "%s: %s", loc, what);
+    }
+}
+
+/* Returns NULL if the record is sane, otherwise a description of the first problem */
+const char *check_booking_fields(const Booking *b) {
+    if (b->booking_id <= 0) return "non-positive booking_id";
+    if (!nul_terminated(b->passenger_name, sizeof(b->passenger_name))) return "passenger_name not terminated";
+    if (b->passenger_name[0] == '\0') return "empty passenger_name";
+    if (b->age < 0 || b->age > 150) return "age out of range";
+    if (!nul_terminated(b->gender, sizeof(b->gender))) return "gender not terminated";
+    if (!nul_terminated(b->travel_class, sizeof(b->travel_class))) return "travel_class not terminated";
+    if (!find_train(b->train_id)) return "unknown train_id";
+    if (b->journey_date != 0 && !valid_date(b->journey_date)) return "invalid journey_date";
+    return NULL;
+}
+
+void fsck_check_record(FsckWorker *w, const Booking *b, long long off, int rec) {
+    const char *err = check_booking_fields(b);
+    if (err) fsck_report(w, off, rec, err);
+    const Train *t = find_train(b->train_id);
+    if (t) w->per_train[t - store->trains]++;
+    w->ids[w->nids].booking_id = b->booking_id;
+    w->ids[w->nids].rec = rec;
+    w->ids[w->nids].offset = off;
+    w->nids++;
+}
+
+/* Compressed snapshots: each thread decodes and checks a run of blocks */
+void *fsck_block_worker(void *p) {
+    FsckWorker *w = (FsckWorker*)p;
+    FILE *fp = fopen(w->path, "rb");
+    if (!fp) { w->io_error = 1; return NULL; }
+    int rs = w->si->rec_size;
+    size_t cap = (size_t)rs * SNAP_BLOCK_RECORDS * 2;
+    unsigned char *payload = (unsigned char*)malloc(cap);
+    Booking rec;
+    for (long long i = w->first; i < w->first + w->count; ++i) {
+        const SnapBlock *sb = &w->blocks[i];
+        if ((size_t)sb->bh.comp_len + sb->bh.raw_len > cap) {
+            cap = (size_t)sb->bh.comp_len + sb->bh.raw_len;
+            payload = (unsigned char*)realloc(payload, cap);
+        }
+        unsigned char *raw = payload + sb->bh.comp_len;
+        if (rb_fseek(fp, sb->file_off + BLOCK_HEADER_SIZE, SEEK_SET) != 0 ||
+            fread(payload, 1, sb->bh.comp_len, fp) != sb->bh.comp_len) {
+            w->io_error = 1;
+            break;
+        }
+        if (read_block_payload(&sb->bh, payload, raw) != 0) {
+            char what[80];
+            snprintf(what, sizeof(what), "corrupt block or checksum mismatch (%u records lost)", sb->bh.records);
+            fsck_report(w, sb->file_off, -1, what);
+            continue;
+        }
+        for (unsigned int k = 0; k < sb->bh.records; ++k) {
+            if (decode_record(w->si->version, raw + (size_t)k * rs, &rec) != 0) {
+                fsck_report(w, sb->file_off, (int)k, "record checksum mismatch");
+                continue;
+            }
+            fsck_check_record(w, &rec, sb->file_off, (int)k);
+        }
+    }
+    free(payload);
+    fclose(fp);
+    return NULL;
+}
+
+void *fsck_worker(void *p) {
+    FsckWorker *w = (FsckWorker*)p;
+    FILE *fp = fopen(w->path, "rb");
+    if (!fp) { w->io_error = 1; return NULL; }
+    int rs = w->si->rec_size;
+    if (rb_fseek(fp, w->si->data_off + w->first * rs, SEEK_SET) != 0) {
+        w->io_error = 1;
+        fclose(fp);
+        return NULL;
+    }
+    unsigned char *buf = (unsigned char*)malloc((size_t)rs * FSCK_BLOCK_RECORDS);
+    long long done = 0;
+    Booking rec;
+    while (done < w->count) {
+        long long want = w->count - done;
+        if (want > FSCK_BLOCK_RECORDS) want = FSCK_BLOCK_RECORDS;
+        size_t got = fread(buf, (size_t)rs, (size_t)want, fp);
+        for (size_t i = 0; i < got; ++i) {
+            long long off = w->si->data_off + (w->first + done + (long long)i) * rs;
+            if (decode_record(w->si->version, buf + i * rs, &rec) != 0) {
+                fsck_report(w, off, -1, "record checksum mismatch");
+                continue;
+            }
+            fsck_check_record(w, &rec, off, -1);
+        }
+        done += (long long)got;
+        if ((long long)got < want) { w->io_error = 1; break; }
+    }
+    free(buf);
+    fclose(fp);
+    return NULL;
+}
+
+int cmp_id_offset(const void *a, const void *b) {
+    const IdOffset *x = (const IdOffset*)a, *y = (const IdOffset*)b;
+    if (x->booking_id != y->booking_id) return x->booking_id < y->booking_id ? -1 : 1;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return (x->rec > y->rec) - (x->rec < y->rec);
+}
+
+/* Check the journals that belong to bookings.dat. Returns the number of problems. */
+int fsck_journals(unsigned long long snap_seq) {
+    JournalEntry *arr = NULL;
+    int n = 0, cap = 0, files = 0, problems = 0;
+    for (int i = 0; i < MAX_JOURNALS; ++i) {
+        char path[256];
+        int torn;
+        journal_path(journal_prefix, i, path, sizeof(path));
+        if (file_size(path) < 0) continue;
+        files++;
+        long long bad = read_journal_file(path, &arr, &n, &cap, &torn);
+        if (bad >= 0 && torn) {
+            printf("  %s offset %lld: torn last entry (unconfirmed commit, ignored)\n", path, bad);
+        } else if (bad >= 0) {
+            printf("  %s offset %lld: bad entry, rest of journal unreadable\n", path, bad);
+            problems++;
+        }
+    }
+    qsort(arr, (size_t)n, sizeof(JournalEntry), cmp_journal_seq);
+    int pending = 0;
+    for (int i = 0; i < n; ++i) {
+        if (arr[i].seq > snap_seq) pending++;
+        if (i > 0 && arr[i].seq == arr[i-1].seq) {
+            printf("  journal seq %llu appears twice\n", arr[i].seq);
+            problems++;
+        }
+    }
+    if (files)
+        printf("journals: %d files, %d entries, %d newer than the snapshot (replayed at next start), %d problems\n",
+               files, n, pending, problems);
+    free(arr);
+    return problems;
+}
+
+/* Returns 0 if the file is clean, 1 if problems were found, 2 if it could not be read */
+int fsck_bookings(const char *path) {
+    long long size = file_size(path);
+    FILE *fp = size >= 0 ? fopen(path, "rb") : NULL;
+    if (!fp) {
+        printf("fsck: cannot open %s\n", path);
+        return 2;
+    }
+    SnapshotInfo si;
+    probe_snapshot(fp, size, &si);
+    if (si.rec_size == 0) {
+        printf("fsck: %s has unknown format version %d or a wrong record size\n", path, si.version);
+        fclose(fp);
+        return 2;
+    }
+    SnapBlock *blocks = NULL;
+    long long bad_off = -1;
+    long long units;                    // records, or blocks when compressed
+    if (snapshot_is_compressed(si.version)) {
+        int nblocks = scan_snapshot_blocks(fp, &si, size, &blocks, &bad_off);
+        si.count = nblocks ? blocks[nblocks-1].first_record + blocks[nblocks-1].bh.records : 0;
+        units = nblocks;
+    } else {
+        units = si.count;
+    }
+    fclose(fp);
+    long long nrec = si.count;
+    long long tail = si.tail;
+    int nthreads = env_int("RB_FSCK_THREADS", 4);
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > units) nthreads = units > 0 ? (int)units : 1;
+
+    long long start = now_ms();
+    FsckWorker *w = (FsckWorker*)calloc(nthreads, sizeof(FsckWorker));
+    pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    IdOffset *ids = (IdOffset*)malloc(sizeof(IdOffset) * (nrec > 0 ? nrec : 1));
+    long long per = units / nthreads, first = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        w[i].path = path;
+        w[i].si = &si;
+        w[i].blocks = blocks;
+        w[i].first = first;
+        w[i].count = per + (i < units % nthreads ? 1 : 0);
+        w[i].ids = ids + (blocks ? (first < units ? blocks[first].first_record : nrec) : first);
+        w[i].reports = malloc(sizeof(*w[i].reports) * FSCK_MAX_REPORTS);
+        first += w[i].count;
+        start_store_thread(&tids[i], blocks ? fsck_block_worker : fsck_worker, &w[i]);
+    }
+
+    long long bad = 0, nids = 0;
+    int per_train[MAX_TRAINS] = {0};
+    int io_error = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+        for (long long r = 0; r < w[i].reported; ++r) printf("  %s\n", w[i].reports[r]);
+        if (w[i].bad > w[i].reported)
+            printf("  ... %lld more bad %s in range %lld-%lld\n", w[i].bad - w[i].reported,
+                   blocks ? "blocks/records" : "records", w[i].first, w[i].first + w[i].count - 1);
+        bad += w[i].bad;
+        io_error |= w[i].io_error;
+        for (int t = 0; t < MAX_TRAINS; ++t) per_train[t] += w[i].per_train[t];
+        // worker ranges are contiguous, so compact the id arrays in place
+        memmove(ids + nids, w[i].ids, sizeof(IdOffset) * w[i].nids);
+        nids += w[i].nids;
+        free(w[i].reports);
+    }
+    long long elapsed = now_ms() - start;
+
+    if (tail) {
+        printf("  offset %lld: truncated record (%lld of %d bytes)\n",
+               si.data_off + nrec * si.rec_size, tail, si.rec_size);
+        bad++;
+    }
+    if (bad_off >= 0) {
+        printf("  offset %lld: broken block framing, rest of file unreadable\n", bad_off);
+        bad++;
+    }
+    if (si.header_count >= 0 && si.header_count != nrec) {
+        printf("  offset 0: header claims %lld records, file holds %lld\n", si.header_count, nrec);
+        bad++;
+    }
+
+    qsort(ids, (size_t)nids, sizeof(IdOffset), cmp_id_offset);
+    long long dups = 0;
+    for (long long i = 1; i < nids; ++i) {
+        if (ids[i].booking_id == ids[i-1].booking_id && ids[i].booking_id > 0) {
+            if (dups < FSCK_MAX_REPORTS) {
+                char loc[64], first_loc[64];
+                format_location(loc, sizeof(loc), ids[i].offset, ids[i].rec);
+                format_location(first_loc, sizeof(first_loc), ids[i-1].offset, ids[i-1].rec);
+                printf("  %s: duplicate booking_id %d (first seen at %s)\n", loc, ids[i].booking_id, first_loc);
+            }
+            dups++;
+        }
+    }
+
+    int overbooked = 0;
+    for (int t = 0; t < MAX_TRAINS; ++t) {
+        if (per_train[t] > store->trains[t].total_seats) {
+            printf("  train %d (%s): %d bookings exceed %d seats\n",
+                   store->trains[t].id, store->trains[t].name, per_train[t], store->trains[t].total_seats);
+            overbooked++;
+        }
+    }
+
+    double secs = elapsed > 0 ? elapsed / 1000.0 : 0.001;
+    printf("fsck %s (format v%d): %lld records, %lld bad, %lld duplicate ids, %d overbooked trains%s\n",
+           path, si.version, nrec, bad, dups, overbooked, io_error ? ", read errors" : "");
+    printf("  scanned %lld bytes in %lld ms with %d threads (%.1f MB/s)\n",
+           size, elapsed, nthreads, size / secs / (1024.0 * 1024.0));
+
+    char store_file[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, store_file, sizeof(store_file));
+    int journal_problems = strcmp(path, store_file) == 0 ? fsck_journals(si.seq) : 0;
+
+    free(ids);
+    free(tids);
+    free(w);
+    free(blocks);
+    if (io_error) return 2;
+    return (bad || dups || overbooked || journal_problems) ? 1 : 0;
+}
+
+/* ---------------- Migration ----------------
+   railway_booking migrate [src] [dst]
+   Rewrites a booking file of any format this build reads (the original raw struct
+   dump, versions 1-4, or the current ones) in the current format, one block at a
+   time, so memory use does not grow with the file. src and dst default to
+   bookings.dat; output goes to dst.tmp and is renamed into place once complete.
+   Output is SNAPSHOT_VERSION, or SNAPSHOT_VERSION_LZ with RB_COMPRESS set.
+   Like archive, it refuses to run while another process serves the store.
+*/
+int migrate_snapshot(const char *src, const char *dst) {
+    if (claim_store() != 0) {
+        printf("migrate: another process is serving this store; stop it first (%s%s is locked)\n",
+               store->dir, OWNER_LOCK_FILE);
+        return 1;
+    }
+    long long size = file_size(src);
+    FILE *fp = size >= 0 ? fopen(src, "rb") : NULL;
+    if (!fp) {
+        printf("migrate: cannot open %s\n", src);
+        return 1;
+    }
+    SnapshotInfo si;
+    probe_snapshot(fp, size, &si);
+    if (si.rec_size == 0) {
+        printf("migrate: %s has unknown format version %d\n", src, si.version);
+        fclose(fp);
+        return 1;
+    }
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    SnapshotWriter w;
+    if (snapshot_writer_open(&w, tmp, snapshot_compress) != 0) {
+        printf("migrate: cannot create %s\n", tmp);
+        fclose(fp);
+        return 1;
+    }
+
+    long long start = now_ms(), lost = 0;
+    int damaged = 0;
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    Booking *recs = NULL;
+    unsigned int recs_cap = 0;
+    if (snapshot_is_compressed(si.version)) {
+        long long off = si.data_off;
+        while (off < size && w.ok) {
+            unsigned char hdr[BLOCK_HEADER_SIZE];
+            SnapBlock sb;
+            if (rb_fseek(fp, off, SEEK_SET) != 0 || fread(hdr, sizeof(hdr), 1, fp) != 1) { damaged = 1; break; }
+            get_block_header(hdr, &sb.bh);
+            if (!block_framed(&sb.bh, si.rec_size, off, size)) { damaged = 1; break; }
+            sb.file_off = off;
+            sb.first_record = 0;
+            if (sb.bh.records > recs_cap) {
+                recs_cap = sb.bh.records;
+                recs = (Booking*)realloc(recs, sizeof(Booking) * recs_cap);
+            }
+            if (read_snapshot_block(fp, si.version, &sb, &buf, &cap, recs) != 0) damaged = 1;
+            for (unsigned int k = 0; k < sb.bh.records; ++k) {
+                if (recs[k].booking_id == 0) lost++;
+                else snapshot_writer_add(&w, &recs[k]);
+            }
+            off += BLOCK_HEADER_SIZE + sb.bh.comp_len;
+        }
+    } else {
+        recs = (Booking*)malloc(sizeof(Booking));
+        buf = (unsigned char*)malloc((size_t)si.rec_size * SNAP_BLOCK_RECORDS);
+        size_t got;
+        while (w.ok && (got = fread(buf, (size_t)si.rec_size, SNAP_BLOCK_RECORDS, fp)) > 0) {
+            for (size_t i = 0; i < got; ++i) {
+                if (decode_record(si.version, buf + i * si.rec_size, recs) != 0) lost++;
+                else snapshot_writer_add(&w, recs);
+            }
+        }
+        damaged = si.tail != 0;
+    }
+    fclose(fp);
+    free(buf);
+    free(recs);
+
+    long long migrated = w.count;
+    if (snapshot_writer_close(&w, si.seq) != 0 || replace_file(tmp, dst) != 0) {
+        remove(tmp);
+        printf("migrate: could not write %s\n", dst);
+        return 1;
+    }
+    char store_file[MAX_STORE_PATH], index_path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, store_file, sizeof(store_file));
+    store_path(INDEX_FILE, index_path, sizeof(index_path));
+    if (strcmp(dst, store_file) == 0) remove(index_path);      // records may have moved; rebuilt on the next load
+    long long elapsed = now_ms() - start;
+    double secs = elapsed > 0 ? elapsed / 1000.0 : 0.001;
+    printf("migrate: %s (format v%d) -> %s (format v%d): %lld records in %lld ms (%.1f MB/s)\n",
+           src, si.version, dst, snapshot_compress ? SNAPSHOT_VERSION_LZ : SNAPSHOT_VERSION,
+           migrated, elapsed, size / secs / (1024.0 * 1024.0));
+    if (damaged || lost)
+        printf("  source was damaged: %lld records could not be decoded; run 'fsck %s' for details\n", lost, src);
+    return damaged || lost ? 1 : 0;
+}
+
+/* ---------------- Hot backup ----------------
+   railway_booking backup <dest> [MB/s]
+   save_bookings() publishes each snapshot with a rename, so a descriptor opened on
+   bookings.dat keeps referring to one complete snapshot even while the booking
+   program goes on saving newer ones. The backup copies from such a descriptor.
+   On Linux it tries a reflink (FICLONE) first when unthrottled, then
+   copy_file_range(); elsewhere it falls back to a buffered copy.
+   The bandwidth limit (MB/s, 0 = unlimited) can also be set with RB_BACKUP_MBPS.
+   Commits made since the snapshot live in the journals; the backup adds them as
+   <dest>.journal, cut at the first missing sequence number so it describes one
+   point in time. If a checkpoint replaces bookings.dat meanwhile (and empties the
+   journals) the backup starts over. To restore, copy <dest> to bookings.dat and
+   <dest>.journal to journal_00.log.
+*/
+#define BACKUP_CHUNK (1024 * 1024)
+
+/* Sleep as needed so that `copied` bytes take at least copied/bps seconds since start */
+void throttle(long long start, long long copied, long long bps) {
+    if (bps <= 0) return;
+    long long due = start + copied * 1000 / bps;
+    long long now = now_ms();
+    if (due > now) sleep_ms((int)(due - now));
+}
+
+#ifndef _WIN32
+/* Copy len bytes between descriptors. Returns bytes copied, sets *method. */
+long long copy_fd(int in, int out, long long len, long long bps, const char **method) {
+    long long start = now_ms(), copied = 0;
+#ifdef __linux__
+#ifdef FICLONE
+    if (bps <= 0 && ioctl(out, FICLONE, in) == 0) {
+        *method = "reflink";
+        return len;
+    }
+#endif
+    *method = "copy_file_range";
+    while (copied < len) {
+        size_t want = (size_t)(len - copied < BACKUP_CHUNK ? len - copied : BACKUP_CHUNK);
+        ssize_t n = copy_file_range(in, NULL, out, NULL, want, 0);
+        if (n <= 0) break;
+        copied += n;
+        throttle(start, copied, bps);
+    }
+    if (copied == len) return copied;
+    // cross-filesystem or unsupported: finish with plain read/write
+    if (lseek(in, copied, SEEK_SET) < 0 || lseek(out, copied, SEEK_SET) < 0) return copied;
+#endif
+    *method = copied ? "copy_file_range+read/write" : "read/write";
+    char *buf = (char*)malloc(BACKUP_CHUNK);
+    while (copied < len) {
+        ssize_t n = read(in, buf, BACKUP_CHUNK);
+        if (n <= 0) break;
+        if (write(out, buf, (size_t)n) != n) break;
+        copied += n;
+        throttle(start, copied, bps);
+    }
+    free(buf);
+    return copied;
+}
+#endif
+
+/* Header seq of a snapshot file, or 0 if it has none */
+unsigned long long snapshot_seq_of(const char *path) {
+    long long size = file_size(path);
+    FILE *fp = size >= 0 ? fopen(path, "rb") : NULL;
+    if (!fp) return 0;
+    SnapshotInfo si;
+    probe_snapshot(fp, size, &si);
+    fclose(fp);
+    return si.seq;
+}
+
+/* Copy bookings.dat to dest. Returns 0 on success */
+int backup_snapshot(const char *dest, long long bps) {
+    char tmp[512], src[MAX_STORE_PATH];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dest);
+    store_path(BOOKINGS_FILE, src, sizeof(src));
+    long long start = now_ms(), len = 0, copied = 0;
+    const char *method = "stdio";
+#ifndef _WIN32
+    int in = open(src, O_RDONLY);
+    if (in < 0) {
+        printf("backup: cannot open %s\n", src);
+        return 1;
+    }
+    struct stat st;
+    fstat(in, &st);
+    len = (long long)st.st_size;
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        printf("backup: cannot create %s\n", tmp);
+        close(in);
+        return 1;
+    }
+    copied = copy_fd(in, out, len, bps, &method);
+    int ok = copied == len && fsync(out) == 0;
+    close(out);
+    close(in);
+#else
+    FILE *in = fopen(src, "rb");
+    if (!in) {
+        printf("backup: cannot open %s\n", src);
+        return 1;
+    }
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        printf("backup: cannot create %s\n", tmp);
+        fclose(in);
+        return 1;
+    }
+    char *buf = (char*)malloc(BACKUP_CHUNK);
+    size_t n;
+    while ((n = fread(buf, 1, BACKUP_CHUNK, in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) break;
+        copied += (long long)n;
+        throttle(start, copied, bps);
+    }
+    len = copied;
+    int ok = !ferror(in) && !ferror(out);
+    free(buf);
+    fclose(out);
+    fclose(in);
+#endif
+    if (!ok || replace_file(tmp, dest) != 0) {
+        remove(tmp);
+        printf("backup: failed after %lld of %lld bytes\n", copied, len);
+        return 1;
+    }
+    long long elapsed = now_ms() - start;
+    printf("backup: %s -> %s, %lld bytes in %lld ms via %s\n",
+           src, dest, len, elapsed, method);
+    return 0;
+}
+
+/* Write the journaled commits that follow the snapshot in dest to <dest>.journal.
+   Returns the number written, or -1 if bookings.dat was checkpointed meanwhile. */
+int backup_journal_tail(const char *dest) {
+    unsigned long long seq = snapshot_seq_of(dest);
+    JournalEntry *je;
+    int damaged;
+    int n = read_journals(journal_prefix, &je, &damaged);
+    char src[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, src, sizeof(src));
+    if (snapshot_seq_of(src) != seq) {
+        free(je);
+        return -1;
+    }
+    char path[512], tmp[520];
+    snprintf(path, sizeof(path), "%s.journal", dest);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    int count = 0, ok = fp != NULL;
+    unsigned long long next = seq + 1;
+    for (int i = 0; i < n && ok; ++i) {
+        if (je[i].seq < next) continue;     // already in the snapshot
+        if (je[i].seq != next) break;       // commit still in flight: stop at the gap
+        unsigned char e[JOURNAL_ENTRY_SIZE];
+        journal_encode(e, je[i].seq, je[i].op, &je[i].b);
+        ok = fwrite(e, sizeof(e), 1, fp) == 1;
+        count++;
+        next++;
+    }
+    if (fp && fclose(fp) != 0) ok = 0;
+    free(je);
+    if (!ok || (count ? replace_file(tmp, path) : remove(tmp)) != 0) {
+        remove(tmp);
+        printf("backup: could not write %s\n", path);
+        return 0;
+    }
+    if (!count) remove(path);
+    else printf("backup: %d journaled changes up to seq %llu -> %s\n", count, next - 1, path);
+    return count;
+}
+
+/* Returns 0 on success */
+int backup_bookings(const char *dest, long long bps) {
+    for (int attempt = 0; attempt < 5; ++attempt) {
+        if (backup_snapshot(dest, bps) != 0) return 1;
+        if (backup_journal_tail(dest) >= 0) return 0;
+        printf("backup: %s%s was checkpointed during the copy, starting over\n", store->dir, BOOKINGS_FILE);
+    }
+    return 1;
+}
+
+/* ---------------- Event log decoder ----------------
+   railway_booking events [file]
+   Prints an event log written with RB_EVENT_LOG as text, one event per line,
+   rings merged by timestamp.
+*/
+typedef struct {
+    Event ev;
+    long long pos;
+} DecodedEvent;
+
+int cmp_decoded_event(const void *a, const void *b) {
+    const DecodedEvent *x = (const DecodedEvent*)a, *y = (const DecodedEvent*)b;
+    if (x->ev.ts_ns != y->ev.ts_ns) return x->ev.ts_ns < y->ev.ts_ns ? -1 : 1;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+const char *booking_result_name(int r) {
+    static const char *names[] = {"ok", "no-train", "no-seats", "duplicate", "busy", "payment-failed", "hold-expired",
+                                  "quota", "velocity", "same-day", "fare-changed"};
+    return r >= 0 && r < (int)(sizeof(names) / sizeof(names[0])) ? names[r] : "?";
+}
+
+void format_event(const Event *ev, char *buf, size_t n) {
+    switch (ev->type) {
+    case EV_BOOKING:
+        snprintf(buf, n, "booking %s id=%d train=%d ref=%s", booking_result_name(ev->a[0]),
+                 ev->a[1], ev->a[2], ev->text[0] ? ev->text : "-");
+        break;
+    case EV_CANCEL:     snprintf(buf, n, "cancel id=%d", ev->a[0]); break;
+    case EV_CHECKPOINT: snprintf(buf, n, "checkpoint records=%d ms=%d seq=%u", ev->a[0], ev->a[1], (unsigned int)ev->a[2]); break;
+    case EV_RECOVERED:  snprintf(buf, n, "recovered journal_entries=%d discarded=%d", ev->a[0], ev->a[1]); break;
+    case EV_TICKET:     snprintf(buf, n, "ticket id=%d file=%s", ev->a[0], ev->text); break;
+    case EV_DROPPED:    snprintf(buf, n, "dropped events=%d", ev->a[0]); break;
+    case EV_LOAD_DONE:  snprintf(buf, n, "load-done records=%d ms=%d%s", ev->a[0], ev->a[1], ev->a[2] ? " damaged" : ""); break;
+    case EV_FARE_BAND:  snprintf(buf, n, "fare-band train=%d band=%d->%d fare=%s", ev->a[0], ev->a[1], ev->a[2], ev->text); break;
+    default:            snprintf(buf, n, "type%d %d %d %d %s", ev->type, ev->a[0], ev->a[1], ev->a[2], ev->text); break;
+    }
+}
+
+int decode_event_log(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("events: cannot open %s\n", path);
+        return 2;
+    }
+    unsigned char h[16];
+    if (fread(h, sizeof(h), 1, fp) != 1 || memcmp(h, EVENT_MAGIC, strlen(EVENT_MAGIC)) != 0 ||
+        le32_get(h + 8) != EVENT_VERSION || le32_get(h + 12) != EVENT_SIZE) {
+        printf("events: %s is not an event log\n", path);
+        fclose(fp);
+        return 2;
+    }
+    DecodedEvent *evs = NULL;
+    long long n = 0, cap = 0;
+    unsigned char p[EVENT_SIZE];
+    while (fread(p, sizeof(p), 1, fp) == 1) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            evs = (DecodedEvent*)realloc(evs, sizeof(DecodedEvent) * cap);
+        }
+        Event *ev = &evs[n].ev;
+        ev->ts_ns = le64_get(p);
+        ev->type = (unsigned short)(p[8] | p[9] << 8);
+        ev->ring = (unsigned short)(p[10] | p[11] << 8);
+        for (int i = 0; i < 3; ++i) ev->a[i] = (int)le32_get(p + 12 + 4 * i);
+        memcpy(ev->text, p + 24, sizeof(ev->text));
+        ev->text[sizeof(ev->text) - 1] = 0;
+        evs[n].pos = n;
+        n++;
+    }
+    fclose(fp);
+    qsort(evs, (size_t)n, sizeof(DecodedEvent), cmp_decoded_event);
+    for (long long i = 0; i < n; ++i) {
+        const Event *ev = &evs[i].ev;
+        time_t secs = (time_t)(ev->ts_ns / 1000000000ull);
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &secs);
+#else
+        localtime_r(&secs, &tm);
+#endif
+        char when[32], what[160];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        format_event(ev, what, sizeof(what));
+        printf("%s.%06u t%-3u %s\n", when, (unsigned int)(ev->ts_ns % 1000000000ull / 1000), ev->ring, what);
+    }
+    free(evs);
+    return 0;
+}
+
+/* ---------------- Serving ----------------
+   railway_booking serve [operator...] answers requests for many operators from one
+   process. Requests are read from stdin, one per line:
+     op|book|name|age|gender|train|class|YYYY-MM-DD[|fare]
+     op|cancel|id
+     op|search|id
+     op|list
+   where op is a tenant name or "-" for the default store. Operators named on the
+   command line are opened up front, others when their first request arrives. The
+   reader queues each request on its operator's store, and RB_WORKERS shared worker
+   threads take requests from the stores in turn, each switching its `store` to the
+   request's. One operator cannot crowd out the others:
+     - a store queues at most `queue` requests (tenant.conf); one that finds the
+       queue full is answered "busy" at once rather than holding up the reader
+     - at most `workers` (tenant.conf) workers serve one store at a time; by default
+       a store leaves one worker free for each other operator
+     - quota_mb and ops_per_sec are charged to the store's own counters
+   Each answer is one line on stdout, in completion order:
+     <input line>\t<op>\t<command>\t<result>[\t<details>]
+   At end of input the queues are drained, a summary per operator goes to stderr and
+   every store is saved. No ticket files are written.
+*/
+#define SERVE_LINE 256
+#define MAX_SERVE_WORKERS 64
+
+typedef struct ServeRequest {
+    long line;
+    long long queued_ns;
+    char text[SERVE_LINE];      /* the request after "op|" */
+} ServeRequest;
+
+/* Guards the queues, serve_stores and each store's active count */
+pthread_mutex_t serve_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t serve_cond = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t serve_out_lock = PTHREAD_MUTEX_INITIALIZER;
+Store *serve_stores[MAX_TENANTS];
+int num_serve_stores = 0;
+int serve_next = 0;             /* where the next worker starts looking */
+int serve_pending = 0;          /* requests queued on all stores */
+int serve_eof = 0;
+int serve_workers = 4;
+FILE *serve_out = NULL;         /* answers; NULL discards them (benchmarks) */
+
+/* Workers store s may use at once. Caller holds serve_lock. */
+int serve_cap(const Store *s) {
+    if (s->max_workers > 0) return s->max_workers;
+    int cap = serve_workers - (num_serve_stores - 1);
+    return cap > 0 ? cap : 1;
+}
+
+const char *serve_op_name(const Store *s) {
+    return s->name[0] ? s->name : "-";
+}
+
+void serve_reply(const char *op, long line, const char *text, const char *result) {
+    if (!serve_out) return;
+    size_t cmd = strcspn(text, "|");
+    pthread_mutex_lock(&serve_out_lock);
+    fprintf(serve_out, "%ld\t%s\t%.*s\t%s\n", line, op, (int)cmd, text, result);
+    fflush(serve_out);
+    pthread_mutex_unlock(&serve_out_lock);
+}
+
+/* Run one request against the calling thread's store and write its answer */
+void serve_request(const ServeRequest *r) {
+    char buf[SERVE_LINE], out[256];
+    snprintf(buf, sizeof(buf), "%s", r->text);
+    char *f[10], *p = buf;
+    int nf = 0;
+    while (nf < 10) {
+        f[nf++] = p;
+        p = strchr(p, '|');
+        if (!p) break;
+        *p++ = 0;
+    }
+    snprintf(out, sizeof(out), "invalid");
+    if (strcmp(f[0], "book") == 0 && (nf == 7 || nf == 8)) {
+        Booking bk;
+        memset(&bk, 0, sizeof(bk));
+        snprintf(bk.passenger_name, sizeof(bk.passenger_name), "%s", f[1]);
+        bk.age = atoi(f[2]);
+        int g = gender_id(f[3]), c = class_id(f[5]);
+        bk.train_id = atoi(f[4]);
+        int fare = nf == 8 ? atoi(f[7]) : 0;
+        if (f[1][0] && bk.age > 0 && g >= 0 && c >= 0 && parse_date(f[6], &bk.journey_date) &&
+            bk.journey_date >= today_date()) {
+            strcpy(bk.gender, gender_names[g]);
+            strcpy(bk.travel_class, class_codes[c]);
+            int result = place_booking(&bk, &fare, NULL, 0);
+            if (result == BOOK_OK) snprintf(out, sizeof(out), "ok\t%d\t%d", bk.booking_id, fare);
+            else if (result == BOOK_FARE_CHANGED) snprintf(out, sizeof(out), "fare-changed\t%d", fare);
+            else snprintf(out, sizeof(out), "%s", booking_result_name(result));
+        }
+    } else if (strcmp(f[0], "cancel") == 0 && nf == 2) {
+        snprintf(out, sizeof(out), "%s", cancel_by_id(atoi(f[1])) ? "canceled" : "not-found");
+    } else if (strcmp(f[0], "search") == 0 && nf == 2) {
+        Booking b;
+        int id = atoi(f[1]);
+        int where = find_booking(id, &b) ? 1 : archive_lookup(id, &b) ? 2 : 0;
+        if (where) {
+            char date[16];
+            format_date(b.journey_date, date, sizeof(date));
+            snprintf(out, sizeof(out), "found\t%s\t%d\t%s\t%s%s", b.passenger_name, b.train_id, b.travel_class,
+                     date, where == 2 ? "\tarchived" : "");
+        } else {
+            snprintf(out, sizeof(out), "not-found");
+        }
+    } else if (strcmp(f[0], "list") == 0 && nf == 1) {
+        int avail[MAX_TRAINS];
+        train_availability(avail);
+        size_t off = (size_t)snprintf(out, sizeof(out), "ok");
+        for (int t = 0; t < MAX_TRAINS && off < sizeof(out); ++t)
+            off += (size_t)snprintf(out + off, sizeof(out) - off, "\t%d:%d", store->trains[t].id, avail[t]);
+    }
+    serve_reply(serve_op_name(store), r->line, r->text, out);
+}
 
-    Node *cur = head;
-    while (cur) {
-        if (cur->b.booking_id == id) {
-            // print details
-            Train chosenTrain = {0};
-            for (int i = 0; i < MAX_TRAINS; ++i) {
-                if (trains[i].id == cur->b.train_id) { chosenTrain = trains[i]; break; }
+void *serve_worker(void *p) {
+    (void)p;
+    pthread_mutex_lock(&serve_lock);
+    for (;;) {
+        Store *s = NULL;
+        for (int k = 0; k < num_serve_stores && !s; ++k) {
+            Store *c = serve_stores[(serve_next + k) % num_serve_stores];
+            if (c->queue_len && c->active < serve_cap(c)) {
+                s = c;
+                serve_next = (serve_next + k + 1) % num_serve_stores;
             }
-            printf("\nBooking found:\n");
-            printf("Booking ID: %d\n", cur->b.booking_id);
-            printf("Name: %s\n", cur->b.passenger_name);
-            printf("Age: %d\n", cur->b.age);
-            printf("Gender: %s\n", cur->b.gender);
-            printf("Train: %s (%s -> %s)\n", chosenTrain.name, chosenTrain.from, chosenTrain.to);
-            printf("Class: %s\n", cur->b.travel_class);
-            return;
         }
-        cur = cur->next;
+        if (!s) {
+            if (serve_eof && !serve_pending) {
+                pthread_cond_broadcast(&serve_cond);    // workers left waiting behind a store's cap
+                break;
+            }
+            pthread_cond_wait(&serve_cond, &serve_lock);
+            continue;
+        }
+        ServeRequest r = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % s->queue_cap;
+        s->queue_len--;
+        serve_pending--;
+        s->active++;
+        pthread_mutex_unlock(&serve_lock);
+        store = s;
+        serve_request(&r);
+        long long latency = mono_ns() - r.queued_ns;
+        pthread_mutex_lock(&serve_lock);
+        s->active--;
+        if (s->served == s->latency_cap) {
+            long long cap = s->latency_cap ? s->latency_cap * 2 : 1024;
+            s->latency_ns = (long long*)realloc(s->latency_ns, sizeof(long long) * cap);
+            s->latency_cap = cap;
+        }
+        s->latency_ns[s->served++] = latency;
+        // this worker takes the freed slot itself, but a store that was at its cap
+        // may now be startable by an idle one
+        if (s->queue_len) pthread_cond_signal(&serve_cond);
     }
-    printf("Booking with ID %d not found.\n", id);
+    pthread_mutex_unlock(&serve_lock);
+    return NULL;
 }
 
-/* Cancel booking by ID */
-void cancel_booking() {
-    printf("\nEnter Booking ID to cancel: ");
-    int id;
-    if (scanf("%d", &id) != 1) {
-        printf("Invalid input.\n");
-        while (getchar() != '\n');
+/* Add a store to the ones the workers take requests from */
+void serve_add_store(Store *s) {
+    pthread_mutex_lock(&serve_lock);
+    s->queue = (ServeRequest*)calloc((size_t)s->queue_cap, sizeof(ServeRequest));
+    serve_stores[num_serve_stores++] = s;
+    pthread_mutex_unlock(&serve_lock);
+}
+
+/* The serving store for operator op ("-" = default store), opened on first use */
+Store *serve_attach(const char *op) {
+    const char *name = strcmp(op, "-") == 0 ? "" : op;
+    for (int i = 0; i < num_serve_stores; ++i)      // only the reader adds stores
+        if (strcmp(serve_stores[i]->name, name) == 0) return serve_stores[i];
+    if (open_tenant(name) != 0) return NULL;
+    serve_add_store(store);
+    return store;
+}
+
+/* Queue a request on s. Returns 0 if its queue is full. */
+int serve_submit(Store *s, long line, const char *text) {
+    pthread_mutex_lock(&serve_lock);
+    if (s->queue_len == s->queue_cap) {
+        s->rejected_busy++;
+        pthread_mutex_unlock(&serve_lock);
+        return 0;
+    }
+    ServeRequest *r = &s->queue[(s->queue_head + s->queue_len) % s->queue_cap];
+    r->line = line;
+    r->queued_ns = mono_ns();
+    snprintf(r->text, sizeof(r->text), "%s", text);
+    s->queue_len++;
+    serve_pending++;
+    pthread_cond_signal(&serve_cond);
+    pthread_mutex_unlock(&serve_lock);
+    return 1;
+}
+
+/* Start n workers (at most MAX_SERVE_WORKERS) */
+void serve_start(pthread_t *tids, int n) {
+    serve_workers = n;
+    serve_eof = 0;
+    for (int i = 0; i < n; ++i) pthread_create(&tids[i], NULL, serve_worker, NULL);
+}
+
+/* Let the workers drain every queue, then stop them */
+void serve_finish(pthread_t *tids, int n) {
+    pthread_mutex_lock(&serve_lock);
+    serve_eof = 1;
+    pthread_cond_broadcast(&serve_cond);
+    pthread_mutex_unlock(&serve_lock);
+    for (int i = 0; i < n; ++i) pthread_join(tids[i], NULL);
+}
+
+/* Median and 99th percentile latency of the requests s served (sorts the samples) */
+void serve_latency(Store *s, long long *p50, long long *p99) {
+    qsort(s->latency_ns, (size_t)s->served, sizeof(long long), cmp_ll);
+    *p50 = percentile(s->latency_ns, (int)s->served, 50);
+    *p99 = percentile(s->latency_ns, (int)s->served, 99);
+}
+
+/* Detach every store from the workers, dropping its queue and counters */
+void serve_remove_stores() {
+    for (int i = 0; i < num_serve_stores; ++i) {
+        Store *s = serve_stores[i];
+        free(s->queue);
+        free(s->latency_ns);
+        s->queue = NULL;
+        s->latency_ns = NULL;
+        s->queue_head = s->queue_len = 0;
+        s->served = s->rejected_busy = s->latency_cap = 0;
+    }
+    num_serve_stores = 0;
+    serve_next = 0;
+}
+
+/* railway_booking serve [operator...] */
+int serve(int argc, char **argv) {
+    int nworkers = env_int("RB_WORKERS", 4);
+    if (nworkers < 1) nworkers = 1;
+    if (nworkers > MAX_SERVE_WORKERS) nworkers = MAX_SERVE_WORKERS;
+    serve_out = stdout;
+    for (int i = 0; i < argc; ++i)
+        if (!serve_attach(argv[i])) return 1;
+    pthread_t tids[MAX_SERVE_WORKERS];
+    serve_start(tids, nworkers);
+    char line[SERVE_LINE + MAX_TENANT_NAME + 2];
+    long lineno = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        lineno++;
+        chomp(line);
+        if (line[0] == 0 || line[0] == '#') continue;
+        char *bar = strchr(line, '|');
+        if (bar) *bar = 0;
+        Store *s = bar ? serve_attach(line) : NULL;
+        if (!s) serve_reply(bar ? line : "?", lineno, bar ? bar + 1 : line, bar ? "unknown-operator" : "invalid");
+        else if (!serve_submit(s, lineno, bar + 1)) serve_reply(serve_op_name(s), lineno, bar + 1, "busy");
+    }
+    serve_finish(tids, nworkers);
+    for (int i = 0; i < num_serve_stores; ++i) {
+        Store *s = serve_stores[i];
+        long long p50, p99;
+        serve_latency(s, &p50, &p99);
+        fprintf(stderr, "serve: %s: %lld served, %lld busy, up to %d workers, latency p50 %.2f ms, p99 %.2f ms\n",
+                serve_op_name(s), s->served, s->rejected_busy, serve_cap(s), p50 / 1e6, p99 / 1e6);
+    }
+    serve_remove_stores();
+    close_stores();
+    return 0;
+}
+
+/* ---------------- Performance counters ----------------
+   With RB_PERF=1 benchmarks read hardware counters (perf_event_open, Linux) around
+   each measured phase and print them per operation under the phase's result line.
+   Counters are opened for the whole process with inherit set, so threads a phase
+   starts are included once joined; values are scaled when the kernel multiplexed
+   them. Counters the machine or kernel does not offer (VMs, perf_event_paranoid,
+   other systems) are shown as n/a or skipped; the benchmarks run the same either way.
+*/
+#define NUM_PERF_COUNTERS 6
+
+typedef struct {
+    int have[NUM_PERF_COUNTERS];
+    double value[NUM_PERF_COUNTERS];
+} PerfSample;
+
+const char *perf_names[NUM_PERF_COUNTERS] = {
+    "cycles", "instructions", "LLC-misses", "branch-misses", "dTLB-misses", "task-clock-ns"
+};
+int perf_enabled = 0;
+int perf_opened = 0;
+int perf_fds[NUM_PERF_COUNTERS];
+
+#ifdef __linux__
+void perf_open_all() {
+    static const struct { unsigned int type; unsigned long long config; } defs[NUM_PERF_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    };
+    int any = 0;
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        struct perf_event_attr a;
+        memset(&a, 0, sizeof(a));
+        a.size = sizeof(a);
+        a.type = defs[i].type;
+        a.config = defs[i].config;
+        a.disabled = 1;
+        a.inherit = 1;
+        a.exclude_kernel = 1;
+        a.exclude_hv = 1;
+        a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf_fds[i] = (int)syscall(__NR_perf_event_open, &a, 0, -1, -1, 0);
+        any |= perf_fds[i] >= 0;
+    }
+    if (!any) {
+        printf("(RB_PERF: no performance counters available here, continuing without)\n");
         return;
     }
-    while (getchar() != '\n');
+    int first = 1;
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] >= 0) continue;
+        printf("%s%s", first ? "(RB_PERF: not available here: " : ", ", perf_names[i]);
+        first = 0;
+    }
+    if (!first) printf(")\n");
+}
+#else
+void perf_open_all() {
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) perf_fds[i] = -1;
+    printf("(RB_PERF: performance counters need Linux, continuing without)\n");
+}
+#endif
 
-    Node *cur = head, *prev = NULL;
-    while (cur) {
-        if (cur->b.booking_id == id) {
-            // remove node
-            if (prev) prev->next = cur->next;
-            else head = cur->next;
-            free(cur);
-            save_bookings();
-            printf("Booking %d canceled successfully.\n", id);
-            return;
+void perf_begin() {
+    if (!perf_enabled) return;
+    if (!perf_opened) {
+        perf_open_all();
+        perf_opened = 1;
+    }
+#ifdef __linux__
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] < 0) continue;
+        ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void perf_end(PerfSample *s) {
+    memset(s, 0, sizeof(*s));
+    if (!perf_enabled) return;
+#ifdef __linux__
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] < 0) continue;
+        ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        unsigned long long v[3];    // value, time enabled, time running
+        if (read(perf_fds[i], v, sizeof(v)) != (ssize_t)sizeof(v) || v[2] == 0) continue;
+        s->have[i] = 1;
+        s->value[i] = (double)v[0] * ((double)v[1] / (double)v[2]);
+    }
+#endif
+}
+
+/* Print a sample as per-operation figures (nothing unless RB_PERF is set) */
+void perf_report(const PerfSample *s, long long ops) {
+    if (!perf_enabled) return;
+    if (ops < 1) ops = 1;
+    printf("      per op:");
+    int any = 0;
+    for (int i = 0; i < NUM_PERF_COUNTERS; ++i) {
+        if (perf_fds[i] < 0) continue;
+        any = 1;
+        if (s->have[i]) printf(" %s %.1f", perf_names[i], s->value[i] / ops);
+        else printf(" %s n/a", perf_names[i]);
+    }
+    if (s->have[0] && s->have[1] && s->value[0] > 0) printf("  IPC %.2f", s->value[1] / s->value[0]);
+    if (!any) printf(" no counters");
+    printf("\n");
+}
+
+/* ---------------- Benchmarks ----------------
+   Run with: railway_booking bench [name] [args...]
+   Benchmarks use an in-memory store and never read or write bookings.dat.
+*/
+typedef struct {
+    const char *name;
+    const char *usage;
+    int (*run)(int argc, char **argv);
+} Benchmark;
+
+typedef struct {
+    int tid;
+    int n;
+    int ok;
+    int failed;
+} PayBenchArg;
+
+void *pay_bench_worker(void *p) {
+    PayBenchArg *a = (PayBenchArg*)p;
+    for (int i = 0; i < a->n; ++i) {
+        Booking bk;
+        memset(&bk, 0, sizeof(bk));
+        snprintf(bk.passenger_name, sizeof(bk.passenger_name), "Bench Passenger %d-%d", a->tid, i);
+        bk.age = 30;
+        strcpy(bk.gender, "Other");
+        bk.train_id = store->trains[(a->tid + i) % MAX_TRAINS].id;
+        strcpy(bk.travel_class, "SL");
+        if (place_booking(&bk, NULL, NULL, 0) == BOOK_OK) a->ok++;
+        else a->failed++;
+    }
+    return NULL;
+}
+
+/* Concurrent bookings against a slow gateway. With no lock held during payment,
+   throughput scales with the number of threads instead of 1000/latency. */
+int bench_payment(int argc, char **argv) {
+    int nthreads = argc > 0 ? atoi(argv[0]) : 32;
+    int per_thread = argc > 1 ? atoi(argv[1]) : 10;
+    int latency = argc > 2 ? atoi(argv[2]) : 200;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MAX_HOLDS) nthreads = MAX_HOLDS;
+
+    sim_gateway.latency_ms = latency;
+    for (int i = 0; i < MAX_TRAINS; ++i) store->trains[i].total_seats = 1 << 30;
+
+    pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    PayBenchArg *args = (PayBenchArg*)calloc(nthreads, sizeof(PayBenchArg));
+    PerfSample ps;
+    perf_begin();
+    long long start = now_ms();
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].tid = i;
+        args[i].n = per_thread;
+        start_store_thread(&tids[i], pay_bench_worker, &args[i]);
+    }
+    int ok = 0, failed = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+        ok += args[i].ok;
+        failed += args[i].failed;
+    }
+    long long elapsed = now_ms() - start;
+    perf_end(&ps);
+    if (elapsed < 1) elapsed = 1;
+
+    printf("payment: %d threads x %d bookings, gateway latency %d ms\n", nthreads, per_thread, latency);
+    printf("  confirmed %d, failed %d in %lld ms\n", ok, failed, elapsed);
+    printf("  throughput %.1f bookings/s", ok * 1000.0 / elapsed);
+    if (latency > 0) printf(" (serialized bound %.1f bookings/s)", 1000.0 / latency);
+    printf("\n");
+    perf_report(&ps, ok + failed);
+    free(tids);
+    free(args);
+    return 0;
+}
+
+/* Commit throughput with one shared journal vs one journal per thread, then the
+   time to merge the journals back in sequence order. Journals go to bench_journal_NN.log. */
+int bench_journal(int argc, char **argv) {
+    int nthreads = argc > 0 ? atoi(argv[0]) : 8;
+    int per_thread = argc > 1 ? atoi(argv[1]) : 20000;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MAX_JOURNALS) nthreads = MAX_JOURNALS;
+    sim_gateway.latency_ms = 0;
+    sim_gateway.failure_pct = 0;
+    for (int i = 0; i < MAX_TRAINS; ++i) store->trains[i].total_seats = 1 << 30;
+    journal_prefix = "bench_journal_";
+    checkpoint_every = 0;
+    journal_enabled = 1;
+    persist_enabled = 1;
+    printf("journal: %d threads x %d commits%s\n", nthreads, per_thread, journal_fsync ? ", fsync per commit" : "");
+
+    int modes[2] = {1, nthreads};
+    for (int m = 0; m < 2 && (m == 0 || nthreads > 1); ++m) {
+        num_journals = modes[m];
+        if (journal_open_all() != 0) {
+            printf("  cannot create journal files\n");
+            break;
         }
-        prev = cur;
-        cur = cur->next;
+        pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+        PayBenchArg *args = (PayBenchArg*)calloc(nthreads, sizeof(PayBenchArg));
+        PerfSample ps;
+        perf_begin();
+        long long start = now_ms();
+        for (int i = 0; i < nthreads; ++i) {
+            args[i].tid = i;
+            args[i].n = per_thread;
+            start_store_thread(&tids[i], pay_bench_worker, &args[i]);
+        }
+        int ok = 0;
+        for (int i = 0; i < nthreads; ++i) {
+            pthread_join(tids[i], NULL);
+            ok += args[i].ok;
+        }
+        long long elapsed = now_ms() - start;
+        perf_end(&ps);
+        if (elapsed < 1) elapsed = 1;
+
+        JournalEntry *je;
+        int damaged;
+        long long t0 = now_ms();
+        int n = read_journals(journal_prefix, &je, &damaged);
+        long long merge = now_ms() - t0;
+        int ordered = 1;
+        for (int i = 1; i < n; ++i) if (je[i].seq <= je[i-1].seq) ordered = 0;
+        printf("  %2d journal%s  %8.0f commits/s   merge %d entries in %lld ms%s\n",
+               num_journals, num_journals == 1 ? " " : "s", ok * 1000.0 / elapsed, n, merge,
+               n == ok && ordered && !damaged ? "" : "  MISMATCH");
+        perf_report(&ps, ok);
+        free(je);
+        free(tids);
+        free(args);
+        journal_truncate_all();
+        journal_close_all();
+        for (int i = 0; i < num_journals; ++i) {
+            char path[256];
+            journal_path(journal_prefix, i, path, sizeof(path));
+            remove(path);
+        }
+        free_all();
     }
-    printf("Booking ID %d not found.\n", id);
+    persist_enabled = 0;
+    journal_prefix = JOURNAL_PREFIX;
+    return 0;
 }
 
-/* Free linked list on exit */
-void free_all() {
-    Node *cur = head;
-    while (cur) {
-        Node *tmp = cur;
-        cur = cur->next;
-        free(tmp);
+typedef struct {
+    int n;
+    int binary;
+    FILE *fp;
+} EventBenchArg;
+
+pthread_mutex_t event_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *event_bench_worker(void *p) {
+    EventBenchArg *a = (EventBenchArg*)p;
+    for (int i = 0; i < a->n; ++i) {
+        if (a->binary) {
+            log_event(EV_BOOKING, BOOK_OK, i, 2, "SIM-123456");
+        } else {
+            // what a status printf costs when threads share one stream
+            pthread_mutex_lock(&event_bench_lock);
+            fprintf(a->fp, "Booking successful! Booking ID: %d train %d ref %s\n", i, 2, "SIM-123456");
+            pthread_mutex_unlock(&event_bench_lock);
+        }
+    }
+    return NULL;
+}
+
+/* Cost per status line: shared-stream fprintf vs log_event() into per-thread rings */
+int bench_events(int argc, char **argv) {
+    int nthreads = argc > 0 ? atoi(argv[0]) : 8;
+    int per_thread = argc > 1 ? atoi(argv[1]) : 200000;
+    if (nthreads < 1) nthreads = 1;
+    if (events_enabled) {
+        printf("events: skipped, RB_EVENT_LOG is already active\n");
+        return 0;
+    }
+    const char *path = "bench_events.tmp";
+    printf("events: %d threads x %d status lines\n", nthreads, per_thread);
+    pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    EventBenchArg *args = (EventBenchArg*)calloc(nthreads, sizeof(EventBenchArg));
+    for (int binary = 0; binary <= 1; ++binary) {
+        FILE *fp = NULL;
+        if (binary) {
+            if (start_event_log(path) != 0) break;
+        } else if (!(fp = fopen(path, "w"))) {
+            break;
+        }
+        PerfSample ps;
+        perf_begin();
+        long long t0 = wall_ns();
+        for (int i = 0; i < nthreads; ++i) {
+            args[i].n = per_thread;
+            args[i].binary = binary;
+            args[i].fp = fp;
+            start_store_thread(&tids[i], event_bench_worker, &args[i]);
+        }
+        for (int i = 0; i < nthreads; ++i) pthread_join(tids[i], NULL);
+        long long ns = wall_ns() - t0;
+        perf_end(&ps);
+        if (binary) stop_event_log();
+        else fclose(fp);
+        long long size = file_size(path);
+        long long total = (long long)nthreads * per_thread;
+        if (binary) {
+            long long logged = (size - 16) / EVENT_SIZE;
+            printf("  %-16s %6.1f ns/line, %lld bytes", "log_event", (double)ns / total, size);
+            if (logged < total) printf(" (writer kept %lld, the rest were dropped on full rings)", logged);
+            printf("\n");
+        } else {
+            printf("  %-16s %6.1f ns/line, %lld bytes\n", "locked fprintf", (double)ns / total, size);
+        }
+        perf_report(&ps, total);
+        remove(path);
+    }
+    free(args);
+    free(tids);
+    return 0;
+}
+
+/* Cost of tracing a booking: untraced, one in 100 sampled, every booking traced */
+int bench_trace(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 200000;
+    if (n < 1) n = 1;
+    const char *path = "bench_trace.tmp";
+    static const int samples[] = { 0, 100, 1 };
+    for (int i = 0; i < MAX_TRAINS; ++i) store->trains[i].total_seats = 1 << 30;
+    printf("trace: %d bookings per mode, in memory\n", n);
+    for (int m = 0; m < 3; ++m) {
+        if (samples[m] && start_trace(path) != 0) break;
+        trace_sample = samples[m] ? samples[m] : 1;
+        trace_min_ns = 0;
+        PerfSample ps;
+        perf_begin();
+        long long t0 = mono_ns();
+        for (int i = 0; i < n; ++i) {
+            Booking bk;
+            memset(&bk, 0, sizeof(bk));
+            snprintf(bk.passenger_name, sizeof(bk.passenger_name), "Trace Passenger %d-%d", m, i);
+            bk.age = 30;
+            strcpy(bk.gender, "Other");
+            bk.train_id = store->trains[i % MAX_TRAINS].id;
+            strcpy(bk.travel_class, "SL");
+            TraceRequest tr;
+            TraceRequest *trace = trace_request_begin(&tr, "book_ticket");
+            int r = place_booking(&bk, NULL, NULL, 0);
+            trace_request_end(trace, bk.booking_id, r);
+        }
+        long long ns = mono_ns() - t0;
+        perf_end(&ps);
+        if (samples[m]) stop_trace();
+        if (!samples[m]) printf("  %-14s %7.1f ns/booking\n", "untraced", (double)ns / n);
+        else printf("  %-14s %7.1f ns/booking, %lld bytes of trace\n", samples[m] == 1 ? "all traced" : "1 in 100",
+                    (double)ns / n, file_size(path));
+        perf_report(&ps, n);
+    }
+    remove(path);
+    free_all();
+    return 0;
+}
+
+typedef struct {
+    int n;
+    int leased;
+    int *ids;
+} IdBenchArg;
+
+pthread_mutex_t id_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+int id_bench_counter = 1;
+
+void *id_bench_worker(void *p) {
+    IdBenchArg *a = (IdBenchArg*)p;
+    for (int i = 0; i < a->n; ++i) {
+        if (a->leased) {
+            a->ids[i] = allocate_booking_id();
+        } else {
+            pthread_mutex_lock(&id_bench_lock);
+            a->ids[i] = id_bench_counter++;
+            pthread_mutex_unlock(&id_bench_lock);
+        }
+    }
+    return NULL;
+}
+
+/* Id allocation from one locked counter vs per-thread leased blocks */
+int bench_ids(int argc, char **argv) {
+    int nthreads = argc > 0 ? atoi(argv[0]) : 8;
+    int per_thread = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (nthreads < 1) nthreads = 1;
+    printf("ids: %d threads x %d ids, lease block %d\n", nthreads, per_thread, id_block);
+    int *ids = (int*)malloc(sizeof(int) * (size_t)nthreads * per_thread);
+    pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * nthreads);
+    IdBenchArg *args = (IdBenchArg*)calloc(nthreads, sizeof(IdBenchArg));
+    for (int leased = 0; leased <= 1; ++leased) {
+        PerfSample ps;
+        perf_begin();
+        long long start = now_ms();
+        for (int i = 0; i < nthreads; ++i) {
+            args[i].n = per_thread;
+            args[i].leased = leased;
+            args[i].ids = ids + (size_t)i * per_thread;
+            start_store_thread(&tids[i], id_bench_worker, &args[i]);
+        }
+        for (int i = 0; i < nthreads; ++i) pthread_join(tids[i], NULL);
+        long long elapsed = now_ms() - start;
+        perf_end(&ps);
+        if (elapsed < 1) elapsed = 1;
+        long long total = (long long)nthreads * per_thread;
+        qsort(ids, (size_t)total, sizeof(int), cmp_int);
+        long long dups = 0;
+        for (long long i = 1; i < total; ++i) if (ids[i] == ids[i-1]) dups++;
+        printf("  %-14s %8.1f M ids/s%s\n", leased ? "leased blocks" : "locked counter",
+               total / 1000.0 / elapsed, dups ? "  DUPLICATES" : "");
+        perf_report(&ps, total);
+    }
+    free(args);
+    free(tids);
+    free(ids);
+    return 0;
+}
+
+/* Accounts the synthetic bookings are spread over (0 = no owners) */
+int synthetic_owners = 0;
+
+/* Fill the in-memory store with n synthetic bookings (benchmarks only) */
+void make_synthetic_bookings(int n) {
+    static const char *first[] = {"Aarav", "Priya", "Rahul", "Ananya", "Vikram", "Sneha", "Arjun",
+                                  "Kavya", "Rohan", "Isha", "Aditya", "Meera", "Karan", "Pooja"};
+    static const char *last[] = {"Sharma", "Patel", "Iyer", "Reddy", "Das", "Barik", "Nair",
+                                 "Gupta", "Singh", "Mehta", "Khan", "Joshi", "Rao", "Bose"};
+    static const char *genders[] = {"Male", "Female", "Other"};
+    static const char *classes[] = {"SL", "3A", "2A", "1A", "CC"};
+    unsigned int r = 12345;
+    for (int i = 0; i < n; ++i) {
+        Node *node = (Node*)rb_malloc(MEM_BOOKINGS, sizeof(Node));
+        memset(&node->b, 0, sizeof(node->b));
+        r = r * 1103515245u + 12345u;
+        Booking *b = &node->b;
+        b->booking_id = store->next_booking_id++;
+        snprintf(b->passenger_name, sizeof(b->passenger_name), "%s %s",
+                 first[(r >> 8) % 14], last[(r >> 16) % 14]);
+        b->age = 5 + (int)((r >> 4) % 80);
+        strcpy(b->gender, genders[(r >> 12) % 3]);
+        b->train_id = store->trains[(r >> 20) % MAX_TRAINS].id;
+        strcpy(b->travel_class, classes[(r >> 24) % 5]);
+        b->journey_date = 20250101 + (int)((r >> 6) % 28);
+        if (synthetic_owners > 0) b->owner_id = 1 + (int)((r ^ (r >> 13)) % (unsigned int)synthetic_owners);
+        node->next = store->head;
+        store->head = node;
+        index_insert(node);
+    }
+}
+
+/* Completion latency on a synthetic dictionary: prefixes of real names, and the same
+   prefixes with one character replaced */
+int bench_stations(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 10000;
+    int queries = argc > 1 ? atoi(argv[1]) : 200000;
+    if (n < 1) n = 1;
+    if (queries < 1) queries = 1;
+    static const char *syl[] = {"ka", "ra", "ma", "na", "pa", "la", "sa", "ta", "va", "ha", "ja", "da",
+                                "ki", "ri", "mi", "ni", "pi", "li", "su", "tu", "vu", "ho", "jo", "do",
+                                "ban", "gar", "pur", "nag", "kot", "dev", "ram", "shi"};
+    static const char *suffix[] = {"", "pur", "nagar", "abad", "garh", "ganj", " Road", " Junction", " Cantt", " City"};
+    char (*names)[MAX_STATION_NAME] = malloc(sizeof(*names) * n);
+    const char **ptrs = (const char**)malloc(sizeof(char*) * n);
+    long long *traffic = (long long*)malloc(sizeof(long long) * n);
+    unsigned int r = 2024;
+    for (int i = 0; i < n; ++i) {
+        int len = 0, parts = 2 + (int)((r >> 7) % 3);
+        for (int p = 0; p < parts; ++p) {
+            r = r * 1103515245u + 12345u;
+            len += snprintf(names[i] + len, MAX_STATION_NAME - len, "%s", syl[(r >> 10) % 32]);
+        }
+        r = r * 1103515245u + 12345u;
+        snprintf(names[i] + len, MAX_STATION_NAME - len, "%s", suffix[(r >> 12) % 10]);
+        names[i][0] = (char)toupper((unsigned char)names[i][0]);
+        ptrs[i] = names[i];
+        traffic[i] = 1000000 / (1 + (long long)((r >> 3) % (unsigned int)n));   // a few busy stations, a long tail
+    }
+    StationIndex ix;
+    long long t0 = mono_ns();
+    build_station_index(&ix, ptrs, traffic, n);
+    long long build = mono_ns() - t0;
+    printf("stations: %d names (%d distinct), %d trie nodes, built in %.1f ms\n", n, ix.count, ix.num_nodes, build / 1e6);
+
+    long long *lat = (long long*)malloc(sizeof(long long) * queries);
+    for (int typo = 0; typo <= 1; ++typo) {
+        long long results = 0, total = 0;
+        PerfSample ps;
+        perf_begin();
+        for (int i = 0; i < queries; ++i) {
+            r = r * 1103515245u + 12345u;
+            const char *key = ix.labels + ix.key_off[(r >> 8) % (unsigned int)ix.count];
+            char q[MAX_NAME];
+            int len = (int)strlen(key), plen = 1 + (int)((r >> 20) % 8);
+            if (plen > len) plen = len;
+            if (typo && plen < STATION_FUZZY_MIN) plen = len < STATION_FUZZY_MIN ? len : STATION_FUZZY_MIN;
+            memcpy(q, key, (size_t)plen);
+            q[plen] = 0;
+            if (typo) q[(r >> 4) % (unsigned int)plen] = (char)('a' + (r >> 12) % 26);
+            int out[10], exact;
+            long long s = mono_ns();
+            results += complete_station(&ix, q, 10, out, &exact);
+            lat[i] = mono_ns() - s;
+            total += lat[i];
+        }
+        perf_end(&ps);
+        qsort(lat, (size_t)queries, sizeof(long long), cmp_ll);
+        printf("  %-14s %7.0f ns/query, p99 %6.0f ns, max %7.0f ns, %.1f results per query\n",
+               typo ? "one typo" : "exact prefix", (double)total / queries, (double)percentile(lat, queries, 99),
+               (double)lat[queries - 1], (double)results / queries);
+        perf_report(&ps, queries);
+    }
+    free(lat);
+    free_station_index(&ix);
+    free(traffic);
+    free(ptrs);
+    free(names);
+    return 0;
+}
+
+/* Check every code table is collision-free, then time lookups of typed values against
+   the text comparison scan they replace */
+int bench_codes(int argc, char **argv) {
+    int lookups = argc > 0 ? atoi(argv[0]) : 10000000;
+    if (lookups < 1) lookups = 1;
+    static const CodeTable *tables[] = {&class_table, &gender_table, &station_table};
+    static const char *table_names[] = {"classes", "genders", "stations"};
+    int bad = 0;
+    for (int t = 0; t < 3; ++t) {
+        int used = 0;
+        for (int i = 0; i < 1 << tables[t]->bits; ++i) {
+            const CodeSlot *slot = &tables[t]->slots[i];
+            if (!slot->key) continue;
+            used++;
+            unsigned int h = code_hash(slot->key, strlen(slot->key), tables[t]->seed) >> (32 - tables[t]->bits);
+            if ((int)h != i) {
+                printf("codes: '%s' hashes to slot %u, stored in %d\n", slot->key, h, i);
+                bad = 1;
+            }
+        }
+        printf("codes: %-8s %2d keys in %2d slots, seed 0x%x\n", table_names[t], used, 1 << tables[t]->bits, tables[t]->seed);
+    }
+    if (bad) return 1;
+
+    static const char *typed[] = {"SL", "3A", "2a", "1A", "CC", " Sleeper", "EC", "XX",
+                                  "Male", "female", "O", "NDLS", "Pune", "Lucknow", "sbc", "Goa"};
+    int ntyped = (int)(sizeof(typed) / sizeof(typed[0]));
+    unsigned int r = 7;
+    long long hits = 0;
+    PerfSample ps;
+    perf_begin();
+    long long t0 = mono_ns();
+    for (int i = 0; i < lookups; ++i) {
+        r = r * 1103515245u + 12345u;
+        const char *s = typed[(r >> 8) % (unsigned int)ntyped];
+        hits += class_id(s) >= 0 || gender_id(s) >= 0 || station_id(s) >= 0;
+    }
+    long long hashed = mono_ns() - t0;
+    perf_end(&ps);
+    printf("  %-14s %6.1f ns/lookup (%lld of %d known)\n", "perfect hash", (double)hashed / lookups, hits, lookups);
+    perf_report(&ps, lookups);
+
+    hits = 0;
+    perf_begin();
+    t0 = mono_ns();
+    for (int i = 0; i < lookups; ++i) {
+        r = r * 1103515245u + 12345u;
+        const char *s = typed[(r >> 8) % (unsigned int)ntyped];
+        int found = 0;
+        for (int c = 0; c < NUM_CLASSES && !found; ++c) found = equalstr_nospaces_case(s, class_codes[c]);
+        for (int g = 0; g < NUM_GENDERS && !found; ++g) found = equalstr_nospaces_case(s, gender_names[g]);
+        for (int st = 0; st < NUM_STATION_CODES && !found; ++st)
+            found = equalstr_nospaces_case(s, station_codes[st].code) || equalstr_nospaces_case(s, station_codes[st].name);
+        hits += found;
+    }
+    long long scanned = mono_ns() - t0;
+    perf_end(&ps);
+    printf("  %-14s %6.1f ns/lookup (%lld of %d known)\n", "text scan", (double)scanned / lookups, hits, lookups);
+    perf_report(&ps, lookups);
+    return 0;
+}
+
+/* Listing one account's bookings through its owner list vs walking the whole list,
+   as the store grows with the number of bookings per account fixed */
+int bench_owners(int argc, char **argv) {
+    static char *defaults[] = { "100000", "1000000", "4000000" };
+    int per_user = 4, lookups = 2000;
+    if (argc == 0) {
+        argc = 3;
+        argv = defaults;
+    }
+    for (int a = 0; a < argc; ++a) {
+        int n = atoi(argv[a]);
+        if (n < 1) continue;
+        free_all();
+        synthetic_owners = n / per_user > 0 ? n / per_user : 1;
+        make_synthetic_bookings(n);
+        unsigned int r = 31337;
+        long long found = 0;
+        PerfSample ps;
+        perf_begin();
+        long long t0 = mono_ns();
+        for (int i = 0; i < lookups; ++i) {
+            r = r * 1103515245u + 12345u;
+            int user = 1 + (int)((r >> 8) % (unsigned int)synthetic_owners);
+            const OwnerList *l = user < store->owner_lists_cap ? &store->owner_lists[user] : NULL;
+            for (int k = 0; l && k < l->n; ++k) found += index_lookup(l->ids[k]) != NULL;
+        }
+        long long indexed = mono_ns() - t0;
+        perf_end(&ps);
+        printf("owners: %d bookings over %d accounts\n", n, synthetic_owners);
+        printf("  %-12s %9.0f ns/listing, %.1f bookings each\n", "owner list", (double)indexed / lookups, (double)found / lookups);
+        perf_report(&ps, lookups);
+
+        int walks = 20;
+        found = 0;
+        perf_begin();
+        t0 = mono_ns();
+        for (int i = 0; i < walks; ++i) {
+            r = r * 1103515245u + 12345u;
+            int user = 1 + (int)((r >> 8) % (unsigned int)synthetic_owners);
+            for (Node *c = store->head; c; c = c->next) found += c->b.owner_id == user;
+        }
+        long long walked = mono_ns() - t0;
+        perf_end(&ps);
+        printf("  %-12s %9.0f ns/listing, %.1f bookings each\n", "list walk", (double)walked / walks, (double)found / walks);
+        perf_report(&ps, walks);
+    }
+    synthetic_owners = 0;
+    free_all();
+    return 0;
+}
+
+/* Velocity checks under attack traffic: many distinct names hammering one train,
+   with a few repeat offenders mixed in that must keep being caught */
+int bench_velocity(int argc, char **argv) {
+    int keys = argc > 0 ? atoi(argv[0]) : 1000000;
+    int checks = argc > 1 ? atoi(argv[1]) : 4000000;
+    if (keys < 1) keys = 1;
+    if (checks < 1) checks = 1;
+    Booking b;
+    memset(&b, 0, sizeof(b));
+    b.train_id = store->trains[0].id;
+    unsigned int r = 4242;
+    long long admitted = 0, repeat_admitted = 0, repeats = 0;
+    long long ev0 = store->velocity_evictions, rej0 = store->velocity_rejects;
+    PerfSample ps;
+    perf_begin();
+    long long t0 = mono_ns(), now = now_ms();
+    for (int i = 0; i < checks; ++i) {
+        r = r * 1103515245u + 12345u;
+        int repeat = (r >> 4) % 16 == 0;    // 1 in 16 from one of 8 touts
+        int who = repeat ? (int)((r >> 8) % 8) : 8 + (int)((r >> 8) % (unsigned int)keys);
+        snprintf(b.passenger_name, sizeof(b.passenger_name), "Passenger %d", who);
+        pthread_mutex_lock(&store->lock);
+        int ok = velocity_admit(&b, now);
+        pthread_mutex_unlock(&store->lock);
+        admitted += ok;
+        repeats += repeat;
+        repeat_admitted += repeat && ok;
+    }
+    long long elapsed = mono_ns() - t0;
+    perf_end(&ps);
+    printf("velocity: %d checks over %d names, %d slots (%.1f MB)\n", checks, keys, VELOCITY_SLOTS,
+           (double)VELOCITY_SLOTS * sizeof(VelocitySlot) / (1024 * 1024));
+    printf("  %6.1f ns/check, %lld admitted, %lld rejected, %lld live counters evicted\n",
+           (double)elapsed / checks, admitted, store->velocity_rejects - rej0, store->velocity_evictions - ev0);
+    printf("  touts: %lld attempts, %lld admitted (limit %d each)\n", repeats, repeat_admitted, velocity_name_limit);
+    perf_report(&ps, checks);
+    return 0;
+}
+
+/* Accounted bytes per booking (list nodes plus indexes) at several store sizes */
+int bench_memory(int argc, char **argv) {
+    static char *defaults[] = { "1000000", "10000000" };
+    if (argc == 0) {
+        argc = 2;
+        argv = defaults;
+    }
+    for (int a = 0; a < argc; ++a) {
+        int n = atoi(argv[a]);
+        if (n < 1) continue;
+        free_all();
+        mem_reset_peaks();
+        long long rss0 = process_rss();
+        long long t0 = now_ms();
+        make_synthetic_bookings(n);
+        long long elapsed = now_ms() - t0;
+        long long rss = process_rss();
+        long long live = atomic_load(&mem_total.live), peak = atomic_load(&mem_total.peak);
+        printf("memory: %d bookings built in %lld ms\n", n, elapsed);
+        printf("  %-10s %7.1f bytes/booking live (nodes %.1f, indexes %.1f), %.1f at peak\n", "accounted",
+               (double)live / n, (double)atomic_load(&mem_tags[MEM_BOOKINGS].live) / n,
+               (double)atomic_load(&mem_tags[MEM_INDEXES].live) / n, (double)peak / n);
+        if (rss >= 0 && rss0 >= 0)
+            printf("  %-10s %7.1f bytes/booking (includes allocator overhead)\n", "RSS growth", (double)(rss - rss0) / n);
+    }
+    free_all();
+    return 0;
+}
+
+/* Random id lookups: find_booking() one at a time vs find_bookings() in batches */
+int bench_multiget(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 1000000;
+    int batch = argc > 1 ? atoi(argv[1]) : 256;
+    int lookups = argc > 2 ? atoi(argv[2]) : 4000000;
+    if (n < 1) n = 1;
+    if (batch < 1) batch = 1;
+    int first = store->next_booking_id;
+    make_synthetic_bookings(n);
+    int *ids = (int*)malloc(sizeof(int) * lookups);
+    unsigned int r = 99991;
+    for (int i = 0; i < lookups; ++i) {
+        r = r * 1103515245u + 12345u;
+        ids[i] = first + (int)((r >> 4) % (unsigned int)n);
+    }
+    Booking *out = (Booking*)malloc(sizeof(Booking) * batch);
+    unsigned char *found = (unsigned char*)malloc((size_t)batch);
+    printf("multiget: %d lookups of random ids among %d bookings, batch %d\n", lookups, n, batch);
+
+    // the list walk find_booking() used before the id index, for a handful of ids
+    PerfSample pw, p1, p2;
+    int walks = lookups < 200 ? lookups : 200;
+    long long walk_hits = 0;
+    perf_begin();
+    long long t0 = now_ms();
+    for (int i = 0; i < walks; ++i)
+        for (Node *c = store->head; c; c = c->next)
+            if (c->b.booking_id == ids[i]) { walk_hits++; break; }
+    long long walk = now_ms() - t0;
+    perf_end(&pw);
+
+    perf_begin();
+    t0 = now_ms();
+    long long hits1 = 0;
+    for (int i = 0; i < lookups; ++i) hits1 += find_booking(ids[i], &out[0]);
+    long long single = now_ms() - t0;
+    perf_end(&p1);
+
+    perf_begin();
+    t0 = now_ms();
+    long long hits2 = 0;
+    for (int i = 0; i < lookups; i += batch) {
+        int m = lookups - i < batch ? lookups - i : batch;
+        hits2 += find_bookings(ids + i, m, out, found);
+    }
+    long long batched = now_ms() - t0;
+    perf_end(&p2);
+    if (walk < 1) walk = 1;
+    if (single < 1) single = 1;
+    if (batched < 1) batched = 1;
+    printf("  list walk     %8.4f M lookups/s (%d lookups)%s\n", walks / 1000.0 / walk, walks,
+           walk_hits == walks ? "" : "  MISMATCH");
+    perf_report(&pw, walks);
+    printf("  one at a time %8.2f M lookups/s\n", lookups / 1000.0 / single);
+    perf_report(&p1, lookups);
+    printf("  batched       %8.2f M lookups/s (%.2fx)%s\n", lookups / 1000.0 / batched,
+           (double)single / batched, hits1 == hits2 && hits1 == lookups ? "" : "  MISMATCH");
+    perf_report(&p2, lookups);
+    free(found);
+    free(out);
+    free(ids);
+    free_all();
+    return 0;
+}
+
+/* Snapshot size and load speed, plain vs LZ-compressed */
+int bench_compress(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 500000;
+    const char *path = "bench_snapshot.tmp";
+    int threads = load_threads;
+    make_synthetic_bookings(n);
+    printf("compress: %d synthetic bookings (%d bytes each in memory)\n", n, (int)sizeof(Booking));
+    long long plain_size = 0;
+    for (int c = 0; c <= 1; ++c) {
+        long long t0 = now_ms();
+        if (write_snapshot(path, c, 1) != 0) {
+            printf("  could not write %s\n", path);
+            break;
+        }
+        long long t1 = now_ms();
+        long long size = file_size(path);
+        if (!c) plain_size = size;
+        for (int lt = 1; lt <= threads; lt = lt < threads ? threads : threads + 1) {
+            load_threads = lt;
+            Booking *arr;
+            long long got;
+            int damaged;
+            PerfSample ps;
+            perf_begin();
+            long long t2 = now_ms();
+            read_snapshot(path, &arr, &got, &damaged);
+            long long t3 = now_ms() - t2;
+            perf_end(&ps);
+            free(arr);
+            printf("  %-5s size %9lld bytes (ratio %.2f)  save %4lld ms  load %4lld ms with %d thread%s (%.0f MB/s)%s\n",
+                   c ? "lz" : "plain", size, plain_size ? (double)plain_size / size : 1.0, t1 - t0, t3, lt,
+                   lt > 1 ? "s" : " ", (double)got * sizeof(Booking) / (t3 > 0 ? t3 : 1) / 1000.0,
+                   damaged || got != n ? " DAMAGED" : "");
+            perf_report(&ps, got);
+            if (!c) break;      // plain snapshots are read sequentially
+        }
+    }
+    load_threads = threads;
+    remove(path);
+    free_all();
+    return 0;
+}
+
+/* Startup cost of the indexes: rebuild from the loaded list vs attach bookings.idx */
+int bench_restart(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 1000000;
+    const char *path = "bench_index.tmp";
+    make_synthetic_bookings(n);
+    renumber_ordinals();
+    if (write_index_file(path, 1, n) != 0) {
+        printf("restart: could not write %s\n", path);
+        free_all();
+        return 1;
+    }
+    printf("restart: %d bookings, index file %lld bytes\n", n, file_size(path));
+
+    PerfSample pr, pa;
+    perf_begin();
+    long long t0 = now_ms();
+    reset_indexes();
+    for (Node *c = store->head; c; c = c->next) index_insert(c);
+    long long rebuild = now_ms() - t0;
+    perf_end(&pr);
+
+    reset_indexes();
+    perf_begin();
+    t0 = now_ms();
+    int next_id;
+    int ok = attach_index_file(path, 1, n, &next_id);
+    unsigned int pos = 0;
+    for (Node *c = store->head; c; c = c->next) set_ordinal(pos++, c);
+    long long attach = now_ms() - t0;
+    perf_end(&pa);
+
+    // the attached tables must answer like rebuilt ones
+    int bad = 0;
+    for (Node *c = store->head; c; c = c->next)
+        if (index_lookup(c->b.booking_id) != c || !dup_find(dup_key(&c->b)) ||
+            (trip_key(&c->b) && !trip_find(trip_key(&c->b)))) bad++;
+    printf("  rebuild %5lld ms   attach %5lld ms%s%s\n", rebuild, attach,
+           ok ? "" : " (attach failed, not little-endian?)", bad ? "  MISMATCH" : "");
+    if (perf_enabled) {
+        printf("    rebuild\n");
+        perf_report(&pr, n);
+        printf("    attach\n");
+        perf_report(&pa, n);
+    }
+    remove(path);
+    free_all();
+    return 0;
+}
+
+
+typedef struct {
+    int tid;
+    int n;
+    int names;
+    long long tout_attempts, tout_rejects;
+} HitterBenchArg;
+
+void *hitter_bench_worker(void *p) {
+    HitterBenchArg *a = (HitterBenchArg*)p;
+    Booking b;
+    memset(&b, 0, sizeof(b));
+    unsigned int r = 777u + (unsigned int)a->tid * 7919u;
+    for (int i = 0; i < a->n; ++i) {
+        r = r * 1103515245u + 12345u;
+        int tout = (r >> 4) % 64 == 0;      // 1 in 64 from one of 8 touts, mostly turned away
+        int who = tout ? (int)((r >> 10) % 8) : 8 + (int)((r >> 10) % (unsigned int)a->names);
+        snprintf(b.passenger_name, sizeof(b.passenger_name), "Passenger %d", who);
+        b.owner_id = who % 4 == 0 ? 1 + who / 4 : 0;
+        b.train_id = store->trains[(r >> 20) % MAX_TRAINS].id;
+        int rejected = tout ? (r >> 24) % 4 != 0 : (r >> 24) % 32 == 0;
+        hitters_count(&b, rejected);
+        a->tout_attempts += tout;
+        a->tout_rejects += tout && rejected;
+    }
+    return NULL;
+}
+
+/* Heavy-hitter counting from several threads at once: cost per attempt, and whether
+   touts hidden among many one-off names come out on top with sane estimates */
+int bench_hitters(int argc, char **argv) {
+    int nthreads = argc > 0 ? atoi(argv[0]) : 4;
+    int per_thread = argc > 1 ? atoi(argv[1]) : 1000000;
+    int names = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > 64) nthreads = 64;
+    if (per_thread < 1) per_thread = 1;
+    if (names < 1) names = 1;
+    reset_hitters();
+    pthread_t th[64];
+    HitterBenchArg args[64];
+    PerfSample ps;
+    perf_begin();
+    long long t0 = mono_ns();
+    for (int i = 0; i < nthreads; ++i) {
+        memset(&args[i], 0, sizeof(args[i]));
+        args[i].tid = i;
+        args[i].n = per_thread;
+        args[i].names = names;
+        start_store_thread(&th[i], hitter_bench_worker, &args[i]);
+    }
+    long long tout_attempts = 0, tout_rejects = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(th[i], NULL);
+        tout_attempts += args[i].tout_attempts;
+        tout_rejects += args[i].tout_rejects;
+    }
+    long long elapsed = mono_ns() - t0;
+    perf_end(&ps);
+    long long total = (long long)nthreads * per_thread;
+    printf("hitters: %d threads x %d attempts over %d names, sketch %dx%d, top %d (%.1f MB)\n", nthreads, per_thread,
+           names, HITTER_DEPTH, HITTER_WIDTH, HITTER_K, (double)sizeof(Hitters) / (1024 * 1024));
+    printf("  %6.1f ns/attempt, %.2f M attempts/s\n", (double)elapsed / total, total / (elapsed / 1e3));
+    for (int list = HIT_NAME_ATTEMPTS; list <= HIT_NAME_REJECTS; ++list) {
+        HitterRow rows[HITTER_K];
+        int n = hitter_rows(list, rows), found = 0;
+        unsigned int low = ~0u, high = 0;
+        for (int i = 0; i < n && i < 8; ++i) {
+            int who = -1;
+            if (sscanf(rows[i].label, "Passenger %d", &who) == 1 && who >= 0 && who < 8) {
+                found++;
+                if (rows[i].count < low) low = rows[i].count;
+                if (rows[i].count > high) high = rows[i].count;
+            }
+        }
+        long long exact = (list == HIT_NAME_ATTEMPTS ? tout_attempts : tout_rejects) / 8;
+        printf("  %s: %d of 8 touts in the top 8, estimates %u..%u (about %lld each)\n", hitter_list_names[list],
+               found, found ? low : 0, high, exact);
+    }
+    perf_report(&ps, total);
+    print_hitters(3);
+    return 0;
+}
+
+/* Same-day rule on growing stores: one trip set probe per booking, against walking
+   the list for the passenger's other journeys that day */
+int bench_same_day(int argc, char **argv) {
+    static char *defaults[] = { "100000", "1000000", "4000000" };
+    static const char *names[] = {"Aarav Sharma", "Priya Patel", "Rahul Iyer", "Ananya Reddy", "Vikram Das"};
+    int checks = 200000;
+    if (argc == 0) {
+        argc = 3;
+        argv = defaults;
+    }
+    if (!dup_same_day) dup_same_day = 1;
+    for (int a = 0; a < argc; ++a) {
+        int n = atoi(argv[a]);
+        if (n < 1) continue;
+        free_all();
+        make_synthetic_bookings(n);
+        Booking b;
+        memset(&b, 0, sizeof(b));
+        unsigned int r = 4711;
+        long long hits = 0;
+        PerfSample ps;
+        perf_begin();
+        long long t0 = mono_ns();
+        for (int i = 0; i < checks; ++i) {
+            r = r * 1103515245u + 12345u;
+            strcpy(b.passenger_name, names[(r >> 8) % 5]);
+            b.age = 5 + (int)((r >> 12) % 80);
+            b.journey_date = 20250101 + (int)((r >> 20) % 28);
+            b.train_id = store->trains[(r >> 24) % MAX_TRAINS].id;
+            pthread_mutex_lock(&store->lock);
+            DupSlot *d = trip_find(trip_key(&b));   // the probe; a hit is then confirmed by the walk below
+            hits += d && d->count;
+            pthread_mutex_unlock(&store->lock);
+        }
+        long long indexed = mono_ns() - t0;
+        perf_end(&ps);
+        printf("same-day: %d bookings, %s rule\n", n, dup_same_day == 1 ? "same-route" : "any-train");
+        printf("  %-12s %9.1f ns/check, %.1f%% already travelling\n", "trip set", (double)indexed / checks,
+               100.0 * hits / checks);
+        perf_report(&ps, checks);
+
+        int walks = 20;
+        hits = 0;
+        perf_begin();
+        t0 = mono_ns();
+        for (int i = 0; i < walks; ++i) {
+            r = r * 1103515245u + 12345u;
+            strcpy(b.passenger_name, names[(r >> 8) % 5]);
+            b.age = 5 + (int)((r >> 12) % 80);
+            b.journey_date = 20250101 + (int)((r >> 20) % 28);
+            b.train_id = store->trains[(r >> 24) % MAX_TRAINS].id;
+            unsigned long long want = trip_key(&b);
+            for (Node *c = store->head; c; c = c->next)
+                if (c->b.age == b.age && c->b.journey_date == b.journey_date && trip_key(&c->b) == want) {
+                    hits++;
+                    break;
+                }
+        }
+        long long walked = mono_ns() - t0;
+        perf_end(&ps);
+        printf("  %-12s %9.0f ns/check\n", "list walk", (double)walked / walks);
+        perf_report(&ps, walks);
+    }
+    free_all();
+    return 0;
+}
+
+/* Fare quotes on growing stores: the band from train_booked[] against recounting
+   the train's bookings for every quote */
+int bench_fares(int argc, char **argv) {
+    static char *defaults[] = { "10000", "1000000" };
+    int quotes = 1000000;
+    if (argc == 0) {
+        argc = 2;
+        argv = defaults;
+    }
+    int saved_dynamic = dynamic_fares;
+    dynamic_fares = 1;
+    for (int a = 0; a < argc; ++a) {
+        int n = atoi(argv[a]);
+        if (n < 1) continue;
+        free_all();
+        for (int i = 0; i < MAX_TRAINS; ++i) store->trains[i].total_seats = n / MAX_TRAINS + n / (MAX_TRAINS * 4);
+        make_synthetic_bookings(n);
+        long long sum = 0;
+        PerfSample ps;
+        perf_begin();
+        long long t0 = mono_ns();
+        for (int i = 0; i < quotes; ++i) {
+            pthread_mutex_lock(&store->lock);
+            sum += current_fare(&store->trains[i % MAX_TRAINS]);
+            pthread_mutex_unlock(&store->lock);
+        }
+        long long counted = mono_ns() - t0;
+        perf_end(&ps);
+        printf("fares: %d bookings, %d seats per train\n", n, store->trains[0].total_seats);
+        printf("  %-12s %9.1f ns/quote, average fare %.0f\n", "counters", (double)counted / quotes, (double)sum / quotes);
+        perf_report(&ps, quotes);
+
+        int recounts = 20;
+        sum = 0;
+        perf_begin();
+        t0 = mono_ns();
+        for (int i = 0; i < recounts; ++i) {
+            const Train *t = &store->trains[i % MAX_TRAINS];
+            int booked = 0;
+            for (Node *c = store->head; c; c = c->next) booked += c->b.train_id == t->id;
+            sum += band_fare(t, fare_band(booked, t->total_seats));
+        }
+        long long walked = mono_ns() - t0;
+        perf_end(&ps);
+        printf("  %-12s %9.0f ns/quote, average fare %.0f\n", "recount", (double)walked / recounts, (double)sum / recounts);
+        perf_report(&ps, recounts);
+    }
+    dynamic_fares = saved_dynamic;
+    free_all();
+    return 0;
+}
+
+/* Train listings between bookings: served from the response cache, rebuilt every
+   time, and with a booking landing every `every` listings */
+int bench_listing(int argc, char **argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 1000000;
+    int every = argc > 1 ? atoi(argv[1]) : 100;
+    if (n < 1) n = 1;
+    if (every < 1) every = 1;
+    for (int i = 0; i < MAX_TRAINS; ++i) store->trains[i].total_seats = 1 << 30;
+    char text[LISTING_TEXT_SIZE];
+    int avail[MAX_TRAINS];
+    long long chars = 0;
+    printf("listing: %d listings of %d trains\n", n, MAX_TRAINS);
+    for (int mode = 0; mode < 3; ++mode) {
+        long long hits0 = store->response_hits, misses0 = store->response_misses;
+        PerfSample ps;
+        perf_begin();
+        long long t0 = mono_ns();
+        for (int i = 0; i < n; ++i) {
+            if (mode == 2 && i % every == 0) {
+                Booking bk;
+                memset(&bk, 0, sizeof(bk));
+                snprintf(bk.passenger_name, sizeof(bk.passenger_name), "Listing Passenger %d", i);
+                bk.age = 30;
+                strcpy(bk.gender, "Other");
+                bk.train_id = store->trains[(i / every) % MAX_TRAINS].id;
+                strcpy(bk.travel_class, "SL");
+                place_booking(&bk, NULL, NULL, 0);
+            }
+            pthread_mutex_lock(&store->lock);
+            if (mode == 1) store->response_cache[0].valid = 0;
+            const CachedResponse *e = cached_response(0);
+            memcpy(avail, e->avail, sizeof(avail));
+            memcpy(text, e->text, sizeof(text));
+            pthread_mutex_unlock(&store->lock);
+            chars += (long long)strlen(text) + avail[0] % 2;
+        }
+        long long elapsed = mono_ns() - t0;
+        perf_end(&ps);
+        static const char *names[] = { "cached", "rebuilt", "with bookings" };
+        printf("  %-14s %7.1f ns/listing, %lld hits, %lld misses\n", names[mode], (double)elapsed / n,
+               store->response_hits - hits0, store->response_misses - misses0);
+        perf_report(&ps, n);
+    }
+    if (!chars) printf("  (empty listing)\n");
+    free_all();
+    return 0;
+}
+
+/* Two operators on one worker pool: a flash sale floods one with bookings while the
+   other books at a steady pace. Reports the steady operator's latency when the
+   flood is held to its default worker cap and when it may take every worker. */
+int bench_tenants(int argc, char **argv) {
+    int workers = argc > 0 ? atoi(argv[0]) : 4;
+    int flood = argc > 1 ? atoi(argv[1]) : 2000;
+    int latency = argc > 2 ? atoi(argv[2]) : 2;
+    int steady = 100;
+    if (workers < 2) workers = 2;
+    if (workers > MAX_SERVE_WORKERS) workers = MAX_SERVE_WORKERS;
+    if (flood < 1) flood = 1;
+    if (latency < 1) latency = 1;
+    int saved_latency = sim_gateway.latency_ms;
+    sim_gateway.latency_ms = latency;
+    Store *home = store;
+    char date[16];
+    format_date(today_date(), date, sizeof(date));
+    // spread the steady bookings over about the time the flood takes
+    int pace_ms = (int)((long long)flood * latency / workers / steady);
+    printf("tenants: %d workers, %d flash-sale bookings, %d steady ones every %d ms, %d ms payments\n",
+           workers, flood, steady, pace_ms, latency);
+    for (int mode = 0; mode < 2; ++mode) {
+        Store *s[2];
+        for (int k = 0; k < 2; ++k) {
+            char name[MAX_TENANT_NAME];
+            snprintf(name, sizeof(name), "%s%d", k ? "steady" : "flood", mode);
+            s[k] = new_store(name, "");
+            if (!s[k]) return 1;
+            for (int i = 0; i < MAX_TRAINS; ++i) s[k]->trains[i].total_seats = 1 << 30;
+            s[k]->queue_cap = flood + steady;
+            serve_add_store(s[k]);
+        }
+        s[0]->max_workers = mode ? workers : 0;
+        pthread_t tids[MAX_SERVE_WORKERS];
+        serve_start(tids, workers);
+        long long t0 = mono_ns();
+        char text[SERVE_LINE];
+        for (int i = 0; i < flood; ++i) {
+            snprintf(text, sizeof(text), "book|Flood Passenger %d|30|Other|%d|SL|%s", i,
+                     s[0]->trains[i % MAX_TRAINS].id, date);
+            serve_submit(s[0], i, text);
+        }
+        for (int i = 0; i < steady; ++i) {
+            snprintf(text, sizeof(text), "book|Steady Passenger %d|30|Other|%d|SL|%s", i,
+                     s[1]->trains[i % MAX_TRAINS].id, date);
+            serve_submit(s[1], i, text);
+            sleep_ms(pace_ms);
+        }
+        serve_finish(tids, workers);
+        long long elapsed = mono_ns() - t0;
+        long long p50, p99, f50, f99;
+        serve_latency(s[1], &p50, &p99);
+        serve_latency(s[0], &f50, &f99);
+        pthread_mutex_lock(&serve_lock);
+        int cap = serve_cap(s[0]);
+        pthread_mutex_unlock(&serve_lock);
+        printf("  flood on %d of %d workers: steady p50 %6.2f ms p99 %6.2f ms, flood p50 %7.1f ms, %.0f bookings/s\n",
+               cap, workers, p50 / 1e6, p99 / 1e6, f50 / 1e6, (flood + steady) / (elapsed / 1e9));
+        serve_remove_stores();
+        for (int k = 0; k < 2; ++k) {
+            store = s[k];
+            free_all();
+        }
+        store = home;
+    }
+    sim_gateway.latency_ms = saved_latency;
+    return 0;
+}
+
+Benchmark benchmarks[] = {
+    {"payment", "[threads] [per_thread] [latency_ms]", bench_payment},
+    {"compress", "[bookings]", bench_compress},
+    {"restart", "[bookings]", bench_restart},
+    {"journal", "[threads] [commits_per_thread]", bench_journal},
+    {"ids", "[threads] [ids_per_thread]", bench_ids},
+    {"multiget", "[bookings] [batch] [lookups]", bench_multiget},
+    {"events", "[threads] [lines_per_thread]", bench_events},
+    {"trace", "[bookings]", bench_trace},
+    {"memory", "[bookings...]", bench_memory},
+    {"stations", "[stations] [queries]", bench_stations},
+    {"codes", "[lookups]", bench_codes},
+    {"owners", "[bookings...]", bench_owners},
+    {"velocity", "[names] [checks]", bench_velocity},
+    {"hitters", "[threads] [attempts/thread] [names]", bench_hitters},
+    {"sameday", "[bookings...]", bench_same_day},
+    {"fares", "[bookings...]", bench_fares},
+    {"listing", "[listings] [listings per booking]", bench_listing},
+    {"tenants", "[workers] [flash_sale_bookings] [latency_ms]", bench_tenants},
+};
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+int run_benchmarks(int argc, char **argv) {
+    persist_enabled = 0;
+    perf_enabled = env_int("RB_PERF", 0);
+    if (argc == 0) {
+        for (int i = 0; i < NUM_BENCHMARKS; ++i) benchmarks[i].run(0, NULL);
+        return 0;
     }
-    head = NULL;
+    for (int i = 0; i < NUM_BENCHMARKS; ++i)
+        if (strcmp(argv[0], benchmarks[i].name) == 0)
+            return benchmarks[i].run(argc - 1, argv + 1);
+    printf("Unknown benchmark '%s'. Available:\n", argv[0]);
+    for (int i = 0; i < NUM_BENCHMARKS; ++i)
+        printf("  %s %s\n", benchmarks[i].name, benchmarks[i].usage);
+    return 1;
 }
 
 void show_menu() {
@@ -448,16 +7961,85 @@ void show_menu() {
     printf("4. Search Booking by ID\n");
     printf("5. Cancel Booking\n");
     printf("6. Exit\n");
+    printf("7. Switch Operator\n");
+    printf("8. %s\n", session_user(menu_session) ? "Log Out" : "Log In");
+    printf("9. My Bookings\n");
+    printf("10. Booking Stats\n");
     printf("Enter choice: ");
 }
 
-int main() {
-    load_bookings();
+int main(int argc, char **argv) {
+    init_payment();
+    snapshot_compress = env_int("RB_COMPRESS", 0);
+    load_threads = env_int("RB_LOAD_THREADS", 4);
+    journal_enabled = env_int("RB_JOURNAL", 1);
+    num_journals = env_int("RB_JOURNALS", 4);
+    checkpoint_every = env_int("RB_CHECKPOINT_EVERY", 10000);
+    id_block = env_int("RB_ID_BLOCK", 64);
+    journal_fsync = env_int("RB_JOURNAL_FSYNC", 0);
+    session_idle_s = env_int("RB_SESSION_IDLE_S", 1800);
+    velocity_name_limit = env_int("RB_VELOCITY_NAME", 4);
+    velocity_user_limit = env_int("RB_VELOCITY_USER", 6);
+    velocity_window_s = env_int("RB_VELOCITY_WINDOW_S", 3600);
+    dynamic_fares = env_int("RB_DYNAMIC_FARES", 1);
+    dup_same_day = env_int("RB_DUP_SAME_DAY", 1);
+#ifdef _WIN32
+    journal_enabled = 0;    // journals use POSIX descriptors
+#endif
+    if (argc > 1 && strcmp(argv[1], "events") == 0)
+        return decode_event_log(argc > 2 ? argv[2] : "events.log");
+    const char *event_log = getenv("RB_EVENT_LOG");
+    if (event_log && *event_log) {
+        if (start_event_log(event_log) == 0) atexit(stop_event_log);
+        else printf("Warning: cannot open event log %s\n", event_log);
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        store = new_store("", "");
+        return run_benchmarks(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "serve") == 0)
+        return serve(argc - 2, argv + 2);
+    const char *tenant_name = getenv("RB_TENANT");
+    if (!tenant_name) tenant_name = "";
+    store = tenant_store(tenant_name);
+    if (!store) return 1;
+    char bookings_path[MAX_STORE_PATH];
+    store_path(BOOKINGS_FILE, bookings_path, sizeof(bookings_path));
+    if (argc > 2 && strcmp(argv[1], "archive") == 0)
+        return archive_bookings(atoi(argv[2]));
+    if (argc > 1 && strcmp(argv[1], "migrate") == 0)
+        return migrate_snapshot(argc > 2 ? argv[2] : bookings_path,
+                                argc > 3 ? argv[3] : (argc > 2 ? argv[2] : bookings_path));
+    if (argc > 1 && strcmp(argv[1], "lookup") == 0)
+        return lookup_bookings(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "stations") == 0)
+        return station_lookup(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "stats") == 0)
+        return memory_stats();
+    if (argc > 1 && strcmp(argv[1], "replay") == 0)
+        return replay_capture(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "fsck") == 0)
+        return fsck_bookings(argc > 2 ? argv[2] : bookings_path);
+    if (argc > 2 && strcmp(argv[1], "backup") == 0) {
+        int mbps = argc > 3 ? atoi(argv[3]) : env_int("RB_BACKUP_MBPS", 0);
+        return backup_bookings(argv[2], (long long)mbps * 1024 * 1024);
+    }
+    if (open_tenant(tenant_name) != 0) return 1;
+    const char *trace = getenv("RB_TRACE");
+    if (trace && *trace) {
+        if (start_trace(trace) == 0) atexit(stop_trace);
+        else printf("Warning: cannot open trace file %s\n", trace);
+    }
+    const char *capture = getenv("RB_CAPTURE");
+    if (capture && *capture) {
+        if (start_capture(capture) == 0) atexit(stop_capture);
+        else printf("Warning: cannot open capture file %s\n", capture);
+    }
     int choice;
     while (1) {
         show_menu();
         if (scanf("%d", &choice) != 1) {
-            printf("Invalid input. Please enter a number 1-6.\n");
+            printf("Invalid input. Please enter a number 1-10.\n");
             while (getchar() != '\n');
             continue;
         }
@@ -469,12 +8051,15 @@ int main() {
             case 4: search_booking(); break;
             case 5: cancel_booking(); break;
             case 6:
-                save_bookings();
-                free_all();
+                close_stores();
                 printf("Goodbye!\n");
                 exit(0);
+            case 7: change_operator(); break;
+            case 8: log_in_out(); break;
+            case 9: my_bookings(); break;
+            case 10: booking_stats(); break;
             default:
-                printf("Invalid choice. Please choose 1-6.\n");
+                printf("Invalid choice. Please choose 1-10.\n");
         }
     }
     return 0;